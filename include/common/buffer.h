@@ -42,13 +42,23 @@ struct buffer_wait {
 	struct list list;          /* Next element in the <buffer_wq> list */
 };
 
+/* Buffers may be allocated from up to BUF_CLASSES pools of increasing sizes
+ * (small, medium, and large which is tune.bufsize). Only the enabled classes
+ * are listed in pool_head_buffer_class[], from the smallest to the largest,
+ * the last one always being pool_head_buffer.
+ */
+#define BUF_CLASSES 3
+
 extern struct pool_head *pool_head_buffer;
+extern struct pool_head *pool_head_buffer_class[BUF_CLASSES];
+extern int nb_buffer_classes;
 extern struct list buffer_wq;
 __decl_hathreads(extern HA_SPINLOCK_T buffer_wq_lock);
 
 int init_buffer();
 void deinit_buffer();
 void buffer_dump(FILE *o, struct buffer *b, int from, int to);
+int b_grow(struct buffer *buf, size_t size, int margin);
 
 /*****************************************************************/
 /* These functions are used to compute various buffer area sizes */
@@ -67,6 +77,31 @@ static inline int buffer_almost_full(const struct buffer *buf)
 /* Functions below are used for buffer allocation */
 /**************************************************/
 
+/* Returns the pool allocated buffer <buf> belongs to, which is found from its
+ * size since buffers may be swapped between users of different classes.
+ */
+static inline struct pool_head *b_pool(const struct buffer *buf)
+{
+	int cls;
+
+	if (likely(buf->size == pool_head_buffer->size))
+		return pool_head_buffer;
+
+	for (cls = 0; cls < nb_buffer_classes - 1; cls++) {
+		if (buf->size == pool_head_buffer_class[cls]->size)
+			return pool_head_buffer_class[cls];
+	}
+	return pool_head_buffer;
+}
+
+/* Returns non-zero if allocated buffer <buf> may still be replaced with one of
+ * a larger size class.
+ */
+static inline int b_may_grow(const struct buffer *buf)
+{
+	return buf->size && buf->size < pool_head_buffer->size;
+}
+
 /* Allocates a buffer and assigns it to *buf. If no memory is available,
  * ((char *)1) is assigned instead with a zero size. No control is made to
  * check if *buf already pointed to another buffer. The allocated buffer is
@@ -110,7 +145,7 @@ static inline struct buffer *b_alloc_fast(struct buffer *buf)
 /* Releases buffer <buf> (no check of emptiness) */
 static inline void __b_drop(struct buffer *buf)
 {
-	pool_free(pool_head_buffer, buf->area);
+	pool_free(b_pool(buf), buf->area);
 }
 
 /* Releases buffer <buf> if allocated. */
@@ -127,18 +162,19 @@ static inline void b_free(struct buffer *buf)
 	*buf = BUF_NULL;
 }
 
-/* Ensures that <buf> is allocated. If an allocation is needed, it ensures that
- * there are still at least <margin> buffers available in the pool after this
- * allocation so that we don't leave the pool in a condition where a session or
- * a response buffer could not be allocated anymore, resulting in a deadlock.
- * This means that we sometimes need to try to allocate extra entries even if
- * only one buffer is needed.
+/* Ensures that <buf> is allocated from pool <pool>, which must be one of the
+ * buffer class pools. If an allocation is needed, it ensures that there are
+ * still at least <margin> buffers available in the pool after this allocation
+ * so that we don't leave the pool in a condition where a session or a response
+ * buffer could not be allocated anymore, resulting in a deadlock. This means
+ * that we sometimes need to try to allocate extra entries even if only one
+ * buffer is needed.
  *
  * We need to lock the pool here to be sure to have <margin> buffers available
  * after the allocation, regardless how many threads that doing it in the same
  * time. So, we use internal and lockless memory functions (prefixed with '__').
  */
-static inline struct buffer *b_alloc_margin(struct buffer *buf, int margin)
+static inline struct buffer *b_alloc_pool_margin(struct buffer *buf, struct pool_head *pool, int margin)
 {
 	char *area;
 
@@ -147,26 +183,33 @@ static inline struct buffer *b_alloc_margin(struct buffer *buf, int margin)
 
 	*buf = BUF_WANTED;
 
+	/* the local cache does not reduce what other threads may find in the
+	 * shared list, so it may be used regardless of the margin.
+	 */
+	area = pool_get_from_cache(pool);
+	if (likely(area))
+		goto done;
+
 #ifndef CONFIG_HAP_LOCKLESS_POOLS
-	HA_SPIN_LOCK(POOL_LOCK, &pool_head_buffer->lock);
+	HA_SPIN_LOCK(POOL_LOCK, &pool->lock);
 #endif
 
 	/* fast path */
-	if ((pool_head_buffer->allocated - pool_head_buffer->used) > margin) {
-		area = __pool_get_first(pool_head_buffer);
+	if ((pool->allocated - pool->used) > margin) {
+		area = __pool_get_first(pool);
 		if (likely(area)) {
 #ifndef CONFIG_HAP_LOCKLESS_POOLS
-			HA_SPIN_UNLOCK(POOL_LOCK, &pool_head_buffer->lock);
+			HA_SPIN_UNLOCK(POOL_LOCK, &pool->lock);
 #endif
 			goto done;
 		}
 	}
 
 	/* slow path, uses malloc() */
-	area = __pool_refill_alloc(pool_head_buffer, margin);
+	area = __pool_refill_alloc(pool, margin);
 
 #ifndef CONFIG_HAP_LOCKLESS_POOLS
-	HA_SPIN_UNLOCK(POOL_LOCK, &pool_head_buffer->lock);
+	HA_SPIN_UNLOCK(POOL_LOCK, &pool->lock);
 #endif
 
 	if (unlikely(!area))
@@ -174,10 +217,27 @@ static inline struct buffer *b_alloc_margin(struct buffer *buf, int margin)
 
  done:
 	buf->area = area;
-	buf->size = pool_head_buffer->size;
+	buf->size = pool->size;
 	return buf;
 }
 
+/* Ensures that <buf> is allocated with the largest size (tune.bufsize), see
+ * b_alloc_pool_margin() for the use of <margin>.
+ */
+static inline struct buffer *b_alloc_margin(struct buffer *buf, int margin)
+{
+	return b_alloc_pool_margin(buf, pool_head_buffer, margin);
+}
+
+/* Ensures that <buf> is allocated from the smallest enabled size class, see
+ * b_alloc_pool_margin() for the use of <margin>. Such a buffer may later be
+ * promoted to a larger class using b_grow().
+ */
+static inline struct buffer *b_alloc_small_margin(struct buffer *buf, int margin)
+{
+	return b_alloc_pool_margin(buf, pool_head_buffer_class[0], margin);
+}
+
 
 /* Offer a buffer currently belonging to target <from> to whoever needs one.
  * Any pointer is valid for <from>, including NULL. Its purpose is to avoid
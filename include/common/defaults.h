@@ -140,6 +140,37 @@
 #define RUNQUEUE_DEPTH 200
 #endif
 
+// the max number of tasks an idle thread takes at once from a busier one
+#ifndef STEAL_BATCH
+#define STEAL_BATCH 16
+#endif
+
+// the number of bytes each thread may keep in the local cache of each pool.
+// The number of objects this represents is bounded by POOL_CACHE_MIN and
+// POOL_CACHE_MAX so that small objects do not make the cache too long to
+// walk and large ones still get a few entries.
+#ifndef CONFIG_HAP_POOL_CACHE_SIZE
+#define CONFIG_HAP_POOL_CACHE_SIZE 262144
+#endif
+
+#ifndef POOL_CACHE_MIN
+#define POOL_CACHE_MIN 16
+#endif
+
+#ifndef POOL_CACHE_MAX
+#define POOL_CACHE_MAX 1024
+#endif
+
+// the max number of pools which get a local cache in each thread
+#ifndef MAX_BASE_POOLS
+#define MAX_BASE_POOLS 32
+#endif
+
+// the max number of NUMA nodes a pool arena is split into
+#ifndef MAX_NUMA_NODES
+#define MAX_NUMA_NODES 8
+#endif
+
 // cookie delimitor in "prefix" mode. This character is inserted between the
 // persistence cookie and the original value. The '~' is allowed by RFC6265,
 // and should not be too common in server names.
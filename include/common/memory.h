@@ -55,6 +55,33 @@ struct pool_free_list {
 };
 #endif
 
+/* The part of a pool arena bound to a NUMA node. Chunks are carved in order
+ * from <next>, and those released by pool_flush() or pool_gc() are chained
+ * in <free_list> for reuse.
+ */
+struct pool_arena_node {
+	char *area;		/* first chunk of this node */
+	char *end;		/* end of this node's part */
+	char *next;		/* next chunk never handed out */
+	void **free_list;	/* chunks given back to the arena */
+	unsigned int used;	/* chunks currently handed out */
+	unsigned int chunks;	/* total number of chunks */
+	__decl_hathreads(HA_SPINLOCK_T lock);
+} __attribute__((aligned(64)));
+
+/* A preallocated area from which a pool takes its objects, backed by huge
+ * pages when possible and split into one part per NUMA node.
+ */
+struct pool_arena {
+	void *base;		/* start of the mapping */
+	size_t size;		/* size of the mapping */
+	unsigned int chunk;	/* size of a chunk, >= the pool's size */
+	unsigned int fallbacks;	/* allocations not served by the arena */
+	int nbnodes;		/* number of NUMA nodes */
+	int hugetlb;		/* 1 if mapped from hugetlbfs, 0 for transparent huge pages */
+	struct pool_arena_node node[MAX_NUMA_NODES];
+};
+
 struct pool_head {
 	void **free_list;
 #ifdef CONFIG_HAP_LOCKLESS_POOLS
@@ -70,10 +97,29 @@ struct pool_head {
 	unsigned int flags;	/* MEM_F_* */
 	unsigned int users;	/* number of pools sharing this zone */
 	unsigned int failed;	/* failed allocations */
+	int cache_idx;		/* index in pool_cache[tid][], or -1 if not cached */
+	unsigned int cache_max;	/* max number of entries in each thread's cache */
+	struct pool_arena *arena; /* arena the entries are taken from, or NULL */
 	struct list list;	/* list of all known pools */
 	char name[12];		/* name of the pool */
 } __attribute__((aligned(64)));
 
+/* The local cache of a pool in a thread. Entries are chained through their
+ * POOL_LINK() and used in LIFO order so that the hottest one is reused first.
+ * They remain accounted as used in the pool.
+ */
+struct pool_cache_head {
+	void **list;		/* last released entry */
+	unsigned int count;	/* number of entries in the list */
+	unsigned long hits;	/* allocations served by the cache */
+	unsigned long misses;	/* allocations which had to use the shared list */
+} __attribute__((aligned(32)));
+
+extern struct pool_cache_head pool_cache[][MAX_BASE_POOLS];
+
+/* threads which are asked to flush their local caches by pool_gc() */
+extern volatile unsigned long pool_cache_flush_req;
+
 /* poison each newly allocated area with this byte if >= 0 */
 extern int mem_poison_byte;
 
@@ -123,6 +169,65 @@ void pool_gc(struct pool_head *pool_ctx);
  */
 void *pool_destroy(struct pool_head *pool);
 
+/* Releases the oldest entries of the current thread's cache of pool <pool>
+ * to the shared list, only keeping the <keep> most recent ones.
+ */
+void pool_evict_from_cache(struct pool_head *pool, struct pool_cache_head *ph, unsigned int keep);
+
+/* Releases the entries of all the current thread's caches to the shared lists */
+void pool_flush_cache();
+
+/* Returns an entry taken from the current thread's cache of pool <pool>, or
+ * NULL if the cache is empty or the pool is not cached.
+ */
+static inline void *pool_get_from_cache(struct pool_head *pool)
+{
+	struct pool_cache_head *ph;
+	void **p;
+
+	if (pool->cache_idx < 0)
+		return NULL;
+
+	ph = &pool_cache[tid][pool->cache_idx];
+	p = ph->list;
+	if (unlikely(!p)) {
+		ph->misses++;
+		return NULL;
+	}
+	ph->list = *POOL_LINK(pool, p);
+	ph->count--;
+	ph->hits++;
+#ifdef DEBUG_MEMORY_POOLS
+	/* keep track of where the element was allocated from */
+	*POOL_LINK(pool, p) = (void *)pool;
+#endif
+	return p;
+}
+
+/* Puts <ptr> into the current thread's cache of pool <pool> and returns
+ * non-zero, or returns zero if the pool is not cached. When the cache grows
+ * past its limit, its oldest half is released at once to the shared list.
+ */
+static inline int pool_put_to_cache(struct pool_head *pool, void *ptr)
+{
+	struct pool_cache_head *ph;
+
+	if (pool->cache_idx < 0)
+		return 0;
+
+#ifdef DEBUG_MEMORY_POOLS
+	/* we'll get late corruption if we refill to the wrong pool or double-free */
+	if (*POOL_LINK(pool, ptr) != (void *)pool)
+		*(volatile int *)0 = 0;
+#endif
+	ph = &pool_cache[tid][pool->cache_idx];
+	*POOL_LINK(pool, ptr) = (void *)ph->list;
+	ph->list = ptr;
+	if (unlikely(++ph->count > pool->cache_max))
+		pool_evict_from_cache(pool, ph, pool->cache_max / 2);
+	return 1;
+}
+
 #ifdef CONFIG_HAP_LOCKLESS_POOLS
 /*
  * Returns a pointer to type <type> taken from the pool <pool_type> if
@@ -157,6 +262,8 @@ static inline void *pool_get_first(struct pool_head *pool)
 {
 	void *ret;
 
+	if ((ret = pool_get_from_cache(pool)) != NULL)
+		return ret;
 	ret = __pool_get_first(pool);
 	return ret;
 }
@@ -170,6 +277,8 @@ static inline void *pool_alloc_dirty(struct pool_head *pool)
 {
 	void *p;
 
+	if ((p = pool_get_from_cache(pool)) != NULL)
+		return p;
 	if ((p = __pool_get_first(pool)) == NULL)
 		p = __pool_refill_alloc(pool, 0);
 	return p;
@@ -211,6 +320,9 @@ static inline void pool_free(struct pool_head *pool, void *ptr)
 {
         if (likely(ptr != NULL)) {
 		void *free_list;
+
+		if (pool_put_to_cache(pool, ptr))
+			return;
 #ifdef DEBUG_MEMORY_POOLS
 		/* we'll get late corruption if we refill to the wrong pool or double-free */
 		if (*POOL_LINK(pool, ptr) != (void *)pool)
@@ -251,6 +363,8 @@ static inline void *pool_get_first(struct pool_head *pool)
 {
 	void *ret;
 
+	if ((ret = pool_get_from_cache(pool)) != NULL)
+		return ret;
 	HA_SPIN_LOCK(POOL_LOCK, &pool->lock);
 	ret = __pool_get_first(pool);
 	HA_SPIN_UNLOCK(POOL_LOCK, &pool->lock);
@@ -266,6 +380,8 @@ static inline void *pool_alloc_dirty(struct pool_head *pool)
 {
 	void *p;
 
+	if ((p = pool_get_from_cache(pool)) != NULL)
+		return p;
 	HA_SPIN_LOCK(POOL_LOCK, &pool->lock);
 	if ((p = __pool_get_first(pool)) == NULL)
 		p = __pool_refill_alloc(pool, 0);
@@ -370,6 +486,8 @@ static inline void *pool_alloc(struct pool_head *pool)
 static inline void pool_free(struct pool_head *pool, void *ptr)
 {
         if (likely(ptr != NULL)) {
+		if (pool_put_to_cache(pool, ptr))
+			return;
 		HA_SPIN_LOCK(POOL_LOCK, &pool->lock);
 #ifdef DEBUG_MEMORY_POOLS
 		/* we'll get late corruption if we refill to the wrong pool or double-free */
@@ -543,6 +543,15 @@ static inline void measure_idle()
 	idle_time = samp_time = 0;
 }
 
+/* returns a monotonic date in nanoseconds, only meant to measure durations */
+static inline unsigned long long now_mono_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 #endif /* _COMMON_TIME_H */
 
 /*
@@ -645,7 +645,10 @@ static inline int channel_recv_limit(const struct channel *chn)
  */
 static inline int channel_full(const struct channel *c, unsigned int reserve)
 {
-	if (b_is_null(&c->buf))
+	/* a buffer which may still be promoted to a larger size class is
+	 * never considered full, its receiver will grow it on demand.
+	 */
+	if (b_is_null(&c->buf) || b_may_grow(&c->buf))
 		return 0;
 
 	return (ci_data(c) + reserve >= c_size(c));
@@ -696,7 +699,8 @@ static inline int ci_space_for_replace(const struct channel *chn)
  * not the last available buffer or it's the response buffer. Unless the buffer
  * is the response buffer, an extra control is made so that we always keep
  * <tune.buffers.reserved> buffers available after this allocation. Returns 0 in
- * case of failure, non-zero otherwise.
+ * case of failure, non-zero otherwise. The buffer is taken from the smallest
+ * enabled size class, see channel_grow_buffer() to promote it.
  *
  * If no buffer are available, the requester, represented by <wait> pointer,
  * will be added in the list of objects waiting for an available buffer.
@@ -708,7 +712,7 @@ static inline int channel_alloc_buffer(struct channel *chn, struct buffer_wait *
 	if (!(chn->flags & CF_ISRESP))
 		margin = global.tune.reserved_bufs;
 
-	if (b_alloc_margin(&chn->buf, margin) != NULL)
+	if (b_alloc_small_margin(&chn->buf, margin) != NULL)
 		return 1;
 
 	if (LIST_ISEMPTY(&wait->list)) {
@@ -720,6 +724,35 @@ static inline int channel_alloc_buffer(struct channel *chn, struct buffer_wait *
 	return 0;
 }
 
+/* Tries to promote the buffer of channel <chn> to the smallest larger size
+ * class holding at least <size> bytes, with the same reserve rules as
+ * channel_alloc_buffer(). Returns non-zero if the buffer was replaced. If no
+ * buffer is available and <wait> is not NULL, the requester is added to the
+ * list of objects waiting for an available buffer. Zero is also returned
+ * without waiting when the buffer is not allocated or no such class exists.
+ */
+static inline int channel_grow_buffer(struct channel *chn, size_t size, struct buffer_wait *wait)
+{
+	int margin = 0;
+
+	if (!b_may_grow(&chn->buf) || size > pool_head_buffer->size)
+		return 0;
+
+	if (!(chn->flags & CF_ISRESP))
+		margin = global.tune.reserved_bufs;
+
+	if (b_grow(&chn->buf, size, margin))
+		return 1;
+
+	if (wait && LIST_ISEMPTY(&wait->list)) {
+		HA_SPIN_LOCK(BUF_WQ_LOCK, &buffer_wq_lock);
+		LIST_ADDQ(&buffer_wq, &wait->list);
+		HA_SPIN_UNLOCK(BUF_WQ_LOCK, &buffer_wq_lock);
+	}
+
+	return 0;
+}
+
 /* Releases a possibly allocated buffer for channel <chn>. If it was not
  * allocated, this function does nothing. Else the buffer is released and we try
  * to wake up as many streams/applets as possible. */
@@ -33,8 +33,8 @@
 
 /* public variables */
 
-extern volatile struct fdlist fd_cache;
-extern volatile struct fdlist fd_cache_local[MAX_THREADS];
+extern struct fdset fd_cache;                     // FDs of several threads with cached events
+extern struct fdset fd_cache_local[MAX_THREADS];  // FDs of a single thread with cached events
 
 extern volatile struct fdlist update_list;
 
@@ -47,8 +47,6 @@ extern THREAD_LOCAL int fd_nbupdt; // number of updates in the list
 
 extern int poller_wr_pipe[MAX_THREADS];
 
-__decl_hathreads(extern HA_RWLOCK_T   __attribute__((aligned(64))) fdcache_lock);    /* global lock to protect fd_cache array */
-
 /* Deletes an FD from the fdsets.
  * The file descriptor is also closed.
  */
@@ -162,28 +160,73 @@ static inline void done_update_polling(int fd)
 	}
 }
 
+/* Adds <fd> to set <set>. Returns non-zero if it was not yet in it. */
+static inline int fdset_add(struct fdset *set, int fd)
+{
+	unsigned int w = fd / LONGBITS;
+	unsigned long sbit = 1UL << (w % LONGBITS);
+
+	if (HA_ATOMIC_BTS(&set->bits[w], fd % LONGBITS))
+		return 0;
+
+	/* the bit must be visible before the summary is checked, which the
+	 * atomic operation above guarantees.
+	 */
+	if (!(((volatile unsigned long *)set->summary)[w / LONGBITS] & sbit))
+		HA_ATOMIC_OR(&set->summary[w / LONGBITS], sbit);
+	return 1;
+}
+
+/* Removes <fd> from set <set>. Its summary bit is left for the walker to
+ * clear once the whole word is empty.
+ */
+static inline void fdset_del(struct fdset *set, int fd)
+{
+	unsigned long bit = 1UL << (fd % LONGBITS);
+
+	if (((volatile unsigned long *)set->bits)[fd / LONGBITS] & bit)
+		HA_ATOMIC_AND(&set->bits[fd / LONGBITS], ~bit);
+}
+
+/* Returns non-zero if <fd> is in set <set> */
+static inline int fdset_isset(const struct fdset *set, int fd)
+{
+	return !!(((volatile unsigned long *)set->bits)[fd / LONGBITS] & (1UL << (fd % LONGBITS)));
+}
+
+/* Returns the FD cache set in which <fd> is placed, depending on the threads
+ * it belongs to.
+ */
+static inline struct fdset *fd_cache_set(const int fd)
+{
+	unsigned long mask = fdtab[fd].thread_mask;
+
+	if (mask && !(mask & (mask - 1)))
+		return &fd_cache_local[my_ffsl(mask) - 1];
+	return &fd_cache;
+}
+
+/* Returns non-zero if <fd> has a cache entry */
+static inline int fd_in_cache(const int fd)
+{
+	return fdset_isset(fd_cache_set(fd), fd);
+}
+
 /* Allocates a cache entry for a file descriptor if it does not yet have one.
  * This can be done at any time.
  */
 static inline void fd_alloc_cache_entry(const int fd)
 {
-	HA_ATOMIC_OR(&fd_cache_mask, fdtab[fd].thread_mask);
-	if (!(fdtab[fd].thread_mask & (fdtab[fd].thread_mask - 1)))
-		fd_add_to_fd_list(&fd_cache_local[my_ffsl(fdtab[fd].thread_mask) - 1], fd,  offsetof(struct fdtab, cache));
-	else
-		fd_add_to_fd_list(&fd_cache, fd,  offsetof(struct fdtab, cache));
+	unsigned long mask = fdtab[fd].thread_mask;
+
+	if (fdset_add(fd_cache_set(fd), fd) && (fd_cache_mask & mask) != mask)
+		HA_ATOMIC_OR(&fd_cache_mask, mask);
 }
 
-/* Removes entry used by fd <fd> from the FD cache and replaces it with the
- * last one.
- * If the fd has no entry assigned, return immediately.
- */
+/* Removes the cache entry used by fd <fd>, if any. */
 static inline void fd_release_cache_entry(const int fd)
 {
-	if (!(fdtab[fd].thread_mask & (fdtab[fd].thread_mask - 1)))
-		fd_rm_from_fd_list(&fd_cache_local[my_ffsl(fdtab[fd].thread_mask) - 1], fd, offsetof(struct fdtab, cache));
-	else
-		fd_rm_from_fd_list(&fd_cache, fd, offsetof(struct fdtab, cache));
+	fdset_del(fd_cache_set(fd), fd);
 }
 
 /* This function automatically enables/disables caching for an entry depending
@@ -0,0 +1,29 @@
+/*
+ * include/proto/flt_json.h
+ * This file defines function prototypes for the json filter.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef _PROTO_FLT_JSON_H
+#define _PROTO_FLT_JSON_H
+
+#include <types/proxy.h>
+#include <types/stats.h>
+
+extern const char *json_flt_id;
+
+void flt_json_fill_stats(struct proxy *px, struct field *stats);
+
+#endif // _PROTO_FLT_JSON_H
@@ -30,6 +30,7 @@
 #include <common/mini-clist.h>
 #include <common/standard.h>
 #include <common/ticks.h>
+#include <common/time.h>
 #include <common/hathreads.h>
 
 #include <eb32sctree.h>
@@ -74,6 +75,13 @@
  *   - timer is the real expiration date (possibly infinite)
  *   - node->key is always before or equal to timer
  *
+ * When "tune.timers wheel" is set, the per-thread wait queues are hierarchical
+ * timer wheels instead of trees (see struct timer_wheel). Queuing and removing
+ * a task then only are list operations, and the same rules apply : the task's
+ * wq.key is the date it was queued for, never later than its expire date, and
+ * it is only moved when it gets closer. Tasks bound to several threads always
+ * use the global tree.
+ *
  * The run queue works similarly to the wait queue except that the current date
  * is replaced by an insertion counter which can also wrap without any problem.
  */
@@ -102,15 +110,22 @@ extern int global_rqueue_size; /* Number of element sin the global runqueue */
 /* force to split per-thread stuff into separate cache lines */
 struct task_per_thread {
 	struct eb_root timers;  /* tree constituting the per-thread wait queue */
+	struct timer_wheel *wheel; /* per-thread wait queue used instead of <timers> if not NULL */
 	struct eb_root rqueue;  /* tree constituting the per-thread run queue */
 	struct list task_list;  /* List of tasks to be run, mixing tasks and tasklets */
 	int task_list_size;     /* Number of tasks in the task_list */
 	int rqueue_size;        /* Number of elements in the per-thread run queue */
+	/* written by the other threads, kept away from the fields above */
+	__attribute__((aligned(64))) struct task *inbox; /* tasks woken up by other threads, last first */
+	unsigned long steal_req; /* idle threads waiting for some of our tasks */
 	__attribute__((aligned(64))) char end[0];
 };
 
 extern struct task_per_thread task_per_thread[MAX_THREADS];
 
+extern unsigned int profiling;  /* bitfield of HA_PROF_* */
+extern struct task_prof task_prof[MAX_THREADS][TASK_PROF_HANDLERS];
+
 __decl_hathreads(extern HA_SPINLOCK_T rq_lock);  /* spin lock related to run queue */
 __decl_hathreads(extern HA_SPINLOCK_T wq_lock);  /* spin lock related to wait queue */
 
@@ -132,29 +147,38 @@ static inline int task_in_wq(struct task *t)
 	return t->wq.node.leaf_p != NULL;
 }
 
-/* puts the task <t> in run queue with reason flags <f>, and returns <t> */
-/* This will put the task in the local runqueue if the task is only runnable
- * by the current thread, in the global runqueue otherwies.
- */
 void __task_wakeup(struct task *t, struct eb_root *);
-static inline void task_wakeup(struct task *t, unsigned int f)
-{
-	unsigned short state;
+void task_drain_inbox();
 
+/* Returns the run queue task <t> must be woken up into: the current thread's
+ * one if it is the only one allowed to run it, the one of the thread it is
+ * bound to if it is another one, or the global one if several threads may run
+ * it. Another thread's run queue is only reached through its inbox, see
+ * __task_wakeup().
+ */
+static inline struct eb_root *task_rq_root(const struct task *t)
+{
 #ifdef USE_THREAD
-	struct eb_root *root;
+	unsigned long mask = t->thread_mask & all_threads_mask;
 
-	if (t->thread_mask == tid_bit || global.nbthread == 1)
-		root = &task_per_thread[tid].rqueue;
-	else
-		root = &rqueue;
+	if (mask == tid_bit || global.nbthread == 1)
+		return &task_per_thread[tid].rqueue;
+	if (mask && !atleast2(mask))
+		return &task_per_thread[my_ffsl(mask) - 1].rqueue;
+	return &rqueue;
 #else
-	struct eb_root *root = &task_per_thread[tid].rqueue;
+	return &task_per_thread[tid].rqueue;
 #endif
+}
+
+/* puts the task <t> in run queue with reason flags <f>, and returns <t> */
+static inline void task_wakeup(struct task *t, unsigned int f)
+{
+	unsigned short state;
 
 	state = HA_ATOMIC_OR(&t->state, f);
 	if (!(state & TASK_RUNNING))
-		__task_wakeup(t, root);
+		__task_wakeup(t, task_rq_root(t));
 }
 
 /* change the thread affinity of a task to <thread_mask> */
@@ -171,7 +195,13 @@ static inline void task_set_affinity(struct task *t, unsigned long thread_mask)
  */
 static inline struct task *__task_unlink_wq(struct task *t)
 {
-	eb32_delete(&t->wq);
+	if (t->wq.node.leaf_p == (void *)0x1) {
+		/* the task is in a timer wheel, see __task_queue_wheel() */
+		LIST_DEL(&t->wl);
+		t->wq.node.leaf_p = NULL;
+	}
+	else
+		eb32_delete(&t->wq);
 	return t;
 }
 
@@ -215,10 +245,23 @@ static inline struct task *__task_unlink_rq(struct task *t)
 }
 
 /* This function unlinks task <t> from the run queue if it is in it. It also
- * takes care of updating the next run queue task if it was this task.
+ * takes care of updating the next run queue task if it was this task. A task
+ * still in another thread's inbox is only marked, and that thread drops it
+ * instead of queueing it, see task_drain_inbox().
  */
 static inline struct task *task_unlink_rq(struct task *t)
 {
+	unsigned short state;
+
+	/* the inbox cannot be walked, the task is looked up in the tree */
+	if (unlikely(t->state & TASK_INBOX)) {
+		task_drain_inbox();
+		state = t->state;
+		while (state & TASK_INBOX) {
+			if (HA_ATOMIC_CAS(&t->state, &state, state | TASK_UNLINK))
+				return t;
+		}
+	}
 	if (t->thread_mask != tid_bit)
 		HA_SPIN_LOCK(TASK_RQ_LOCK, &rq_lock);
 	if (likely(task_in_rq(t))) {
@@ -239,6 +282,8 @@ static inline void tasklet_wakeup(struct tasklet *tl)
 	}
 	if (!LIST_ISEMPTY(&tl->list))
 		return;
+	if (unlikely(profiling & HA_PROF_TASKS))
+		tl->wake_date = now_mono_time();
 	LIST_ADDQ(&task_per_thread[tid].task_list, &tl->list);
 	task_per_thread[tid].task_list_size++;
 	HA_ATOMIC_OR(&active_tasks_mask, tid_bit);
@@ -257,6 +302,8 @@ static inline void task_insert_into_tasklet_list(struct task *t)
 	 */
 	if (unlikely(!HA_ATOMIC_CAS(&t->rq.node.leaf_p, &expected, (void *)0x1)))
 		return;
+	if (unlikely(profiling & HA_PROF_TASKS) && !t->wake_date)
+		t->wake_date = now_mono_time();
 	HA_ATOMIC_ADD(&tasks_run_queue, 1);
 	task_per_thread[tid].task_list_size++;
 	tl = (struct tasklet *)t;
@@ -300,6 +347,8 @@ static inline struct task *task_init(struct task *t, unsigned long thread_mask)
 	t->nice = 0;
 	t->calls = 0;
 	t->expire = TICK_ETERNITY;
+	t->inbox_next = NULL;
+	t->wake_date = 0;
 	return t;
 }
 
@@ -307,6 +356,7 @@ static inline void tasklet_init(struct tasklet *t)
 {
 	t->nice = -32768;
 	t->calls = 0;
+	t->wake_date = 0;
 	t->state = 0;
 	t->process = NULL;
 	LIST_INIT(&t->list);
@@ -351,6 +401,23 @@ static inline void __task_free(struct task *t)
 
 static inline void task_free(struct task *t)
 {
+#ifdef USE_THREAD
+	unsigned short state = t->state;
+
+	/* A task still in another thread's inbox is released by that thread
+	 * once it takes it, see task_drain_inbox(). One it is dropping may
+	 * only be released once it is done with it.
+	 */
+	while (unlikely(state & (TASK_INBOX|TASK_UNLINK))) {
+		if (!(state & TASK_INBOX)) {
+			pl_cpu_relax();
+			state = t->state;
+			continue;
+		}
+		if (HA_ATOMIC_CAS(&t->state, &state, state | TASK_UNLINK | TASK_FREE))
+			return;
+	}
+#endif
 	/* There's no need to protect t->state with a lock, as the task
 	 * has to run on the current thread.
 	 */
@@ -372,6 +439,18 @@ static inline void tasklet_free(struct tasklet *tl)
 }
 
 void __task_queue(struct task *task, struct eb_root *wq);
+void __task_queue_wheel(struct task *task, struct timer_wheel *wheel);
+
+/* Same as __task_queue() for the current thread's wait queue, whichever kind
+ * it is.
+ */
+static inline void __task_queue_local(struct task *task)
+{
+	if (task_per_thread[tid].wheel)
+		__task_queue_wheel(task, task_per_thread[tid].wheel);
+	else
+		__task_queue(task, &task_per_thread[tid].timers);
+}
 
 /* Place <task> into the wait queue, where it may already be. If the expiration
  * timer is infinite, do nothing and rely on wake_expired_task to clean up.
@@ -403,7 +482,7 @@ static inline void task_queue(struct task *task)
 #endif
 	{
 		if (!task_in_wq(task) || tick_is_lt(task->expire, task->wq.key))
-			__task_queue(task, &task_per_thread[tid].timers);
+			__task_queue_local(task);
 	}
 }
 
@@ -435,7 +514,7 @@ static inline void task_schedule(struct task *task, int when)
 
 		task->expire = when;
 		if (!task_in_wq(task) || tick_is_lt(task->expire, task->wq.key))
-			__task_queue(task, &task_per_thread[tid].timers);
+			__task_queue_local(task);
 	}
 }
 
@@ -97,6 +97,9 @@ struct appctx {
 		struct {
 			void *ptr;              /* private pointer for SPOE filter */
 		} spoe;                         /* used by SPOE filter */
+		struct {
+			void *ptr;              /* fan-out sink of the json filter */
+		} json;                         /* used by the json filter */
 		struct {
 			const char *msg;        /* pointer to a persistent message to be returned in CLI_ST_PRINT state */
 			int severity;           /* severity of the message to be returned according to (syslog) rfc5424 */
@@ -110,12 +110,23 @@ struct fdlist {
 	int last;
 } __attribute__ ((aligned(8)));
 
+/* A set of FDs, made of one bit per FD and of a summary holding one bit per
+ * word of FD bits which may be non-zero, so that a sparse set is walked
+ * quickly. Bits are only set and cleared using atomic operations, an FD's
+ * bit first and its word's summary bit next, so that no lock is needed to
+ * add or remove FDs while the set is being walked.
+ */
+struct fdset {
+	unsigned long *bits;                 /* one bit per FD */
+	unsigned long *summary;              /* one bit per word of <bits> */
+	unsigned int nbsum;                  /* number of words of <summary> */
+};
+
 /* info about one given fd */
 struct fdtab {
 	__decl_hathreads(HA_SPINLOCK_T lock);
 	unsigned long thread_mask;           /* mask of thread IDs authorized to process the task */
 	unsigned long update_mask;           /* mask of thread IDs having an update for fd */
-	struct fdlist_entry cache;           /* Entry in the fdcache */
 	struct fdlist_entry update;          /* Entry in the global update list */
 	void (*iocb)(int fd);                /* I/O handler */
 	void *owner;                         /* the connection or listener associated with this fd, NULL if closed */
@@ -67,6 +67,8 @@
 #define GTUNE_SOCKET_TRANSFER	 (1<<8)
 #define GTUNE_NOEXIT_ONFAILURE   (1<<9)
 #define GTUNE_USE_SYSTEMD        (1<<10)
+#define GTUNE_TIMER_WHEEL        (1<<11)
+#define GTUNE_USE_URING          (1<<12)
 
 /* Access level for a stats socket */
 #define ACCESS_LVL_NONE     0
@@ -139,6 +141,8 @@ struct global {
 		int runqueue_depth;/* max number of tasks to run at once */
 		int recv_enough;   /* how many input bytes at once are "enough" */
 		int bufsize;       /* buffer size in bytes, defaults to BUFSIZE */
+		int bufsize_small; /* small buffer class size in bytes, disabled if zero */
+		int bufsize_medium;/* medium buffer class size in bytes, disabled if zero */
 		int maxrewrite;    /* buffer max rewrite size in bytes, defaults to MAXREWRITE */
 		int reserved_bufs; /* how many buffers can only be allocated for response */
 		int buf_limit;     /* if not null, how many total buffers may only be allocated */
@@ -195,6 +199,9 @@ struct activity {
 	unsigned int stream;       // calls to process_stream()
 	unsigned int empty_rq;     // calls to process_runnable_tasks() with nothing for the thread
 	unsigned int long_rq;      // process_runnable_tasks() left with tasks in the run queue
+	unsigned int inbox;        // tasks woken up for this thread by other threads
+	unsigned int steal_req;    // requests for tasks sent to a busier thread
+	unsigned int stolen;       // tasks taken from a busier thread's run queue
 	char __pad[0]; // unused except to check remaining room
 	char __end[0] __attribute__((aligned(64))); // align size to 64.
 };
@@ -214,6 +221,7 @@ extern const int one;
 extern const struct linger nolinger;
 extern int stopping;	/* non zero means stopping in progress */
 extern int killed;	/* non zero means a hard-stop is triggered */
+extern int master;	/* 1 if in master, 0 if in child */
 extern char hostname[MAX_HOSTNAME_LEN];
 extern char localpeer[MAX_HOSTNAME_LEN];
 extern struct list global_listener_queue; /* list of the temporarily limited listeners */
@@ -384,6 +384,9 @@ enum stat_field {
 	ST_F_DCON,
 	ST_F_DSES,
 	ST_F_WREW,
+	ST_F_JSON_REC,
+	ST_F_JSON_FAIL,
+	ST_F_JSON_DROP,
 
 	/* must always be the last one */
 	ST_F_TOTAL_FIELDS
@@ -33,6 +33,9 @@
 #define TASK_SLEEPING     0x0000  /* task sleeping */
 #define TASK_RUNNING      0x0001  /* the task is currently running */
 #define TASK_GLOBAL       0x0002  /* The task is currently in the global runqueue */
+#define TASK_INBOX        0x0004  /* The task is in a thread's wakeup inbox */
+#define TASK_UNLINK       0x0008  /* Unlinked while in another thread's inbox, which drops it */
+#define TASK_FREE         0x0010  /* Freed while in another thread's inbox, which releases it */
 
 #define TASK_WOKEN_INIT   0x0100  /* woken up for initialisation purposes */
 #define TASK_WOKEN_TIMER  0x0200  /* woken up because of expired timer */
@@ -66,6 +69,7 @@ struct notification {
 		unsigned int calls; /* number of times process was called */ \
 		struct task *(*process)(struct task *t, void *ctx, unsigned short state); /* the function which processes the task */ \
 		void *context; /* the task's context */			\
+		unsigned long long wake_date; /* date of the pending wakeup in ns when profiling, or 0 */ \
 	}
 
 /* The base for all tasks */
@@ -73,8 +77,10 @@ struct task {
 	TASK_COMMON;			/* must be at the beginning! */
 	struct eb32sc_node rq;		/* ebtree node used to hold the task in the run queue */
 	struct eb32_node wq;		/* ebtree node used to hold the task in the wait queue */
+	struct list wl;			/* list element used to hold the task in a timer wheel slot */
 	int expire;			/* next expiration date for this task, in ticks */
 	unsigned long thread_mask;	/* mask of thread IDs authorized to process the task */
+	struct task *inbox_next;	/* next task in a thread's wakeup inbox */
 };
 
 /* lightweight tasks, without priority, mainly used for I/Os */
@@ -85,6 +91,43 @@ struct tasklet {
 
 #define TASK_IS_TASKLET(t) ((t)->nice == -32768)
 
+/* bits for the "profiling" variable */
+#define HA_PROF_TASKS      0x00000001  /* per-handler task profiling is enabled */
+
+/* Task profiling : each thread accounts the tasks it runs per handler, in a
+ * small hash table of TASK_PROF_HANDLERS entries indexed on the handler. The
+ * wakeup to run latency is reported in TASK_PROF_BUCKETS power-of-two buckets
+ * of microseconds, the first one being below 1us and the last one above 16ms.
+ */
+#define TASK_PROF_HANDLERS 64
+#define TASK_PROF_BUCKETS  16
+
+struct task_prof {
+	const void *func;                        /* the task handler, or NULL if unused */
+	unsigned long long calls;                /* number of calls */
+	unsigned long long cycles;               /* time spent in the handler, in rdtsc() units */
+	unsigned long long lat_calls;            /* calls for which the wakeup date was known */
+	unsigned long long lat_ns;               /* total wakeup to run latency of these calls */
+	unsigned int lat_hist[TASK_PROF_BUCKETS];  /* calls per latency bucket */
+};
+
+/* A hierarchical timer wheel, used as a per-thread wait queue. Level <l> has
+ * TIMER_WHEEL_SLOTS slots of 2^(TIMER_WHEEL_BITS*l) ticks each, so that six
+ * levels of 64 slots cover the whole 32-bit tick range. A task is placed in
+ * the lowest level where its expiration date shares all the upper bits with
+ * the wheel's current date, and is moved down one or several levels when the
+ * current date reaches its slot.
+ */
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 6
+
+struct timer_wheel {
+	unsigned int cur;                                    /* date of the current level 0 slot, in ticks */
+	unsigned long long map[TIMER_WHEEL_LEVELS];          /* slots which may hold tasks, one bit per slot */
+	struct list slot[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; /* only valid when their bit is set in <map> */
+};
+
 /*
  * The task callback (->process) is responsible for updating ->expire. It must
  * return a pointer to the task itself, except if the task has been deleted, in
@@ -0,0 +1,367 @@
+/*
+ * Benchmark of the json filter parsing modes.
+ *
+ * Records of a configurable size and shape are laid out in a ring buffer
+ * organized like haproxy's struct buffer (area, size, head, data), starting
+ * at every possible head offset so that each record eventually straddles the
+ * wrap. Each mode then runs over the buffer the same way the filter runs over
+ * a channel's input, and the time it takes is reported in bytes/s, records/s
+ * and cycles/byte. The number of records found is checked against the number
+ * of records written.
+ *
+ * usage: jsonbench [-b bufsize] [-s recsize] [-t shape] [-m modes] [-w step] [-r repeat]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jsonsimd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define JSON_BENCH_HAVE_TSC
+#endif
+
+/* a ring buffer shaped like haproxy's struct buffer */
+struct ring {
+	size_t size;  /* buffer size in bytes */
+	char  *area;  /* points to <size> bytes */
+	size_t data;  /* amount of data after head including wrapping */
+	size_t head;  /* start offset of remaining data relative to area */
+};
+
+/* record shapes */
+enum {
+	SHAPE_FLAT = 0,  /* object of scalar members */
+	SHAPE_NESTED,    /* array of small nested objects */
+	SHAPE_ARRAY,     /* object holding a long array of numbers */
+	SHAPE_STRING,    /* object holding a long string with escapes */
+};
+
+static const char * const shape_names[] = { "flat", "nested", "array", "string", NULL };
+
+/* A parsing mode. It runs over the whole data of the ring, and returns the
+ * number of records it found, or -1 if it does not find records.
+ */
+struct mode {
+	const char *name;
+	int (*run)(const struct ring *r);
+};
+
+/* returns the ring's data as a view of up to two blocks */
+static inline void ring_view(const struct ring *r, struct json_view *v)
+{
+	size_t contig = r->size - r->head;
+
+	v->blk1 = r->area + r->head;
+	v->len1 = r->data < contig ? r->data : contig;
+	v->blk2 = r->area;
+	v->len2 = r->data - v->len1;
+}
+
+/* returns a pointer to the byte at offset <ofs> of the ring's data */
+static inline char *ring_peek(const struct ring *r, size_t ofs)
+{
+	ofs += r->head;
+	if (ofs >= r->size)
+		ofs -= r->size;
+	return r->area + ofs;
+}
+
+/* Copies <len> bytes from <src> to the ring, which is emptied first and
+ * starts at <head>.
+ */
+static void ring_fill(struct ring *r, size_t head, const char *src, size_t len)
+{
+	size_t n = r->size - head;
+
+	if (n > len)
+		n = len;
+	r->head = head;
+	r->data = len;
+	memcpy(r->area + head, src, n);
+	memcpy(r->area, src + n, len - n);
+}
+
+/* "noop" mode: everything is forwarded as is */
+static int run_noop(const struct ring *r)
+{
+	return -1;
+}
+
+/* end of the last record found by run_newline(), kept so that the compiler
+ * does not simplify the loops into a mere count */
+static volatile size_t newline_end;
+
+/* "newline" mode: one byte at a time on each side of the wrap */
+static int run_newline(const struct ring *r)
+{
+	struct json_view v;
+	int records = 0;
+	size_t i;
+
+	ring_view(r, &v);
+	for (i = 0; i < v.len1; i++) {
+		if (v.blk1[i] == '\n') {
+			newline_end = i + 1;
+			records++;
+		}
+	}
+	for (i = 0; i < v.len2; i++) {
+		if (v.blk2[i] == '\n') {
+			newline_end = v.len1 + i + 1;
+			records++;
+		}
+	}
+	return records;
+}
+
+/* "newlinesimd" mode: vectorized splitter over both blocks */
+static int run_newline_simd(const struct ring *r)
+{
+	struct json_view v;
+	size_t end;
+
+	ring_view(r, &v);
+	return json_split_lines(&v, 0, r->data, &end);
+}
+
+/* "simd" mode: structural index validator */
+static int run_simd(const struct ring *r)
+{
+	static struct json_simd_state st;
+	struct json_view v;
+
+	ring_view(r, &v);
+	json_simd_init(&st);
+	if (json_simd_scan(&st, &v) == JSON_FAIL)
+		return 0;
+	return st.records;
+}
+
+/* "parser" mode: rapidjson through WrappedMemoryStream, one call per record,
+ * the last byte of the data being a newline which is never parsed.
+ */
+static int run_parser(const struct ring *r)
+{
+	char *origin = r->area;
+	char *buffer_end = r->area + r->size;
+	char *parse_start = ring_peek(r, 0);
+	char *parse_end = ring_peek(r, r->data - 1);
+	char *parsed_til;
+	size_t ofs, prev = 0;
+	int records = 0;
+
+	while (parse_start != parse_end) {
+		if (json_parse_wrap(origin, parse_start, parse_end, buffer_end, &parsed_til, NULL) == JSON_FAIL)
+			break;
+		records++;
+
+		/* stop if the parser does not move forward */
+		ofs = (parsed_til - r->area + r->size - r->head) % r->size;
+		if (ofs <= prev || ofs >= r->data)
+			break;
+		prev = ofs;
+		parse_start = parsed_til;
+	}
+	return records;
+}
+
+static const struct mode modes[] = {
+	{ "noop",        run_noop },
+	{ "newline",     run_newline },
+	{ "newlinesimd", run_newline_simd },
+	{ "parser",      run_parser },
+	{ "simd",        run_simd },
+	{ NULL, NULL }
+};
+
+/* Appends to <out> the member number <i> of a record of shape <shape>, and
+ * returns its length. <out> must have room for 64 bytes.
+ */
+static int record_unit(char *out, int shape, unsigned int i)
+{
+	switch (shape) {
+	case SHAPE_FLAT:
+		switch (i % 4) {
+		case 0:  return sprintf(out, "\"id%u\":%u,", i, i * 7919);
+		case 1:  return sprintf(out, "\"name%u\":\"value-%08x\",", i, i * 2654435761U);
+		case 2:  return sprintf(out, "\"ratio%u\":%u.%02u,", i, i, i % 100);
+		default: return sprintf(out, "\"ok%u\":%s,", i, (i & 4) ? "true" : "null");
+		}
+	case SHAPE_NESTED:
+		return sprintf(out, "{\"a\":[%u,{\"b\":\"c%u\"}],\"d\":{\"e\":null,\"f\":false}},", i, i);
+	case SHAPE_ARRAY:
+		return sprintf(out, "%u,", i * 2654435761U);
+	default:
+		return sprintf(out, (i % 4) ? "lorem ipsum %03u " : "\\\"q%03u\\\"\\n ", i % 1000);
+	}
+}
+
+/* Writes to <out> a record of shape <shape> of at least <size> bytes,
+ * followed by a newline. <out> must have room for <size> + 128 bytes.
+ * Returns its length.
+ */
+static size_t record_build(char *out, size_t size, int shape)
+{
+	static const char * const open[]  = { "{",  "{\"items\":[", "{\"values\":[", "{\"text\":\"" };
+	static const char * const close[] = { "}",  "]}",           "]}",            "\"}" };
+	size_t len;
+	unsigned int i;
+
+	len = sprintf(out, "%s", open[shape]);
+	for (i = 0; len < size || !i; i++)
+		len += record_unit(out + len, shape, i);
+	/* remove the last separator */
+	if (shape != SHAPE_STRING)
+		len--;
+	len += sprintf(out + len, "%s\n", close[shape]);
+	return len;
+}
+
+/* returns a timestamp in nanoseconds */
+static inline unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned long long now_cycles(void)
+{
+#if defined(JSON_BENCH_HAVE_TSC)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+	        "usage: %s [options]\n"
+	        "  -b <size>   ring buffer size (default 16384, as tune.bufsize)\n"
+	        "  -s <size>   approximate record size in bytes (default 256)\n"
+	        "  -t <shape>  record shape: flat, nested, array or string (default flat)\n"
+	        "  -m <modes>  comma-separated modes among noop, newline, newlinesimd,\n"
+	        "              parser and simd (default all)\n"
+	        "  -w <step>   step between two head offsets (default 1, every offset)\n"
+	        "  -r <count>  runs per head offset (default 1)\n",
+	        name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	size_t bufsize = 16384, recsize = 256, step = 1;
+	unsigned int repeat = 1;
+	const char *mode_list = NULL;
+	int shape = SHAPE_FLAT;
+	struct ring ring;
+	char *rec, *input;
+	size_t reclen, inlen;
+	unsigned int nrec;
+	const struct mode *m;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "b:s:t:m:w:r:h")) != -1) {
+		switch (opt) {
+		case 'b': bufsize = strtoul(optarg, NULL, 10); break;
+		case 's': recsize = strtoul(optarg, NULL, 10); break;
+		case 'w': step = strtoul(optarg, NULL, 10); break;
+		case 'r': repeat = strtoul(optarg, NULL, 10); break;
+		case 'm': mode_list = optarg; break;
+		case 't':
+			for (shape = 0; shape_names[shape]; shape++) {
+				if (strcmp(shape_names[shape], optarg) == 0)
+					break;
+			}
+			if (!shape_names[shape])
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!bufsize || !step || !repeat)
+		usage(argv[0]);
+
+	rec = malloc(recsize + 128);
+	if (!rec)
+		return 1;
+	reclen = record_build(rec, recsize, shape);
+	if (reclen > bufsize) {
+		fprintf(stderr, "a %zu-byte record does not fit in a %zu-byte buffer\n", reclen, bufsize);
+		return 1;
+	}
+
+	/* as many complete records as the buffer can hold */
+	nrec = bufsize / reclen;
+	inlen = nrec * reclen;
+	input = malloc(inlen);
+	ring.size = bufsize;
+	ring.area = malloc(bufsize);
+	if (!input || !ring.area)
+		return 1;
+	for (i = 0; i < (int)nrec; i++)
+		memcpy(input + i * reclen, rec, reclen);
+
+	printf("# bufsize=%zu shape=%s record=%zu bytes records/buffer=%u offsets=%zu runs=%u\n",
+	       bufsize, shape_names[shape], reclen, nrec, (bufsize + step - 1) / step, repeat);
+	printf("%-12s %14s %14s %12s %8s\n", "mode", "MB/s", "records/s", "cycles/byte", "check");
+
+	for (m = modes; m->name; m++) {
+		unsigned long long ns = 0, cycles = 0, bytes = 0, records = 0;
+		unsigned long long t0, c0;
+		size_t head;
+		unsigned int run;
+		int found, ok = 1;
+
+		if (mode_list) {
+			const char *p = strstr(mode_list, m->name);
+			size_t l = strlen(m->name);
+
+			/* whole names only, "newline" must not match "newlinesimd" */
+			while (p && ((p != mode_list && p[-1] != ',') || (p[l] && p[l] != ',')))
+				p = strstr(p + 1, m->name);
+			if (!p)
+				continue;
+		}
+
+		for (head = 0; head < bufsize; head += step) {
+			ring_fill(&ring, head, input, inlen);
+			for (run = 0; run < repeat; run++) {
+				t0 = now_ns();
+				c0 = now_cycles();
+				found = m->run(&ring);
+				cycles += now_cycles() - c0;
+				ns += now_ns() - t0;
+				bytes += inlen;
+				if (found >= 0)
+					records += found;
+				if (found >= 0 && found != (int)nrec)
+					ok = 0;
+			}
+		}
+
+		if (!ns)
+			ns = 1;
+		printf("%-12s %14.1f %14.0f ", m->name,
+		       bytes * 1000.0 / ns, records * 1000000000.0 / ns);
+#if defined(JSON_BENCH_HAVE_TSC)
+		printf("%12.3f ", (double)cycles / bytes);
+#else
+		printf("%12s ", "-");
+#endif
+		printf("%8s\n", (m->run == run_noop) ? "-" : ok ? "ok" : "MISMATCH");
+	}
+
+	free(ring.area);
+	free(input);
+	free(rec);
+	return 0;
+}
@@ -0,0 +1,2496 @@
+/*
+ * Structural index based JSON validator.
+ *
+ * Stage 1 works on 64-byte blocks and produces 64-bit masks, one bit per
+ * input byte, for quotes, backslashes, structural characters, whitespaces and
+ * control characters. Backslash runs are resolved to find escaped bytes, then
+ * the unescaped quotes are turned into an "inside a string" mask with a
+ * prefix XOR. What remains outside of the strings gives the structural
+ * characters and the first byte of each scalar (number, true, false, null).
+ * Their offsets are appended to a small index.
+ *
+ * Stage 2 walks the index and runs the JSON grammar on it, maintaining the
+ * nesting stack. A record is complete each time a value closes at the top
+ * level. Strings are entirely checked by stage 1 (control characters, escape
+ * sequences), and only scalars are read byte by byte since they are short.
+ *
+ * The input is a json_view made of up to two blocks. Blocks of 64 bytes which
+ * cross the boundary between them, and the last partial block, are copied to
+ * a small aligned area, so that the hot loop never checks for the wrap.
+ */
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jsonsimd.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define JSON_HAVE_AVX2
+#endif
+
+/* this directory is built on its own, without haproxy's include paths */
+#ifndef likely
+#define likely(x)   (__builtin_expect((x) != 0, 1))
+#define unlikely(x) (__builtin_expect((x) != 0, 0))
+#endif
+
+/* stage 2 states */
+enum {
+	JSON_ST_IDLE = 0,   /* between two records, expecting a value */
+	JSON_ST_VALUE,      /* expecting a value (after ':' or ',' in an array) */
+	JSON_ST_ARRAY_FIRST,/* after '[', expecting a value or ']' */
+	JSON_ST_OBJECT_FIRST, /* after '{', expecting a key or '}' */
+	JSON_ST_KEY,        /* after ',' in an object, expecting a key */
+	JSON_ST_COLON,      /* after a key, expecting ':' */
+	JSON_ST_NEXT,       /* after a value in a container, expecting ',' or a closing char */
+	JSON_ST_STR_KEY,    /* inside a key, expecting the closing quote */
+	JSON_ST_STR_VALUE,  /* inside a string value, expecting the closing quote */
+};
+
+/* number of 64-byte blocks indexed before running stage 2 */
+#define JSON_SIMD_CHUNK_BLOCKS  16
+
+/* byte classes used by stage 1 */
+#define JSON_C_QUOTE   0x01
+#define JSON_C_BSLASH  0x02
+#define JSON_C_OP      0x04
+#define JSON_C_WS      0x08
+#define JSON_C_CTRL    0x10
+
+struct json_masks {
+	uint64_t quote;
+	uint64_t bslash;
+	uint64_t op;
+	uint64_t ws;
+	uint64_t ctrl;
+};
+
+static unsigned char json_class[256];
+
+__attribute__((constructor))
+static void json_simd_init_classes(void)
+{
+	int c;
+
+	for (c = 0; c < 0x20; c++)
+		json_class[c] = JSON_C_CTRL;
+	json_class['"']  |= JSON_C_QUOTE;
+	json_class['\\'] |= JSON_C_BSLASH;
+	json_class['{']  |= JSON_C_OP;
+	json_class['}']  |= JSON_C_OP;
+	json_class['[']  |= JSON_C_OP;
+	json_class[']']  |= JSON_C_OP;
+	json_class[':']  |= JSON_C_OP;
+	json_class[',']  |= JSON_C_OP;
+	json_class[' ']  |= JSON_C_WS;
+	json_class['\t'] |= JSON_C_WS;
+	json_class['\n'] |= JSON_C_WS;
+	json_class['\r'] |= JSON_C_WS;
+}
+
+#if defined(__SSE2__)
+/* Classifies the 64 bytes at <p> using SSE2. */
+static inline void json_classify(const char *p, struct json_masks *m)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i bslash = _mm_set1_epi8('\\');
+	const __m128i lower = _mm_set1_epi8(0x20);
+	const __m128i obrace = _mm_set1_epi8('{');  /* '{' and '[' once lowered */
+	const __m128i cbrace = _mm_set1_epi8('}');  /* '}' and ']' once lowered */
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i ctrl = _mm_set1_epi8(0x1f);
+	int i;
+
+	memset(m, 0, sizeof(*m));
+	for (i = 0; i < 64; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i l = _mm_or_si128(x, lower);
+		__m128i op, ws;
+
+		op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(l, obrace), _mm_cmpeq_epi8(l, cbrace)),
+		                  _mm_or_si128(_mm_cmpeq_epi8(x, colon), _mm_cmpeq_epi8(x, comma)));
+		ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, space), _mm_cmpeq_epi8(x, tab)),
+		                  _mm_or_si128(_mm_cmpeq_epi8(x, lf), _mm_cmpeq_epi8(x, cr)));
+
+		m->quote  |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, quote)) << i;
+		m->bslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, bslash)) << i;
+		m->op     |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << i;
+		m->ws     |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << i;
+		m->ctrl   |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x)) << i;
+	}
+}
+#else
+/* Classifies the 64 bytes at <p> using a lookup table. */
+static inline void json_classify(const char *p, struct json_masks *m)
+{
+	int i;
+
+	memset(m, 0, sizeof(*m));
+	for (i = 0; i < 64; i++) {
+		unsigned char c = json_class[(unsigned char)p[i]];
+		uint64_t bit = (uint64_t)1 << i;
+
+		if (c & JSON_C_QUOTE)  m->quote  |= bit;
+		if (c & JSON_C_BSLASH) m->bslash |= bit;
+		if (c & JSON_C_OP)     m->op     |= bit;
+		if (c & JSON_C_WS)     m->ws     |= bit;
+		if (c & JSON_C_CTRL)   m->ctrl   |= bit;
+	}
+}
+#endif
+
+/* Returns a mask where each bit is the XOR of all lower bits of <x>, itself
+ * included. Applied to quotes, it gives the bytes inside strings.
+ */
+static inline uint64_t json_prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+static inline int json_is_hex(unsigned char c)
+{
+	return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+/* Returns a pointer to 64 bytes of the view starting at <ofs>, of which only
+ * the first <n> are meaningful. When the block is not contiguous or is shorter
+ * than 64 bytes, it is copied into <tmp> and padded with spaces.
+ */
+static inline const char *json_view_block(const struct json_view *v, size_t ofs, size_t n, char *tmp)
+{
+	size_t l;
+
+	if (likely(n == 64)) {
+		if (ofs + 64 <= v->len1)
+			return v->blk1 + ofs;
+		if (ofs >= v->len1)
+			return v->blk2 + (ofs - v->len1);
+	}
+
+	l = 0;
+	if (ofs < v->len1) {
+		l = v->len1 - ofs;
+		if (l > n)
+			l = n;
+		memcpy(tmp, v->blk1 + ofs, l);
+	}
+	if (n > l)
+		memcpy(tmp + l, v->blk2 + (ofs + l - v->len1), n - l);
+	memset(tmp + n, ' ', 64 - n);
+	return tmp;
+}
+
+/* Indexes <n> bytes (1 to 64) found at <p>, which are located at offset <base>
+ * in the view. Offsets of structural bytes are appended to <idx>. Returns the
+ * number of entries added. If an invalid string content is found, <err> is set
+ * to its offset and the remaining of the block is ignored.
+ */
+static inline unsigned int json_index_block(struct json_simd_state *st, const char *p,
+                                            size_t n, size_t base, uint32_t *idx, size_t *err)
+{
+	const uint64_t even = 0x5555555555555555ULL;
+	const uint64_t valid = (n == 64) ? ~0ULL : (((uint64_t)1 << n) - 1);
+	struct json_masks m;
+	uint64_t bslash, follows, odd_starts, seq, escaped, overflow;
+	uint64_t quote, in_string, scalar, tokens, bad;
+	uint64_t hexneed, hexnext;
+	unsigned int nb = 0;
+
+	json_classify(p, &m);
+
+	/* Find the escaped bytes: a byte is escaped if it follows an odd-length
+	 * sequence of backslashes. */
+	bslash = m.bslash & valid & ~st->prev_escaped;
+	follows = (bslash << 1) | st->prev_escaped;
+	odd_starts = bslash & ~even & ~follows;
+	seq = odd_starts + bslash;
+	overflow = seq < bslash;
+	escaped = (even ^ (seq << 1)) & follows;
+	if (n < 64)
+		overflow = (escaped >> n) & 1;
+	escaped &= valid;
+
+	quote = m.quote & ~escaped & valid;
+	in_string = json_prefix_xor(quote) ^ st->prev_in_string;
+
+	/* Check the string contents: no control character, only known escape
+	 * sequences, and four hex digits after each \u. */
+	bad = m.ctrl & in_string & valid;
+	hexneed = st->prev_hexneed;
+	hexnext = 0;
+	if (unlikely((escaped & in_string) | hexneed)) {
+		uint64_t esc = escaped & in_string;
+		uint64_t u = 0;
+
+		while (esc) {
+			int i = __builtin_ctzll(esc);
+
+			switch (p[i]) {
+			case '"': case '\\': case '/': case 'b':
+			case 'f': case 'n': case 'r': case 't':
+				break;
+			case 'u':
+				u |= (uint64_t)1 << i;
+				break;
+			default:
+				bad |= (uint64_t)1 << i;
+			}
+			esc &= esc - 1;
+		}
+		hexneed |= (u << 1) | (u << 2) | (u << 3) | (u << 4);
+		hexnext = (u >> 63) | (u >> 62) | (u >> 61) | (u >> 60);
+		if (n < 64) {
+			hexnext = (hexneed >> n) | (hexnext << (64 - n));
+			hexneed &= valid;
+		}
+		esc = hexneed;
+		while (esc) {
+			int i = __builtin_ctzll(esc);
+
+			if (!json_is_hex(p[i]))
+				bad |= (uint64_t)1 << i;
+			esc &= esc - 1;
+		}
+	}
+
+	/* scalars are whatever remains outside of the strings */
+	scalar = ~(m.op | m.ws | quote | in_string) & valid;
+	tokens = (m.op & ~in_string) | quote | (scalar & ~((scalar << 1) | st->prev_scalar));
+	tokens &= valid;
+
+	if (unlikely(bad)) {
+		/* only keep what precedes the error */
+		int i = __builtin_ctzll(bad);
+
+		*err = base + i;
+		tokens &= ((uint64_t)1 << i) - 1;
+	}
+
+	while (tokens) {
+		idx[nb++] = base + __builtin_ctzll(tokens);
+		tokens &= tokens - 1;
+	}
+
+	/* prepare the carries for the next byte */
+	st->prev_hexneed = hexnext;
+	if (n == 64) {
+		st->prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+		st->prev_scalar = scalar >> 63;
+	}
+	else {
+		st->prev_in_string = -((in_string >> (n - 1)) & 1);
+		st->prev_scalar = (scalar >> (n - 1)) & 1;
+	}
+	st->prev_escaped = overflow;
+	return nb;
+}
+
+/* Checks the scalar starting at <ofs>. Returns 1 if it is complete and valid
+ * and sets <end> to the offset following it, 0 if it reaches the end of the
+ * view while being a valid prefix, or -1 if it is invalid.
+ */
+static int json_check_scalar(const struct json_view *v, size_t ofs, size_t *end)
+{
+	static const char * const literals[] = { "true", "false", "null" };
+	size_t len = v->len1 + v->len2;
+	size_t pos = ofs;
+	unsigned char c = json_view_byte(v, pos);
+	int state;
+
+	if (c == 't' || c == 'f' || c == 'n') {
+		const char *lit = literals[(c == 'f') + 2 * (c == 'n')];
+
+		for (; *lit; lit++, pos++) {
+			if (pos == len)
+				return 0;
+			if (json_view_byte(v, pos) != (unsigned char)*lit)
+				return -1;
+		}
+		if (pos == len)
+			return 0;
+		c = json_view_byte(v, pos);
+		if (!(json_class[c] & (JSON_C_OP|JSON_C_WS|JSON_C_QUOTE)))
+			return -1;
+		*end = pos;
+		return 1;
+	}
+
+	/* numbers: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+	 *  0: start, 1: after '-', 2: after a leading '0', 3: integer digits,
+	 *  4: after '.', 5: fraction digits, 6: after 'e', 7: after exponent
+	 *  sign, 8: exponent digits.
+	 */
+	state = 0;
+	for (; pos < len; pos++) {
+		c = json_view_byte(v, pos);
+		if (json_class[c] & (JSON_C_OP|JSON_C_WS|JSON_C_QUOTE))
+			break;
+
+		switch (state) {
+		case 0:
+			if (c == '-') { state = 1; break; }
+			/* fall through */
+		case 1:
+			if (c == '0') state = 2;
+			else if (c >= '1' && c <= '9') state = 3;
+			else return -1;
+			break;
+		case 3:
+			if (c >= '0' && c <= '9') break;
+			/* fall through */
+		case 2:
+			if (c == '.') state = 4;
+			else if ((c | 0x20) == 'e') state = 6;
+			else return -1;
+			break;
+		case 4:
+		case 5:
+			if (c >= '0' && c <= '9') state = 5;
+			else if (state == 5 && (c | 0x20) == 'e') state = 6;
+			else return -1;
+			break;
+		case 6:
+			if (c == '+' || c == '-') { state = 7; break; }
+			/* fall through */
+		case 7:
+		case 8:
+			if (c >= '0' && c <= '9') state = 8;
+			else return -1;
+			break;
+		}
+	}
+
+	if (pos == len)
+		return 0;
+	if (state != 2 && state != 3 && state != 5 && state != 8)
+		return -1;
+	*end = pos;
+	return 1;
+}
+
+static inline void json_push(struct json_simd_state *st, int is_object)
+{
+	uint64_t bit = (uint64_t)1 << (st->depth & 63);
+
+	if (is_object)
+		st->stack[st->depth >> 6] |= bit;
+	else
+		st->stack[st->depth >> 6] &= ~bit;
+	st->depth++;
+}
+
+/* returns non-zero if the innermost open container is an object */
+static inline int json_top_is_object(const struct json_simd_state *st)
+{
+	unsigned int d = st->depth - 1;
+
+	return (st->stack[d >> 6] >> (d & 63)) & 1;
+}
+
+/* Called when a value ending at <end> is complete */
+static inline void json_value_end(struct json_simd_state *st, size_t end)
+{
+	if (st->depth) {
+		st->state = JSON_ST_NEXT;
+		return;
+	}
+	st->state = JSON_ST_IDLE;
+	/* <done> was set to the first byte of the record */
+	st->last = st->done;
+	st->last_end = st->done = end;
+	st->records++;
+}
+
+/* Runs the grammar on <nb> indexed offsets. Returns 1 if all of them were
+ * processed, 0 if an incomplete scalar was found at the end of the view (in
+ * which case <st->scanned> is set to its start), or -1 on error.
+ */
+static int json_walk(struct json_simd_state *st, const struct json_view *v,
+                     const uint32_t *idx, unsigned int nb)
+{
+	unsigned int i;
+
+	for (i = 0; i < nb; i++) {
+		size_t pos = idx[i];
+		unsigned char c = json_view_byte(v, pos);
+		size_t end;
+		int ret;
+
+		switch (st->state) {
+		case JSON_ST_STR_KEY:
+			/* stage 1 guarantees this is the closing quote */
+			st->state = JSON_ST_COLON;
+			continue;
+
+		case JSON_ST_STR_VALUE:
+			json_value_end(st, pos + 1);
+			continue;
+
+		case JSON_ST_COLON:
+			if (c != ':')
+				goto error;
+			st->state = JSON_ST_VALUE;
+			continue;
+
+		case JSON_ST_OBJECT_FIRST:
+			if (c == '}')
+				goto close;
+			/* fall through */
+		case JSON_ST_KEY:
+			if (c != '"')
+				goto error;
+			st->state = JSON_ST_STR_KEY;
+			continue;
+
+		case JSON_ST_NEXT:
+			if (c == ',') {
+				st->state = json_top_is_object(st) ? JSON_ST_KEY : JSON_ST_VALUE;
+				continue;
+			}
+			if ((c == '}' &&  json_top_is_object(st)) ||
+			    (c == ']' && !json_top_is_object(st)))
+				goto close;
+			goto error;
+
+		case JSON_ST_ARRAY_FIRST:
+			if (c == ']')
+				goto close;
+			/* fall through */
+		default: /* JSON_ST_IDLE, JSON_ST_VALUE */
+			/* whitespaces between records belong to the previous one */
+			if (st->state == JSON_ST_IDLE)
+				st->done = pos;
+			switch (c) {
+			case '{':
+			case '[':
+				if (st->depth >= JSON_SIMD_MAX_DEPTH)
+					goto error;
+				json_push(st, c == '{');
+				st->state = (c == '{') ? JSON_ST_OBJECT_FIRST : JSON_ST_ARRAY_FIRST;
+				continue;
+			case '"':
+				st->state = JSON_ST_STR_VALUE;
+				continue;
+			case '}': case ']': case ':': case ',':
+				goto error;
+			}
+
+			ret = json_check_scalar(v, pos, &end);
+			if (ret < 0)
+				goto error;
+			if (!ret) {
+				/* Wait for the end of the scalar. It only contains
+				 * scalar bytes, so stage 1 can restart from its
+				 * first byte with empty carries. */
+				st->scanned = pos;
+				st->prev_in_string = st->prev_escaped = 0;
+				st->prev_scalar = st->prev_hexneed = 0;
+				return 0;
+			}
+			json_value_end(st, end);
+			continue;
+		}
+
+	  close:
+		st->depth--;
+		json_value_end(st, pos + 1);
+		continue;
+
+	  error:
+		st->error = pos;
+		return -1;
+	}
+	return 1;
+}
+
+/* Resets the scanner state before scanning a new stream */
+void json_simd_init(struct json_simd_state *st)
+{
+	memset(st, 0, sizeof(*st));
+}
+
+/* Tells the scanner that the first <len> bytes of the view, which must not be
+ * beyond <st->scanned>, were consumed. The next view passed to json_simd_scan()
+ * must start right after them. Consuming a partial record loses its start, so
+ * <st->done> is then reset.
+ */
+void json_simd_consume(struct json_simd_state *st, size_t len)
+{
+	st->scanned -= len;
+	st->done = (len < st->done) ? st->done - len : 0;
+	if (len < st->last_end) {
+		st->last = (len < st->last) ? st->last - len : 0;
+		st->last_end -= len;
+	}
+	else
+		st->last = st->last_end = 0;
+}
+
+/* Restarts the scanner at offset <ofs> of the view, once the invalid record
+ * which made it fail was skipped. <ofs> becomes the end of the last complete
+ * record, the count of records found before it and their bounds are kept.
+ */
+void json_simd_restart(struct json_simd_state *st, size_t ofs)
+{
+	unsigned int records = st->records;
+	size_t last = st->last, last_end = st->last_end;
+
+	json_simd_init(st);
+	st->records = records;
+	st->last = last;
+	st->last_end = last_end;
+	st->scanned = st->done = ofs;
+}
+
+/* Saves the partial scalar which ends the view <v> after a scan, if any, so
+ * that the whole view may be consumed even though the scalar continues in the
+ * next one. This is needed when the stream has holes, such as HTTP chunk
+ * envelopes. Returns 0 if the scalar is too long to be saved, otherwise 1.
+ */
+int json_simd_suspend(struct json_simd_state *st, const struct json_view *v)
+{
+	size_t len = v->len1 + v->len2;
+
+	if (st->pend_len + (len - st->scanned) > JSON_SIMD_MAX_SCALAR)
+		return 0;
+	for (; st->scanned < len; st->scanned++)
+		st->pend[st->pend_len++] = json_view_byte(v, st->scanned);
+	return 1;
+}
+
+/* Completes the scalar saved by json_simd_suspend() with the first bytes of
+ * the view <v>. Returns 1 once it was validated, 0 if its end is not in the
+ * view yet, or -1 if it is invalid or too long.
+ */
+static int json_resume_scalar(struct json_simd_state *st, const struct json_view *v)
+{
+	size_t len = v->len1 + v->len2;
+	struct json_view pv;
+	size_t pos, end;
+
+	for (pos = 0; pos < len; pos++) {
+		if (json_class[json_view_byte(v, pos)] & (JSON_C_OP|JSON_C_WS|JSON_C_QUOTE))
+			break;
+	}
+	if (st->pend_len + pos > JSON_SIMD_MAX_SCALAR)
+		goto error;
+	if (pos == len)
+		return 0;
+
+	/* the byte following the scalar is copied too, it is needed to
+	 * tell it is complete */
+	for (end = 0; end <= pos; end++)
+		st->pend[st->pend_len + end] = json_view_byte(v, end);
+	pv.blk1 = st->pend;
+	pv.len1 = st->pend_len + pos + 1;
+	pv.blk2 = NULL;
+	pv.len2 = 0;
+	st->pend_len = 0;
+	if (json_check_scalar(&pv, 0, &end) <= 0)
+		goto error;
+	json_value_end(st, pos);
+	st->scanned = pos;
+	return 1;
+
+  error:
+	st->error = 0;
+	return -1;
+}
+
+/* Tells the scanner that the stream ends after the last view it was given,
+ * which must have been suspended. Returns JSON_PASS if the stream ends between
+ * two records, otherwise JSON_FAIL.
+ */
+json_passed_t json_simd_end(struct json_simd_state *st)
+{
+	struct json_view pv;
+	size_t end;
+
+	if (st->pend_len) {
+		st->pend[st->pend_len] = ' ';
+		pv.blk1 = st->pend;
+		pv.len1 = st->pend_len + 1;
+		pv.blk2 = NULL;
+		pv.len2 = 0;
+		st->pend_len = 0;
+		if (json_check_scalar(&pv, 0, &end) <= 0)
+			return JSON_FAIL;
+		json_value_end(st, 0);
+	}
+	return (st->state == JSON_ST_IDLE) ? JSON_PASS : JSON_FAIL;
+}
+
+/* Scans the view <v> from <st->scanned> to its end. Complete records are
+ * counted in <st->records> and <st->done> is set to the end of the last one,
+ * including the whitespaces which follow it up to the next record or to the
+ * end of the scanned data. Returns
+ * JSON_FAIL if invalid JSON is found, with <st->error> set to its offset,
+ * otherwise JSON_PASS.
+ */
+json_passed_t json_simd_scan(struct json_simd_state *st, const struct json_view *v)
+{
+	uint32_t idx[JSON_SIMD_CHUNK_BLOCKS * 64];
+	char tmp[64] __attribute__((aligned(64)));
+	size_t len = v->len1 + v->len2;
+
+	if (unlikely(st->pend_len)) {
+		int ret = json_resume_scalar(st, v);
+
+		if (ret < 0)
+			return JSON_FAIL;
+		if (!ret)
+			return JSON_PASS;
+	}
+
+	while (st->scanned < len) {
+		size_t pos = st->scanned;
+		size_t err = len;
+		unsigned int nb = 0;
+		int ret;
+
+		/* stage 1: index a chunk of blocks */
+		while (pos < len && nb <= (JSON_SIMD_CHUNK_BLOCKS - 1) * 64) {
+			size_t n = len - pos;
+			const char *p;
+
+			if (n > 64)
+				n = 64;
+			p = json_view_block(v, pos, n, tmp);
+			nb += json_index_block(st, p, n, pos, idx + nb, &err);
+			pos += n;
+			if (unlikely(err != len))
+				break;
+		}
+
+		/* stage 2: check the grammar */
+		ret = json_walk(st, v, idx, nb);
+		if (ret < 0)
+			return JSON_FAIL;
+		if (!ret)
+			return JSON_PASS;
+		st->scanned = pos;
+
+		if (unlikely(err != len)) {
+			st->error = err;
+			return JSON_FAIL;
+		}
+	}
+
+	if (st->state == JSON_ST_IDLE)
+		st->done = st->scanned;
+	return JSON_PASS;
+}
+
+/* Lazy iterator over the structural bytes of a view, indexing one block at a
+ * time so that a lookup stops as soon as it has found what it wants.
+ */
+struct json_iter {
+	const struct json_view *v;
+	struct json_simd_state st;  /* only stage 1 carries are used */
+	size_t len;                 /* length of the view */
+	size_t pos;                 /* first byte not indexed yet */
+	size_t err;                 /* offset of invalid string contents, or len */
+	unsigned int nb, cur;       /* entries in <idx>, next one to return */
+	uint32_t idx[64];
+	char tmp[64] __attribute__((aligned(64)));
+};
+
+static inline void json_iter_init(struct json_iter *it, const struct json_view *v)
+{
+	memset(&it->st, 0, sizeof(it->st));
+	it->v = v;
+	it->len = v->len1 + v->len2;
+	it->pos = 0;
+	it->err = it->len;
+	it->nb = it->cur = 0;
+}
+
+/* Sets <tok> to the offset of the next structural byte. Returns 1 on success,
+ * 0 if the end of the view was reached or -1 on invalid string contents.
+ */
+static int json_iter_next(struct json_iter *it, size_t *tok)
+{
+	while (it->cur == it->nb) {
+		size_t n = it->len - it->pos;
+
+		if (unlikely(it->err != it->len))
+			return -1;
+		if (!n)
+			return 0;
+		if (n > 64)
+			n = 64;
+		it->nb = json_index_block(&it->st, json_view_block(it->v, it->pos, n, it->tmp),
+		                          n, it->pos, it->idx, &it->err);
+		it->cur = 0;
+		it->pos += n;
+	}
+	*tok = it->idx[it->cur++];
+	return 1;
+}
+
+/* Skips the value starting with the structural byte at <tok> and sets <end>
+ * to the offset following it. Returns 1 on success, 0 if the end of the view
+ * was reached or -1 if the value is invalid. Apart from scalars, the value is
+ * not validated.
+ */
+static int json_iter_skip(struct json_iter *it, size_t tok, size_t *end)
+{
+	unsigned char c = json_view_byte(it->v, tok);
+	unsigned int depth;
+	int ret;
+
+	switch (c) {
+	case '"':
+		/* the next structural byte is the closing quote */
+		ret = json_iter_next(it, &tok);
+		if (ret <= 0)
+			return ret;
+		break;
+
+	case '{':
+	case '[':
+		depth = 1;
+		while (depth) {
+			ret = json_iter_next(it, &tok);
+			if (ret <= 0)
+				return ret;
+			c = json_view_byte(it->v, tok);
+			if (c == '"')
+				ret = json_iter_next(it, &tok);
+			else if (c == '{' || c == '[')
+				depth++;
+			else if (c == '}' || c == ']')
+				depth--;
+			if (ret <= 0)
+				return ret;
+		}
+		break;
+
+	case '}': case ']': case ':': case ',':
+		return -1;
+
+	default:
+		return json_check_scalar(it->v, tok, end);
+	}
+	*end = tok + 1;
+	return 1;
+}
+
+/* Parses the next step of a path. <path> is updated to point after it. Returns
+ * 0 at the end of the path, 1 for a member name (stored in <name>/<len>), 2
+ * for an array index (stored in <index>) or -1 on syntax error. Supported
+ * steps are ".name", "[\"name\"]" and "[<integer>]".
+ */
+static int json_path_step(const char **path, const char **name, size_t *len, unsigned long *index)
+{
+	const char *p = *path;
+
+	if (!*p)
+		return 0;
+
+	if (*p == '.') {
+		*name = ++p;
+		while (*p && *p != '.' && *p != '[')
+			p++;
+		*len = p - *name;
+		*path = p;
+		return *len ? 1 : -1;
+	}
+
+	if (*p != '[')
+		return -1;
+	p++;
+
+	if (*p == '"') {
+		*name = ++p;
+		while (*p && *p != '"')
+			p++;
+		*len = p - *name;
+		if (p[0] != '"' || p[1] != ']')
+			return -1;
+		*path = p + 2;
+		return 1;
+	}
+
+	if (*p < '0' || *p > '9')
+		return -1;
+	*index = 0;
+	while (*p >= '0' && *p <= '9')
+		*index = *index * 10 + *p++ - '0';
+	if (*p != ']')
+		return -1;
+	*path = p + 1;
+	return 2;
+}
+
+/* Checks the syntax of a path. Returns 1 if it is valid, otherwise 0. */
+int json_path_check(const char *path)
+{
+	const char *name;
+	size_t len;
+	unsigned long index;
+	int ret;
+
+	if (*path++ != '$')
+		return 0;
+	while ((ret = json_path_step(&path, &name, &len, &index)) > 0)
+		;
+	return ret == 0;
+}
+
+/* Looks up the element designated by <path> in the first record of view <v>.
+ * The record is indexed lazily and only the values preceding the element are
+ * walked through (and skipped at the structural index level), so the lookup
+ * stops as soon as the element is found. On success, <start> and <end> are
+ * set to the bounds of the element's text, quotes included for strings.
+ * Returns one of the JSON_LOOKUP_* codes. The path must have been checked
+ * with json_path_check().
+ */
+int json_path_lookup(const struct json_view *v, const char *path, size_t *start, size_t *end)
+{
+	struct json_iter it;
+	const char *name;
+	size_t tok, len, q;
+	unsigned long index, i;
+	int step, match, ret;
+
+	json_iter_init(&it, v);
+
+	/* the root value */
+	ret = json_iter_next(&it, &tok);
+	if (ret <= 0)
+		goto out;
+
+	path++;
+	while ((step = json_path_step(&path, &name, &len, &index)) > 0) {
+		unsigned char c = json_view_byte(v, tok);
+
+		if (step == 1) {
+			if (c != '{')
+				return JSON_LOOKUP_NOTFOUND;
+
+			/* look for the member in the object */
+			for (;;) {
+				ret = json_iter_next(&it, &tok);
+				if (ret <= 0)
+					goto out;
+				c = json_view_byte(v, tok);
+				if (c == ',')
+					continue;
+				if (c == '}')
+					return JSON_LOOKUP_NOTFOUND;
+				if (c != '"')
+					return JSON_LOOKUP_INVALID;
+
+				/* compare the raw key */
+				ret = json_iter_next(&it, &q);
+				if (ret <= 0)
+					goto out;
+				match = (q - tok - 1 == len);
+				for (i = 0; match && i < len; i++)
+					match = (json_view_byte(v, tok + 1 + i) == (unsigned char)name[i]);
+
+				ret = json_iter_next(&it, &tok);
+				if (ret <= 0)
+					goto out;
+				if (json_view_byte(v, tok) != ':')
+					return JSON_LOOKUP_INVALID;
+				ret = json_iter_next(&it, &tok);
+				if (ret <= 0)
+					goto out;
+				if (match)
+					break;
+				ret = json_iter_skip(&it, tok, &q);
+				if (ret <= 0)
+					goto out;
+			}
+		}
+		else {
+			if (c != '[')
+				return JSON_LOOKUP_NOTFOUND;
+
+			/* look for the element in the array */
+			for (i = 0;; i++) {
+				ret = json_iter_next(&it, &tok);
+				if (ret <= 0)
+					goto out;
+				c = json_view_byte(v, tok);
+				if (c == ',' && i) {
+					ret = json_iter_next(&it, &tok);
+					if (ret <= 0)
+						goto out;
+					c = json_view_byte(v, tok);
+				}
+				if (c == ']')
+					return JSON_LOOKUP_NOTFOUND;
+				if (i == index)
+					break;
+				ret = json_iter_skip(&it, tok, &q);
+				if (ret <= 0)
+					goto out;
+			}
+		}
+	}
+	if (step < 0)
+		return JSON_LOOKUP_INVALID;
+
+	/* <tok> is the first byte of the element */
+	ret = json_iter_skip(&it, tok, end);
+	if (ret <= 0)
+		goto out;
+	*start = tok;
+	return JSON_LOOKUP_FOUND;
+
+  out:
+	return ret < 0 ? JSON_LOOKUP_INVALID : JSON_LOOKUP_MISSING;
+}
+
+/* Returns the offset of the first byte <c> found between <from> and <to> in
+ * view <v>, or <to> if there is none.
+ */
+size_t json_view_chr(const struct json_view *v, size_t from, size_t to, char c)
+{
+	const char *p;
+
+	if (from < v->len1) {
+		size_t end = to < v->len1 ? to : v->len1;
+
+		p = memchr(v->blk1 + from, c, end - from);
+		if (p)
+			return p - v->blk1;
+		from = end;
+	}
+	if (from < to) {
+		p = memchr(v->blk2 + from - v->len1, c, to - from);
+		if (p)
+			return p - v->blk2 + v->len1;
+	}
+	return to;
+}
+
+/* Returns non-zero if the <nlen> bytes at <n> appear in the <hlen> bytes at
+ * <h>. Candidates are the positions where both the first and the last bytes
+ * of the needle match, which are found 16 at a time, and they are confirmed
+ * with a memcmp(). Most bytes of a record are thus only looked at once.
+ */
+static int json_raw_search(const char *h, size_t hlen, const char *n, size_t nlen)
+{
+	size_t i = 0;
+
+	if (hlen < nlen)
+		return 0;
+#if defined(__SSE2__)
+	{
+		const __m128i first = _mm_set1_epi8(n[0]);
+		const __m128i last  = _mm_set1_epi8(n[nlen - 1]);
+
+		for (; i + 16 + nlen - 1 <= hlen; i += 16) {
+			__m128i b0 = _mm_loadu_si128((const __m128i *)(h + i));
+			__m128i b1 = _mm_loadu_si128((const __m128i *)(h + i + nlen - 1));
+			unsigned int mask;
+
+			mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(b0, first),
+			                                       _mm_cmpeq_epi8(b1, last)));
+			while (mask) {
+				if (memcmp(h + i + __builtin_ctz(mask), n, nlen) == 0)
+					return 1;
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+	/* the remaining positions */
+	for (; i + nlen <= hlen; i++) {
+		const char *p = memchr(h + i, n[0], hlen - nlen + 1 - i);
+
+		if (!p)
+			break;
+		i = p - h;
+		if (memcmp(p, n, nlen) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* Returns non-zero if the <nlen> bytes at <n>, which must not be more than
+ * JSON_RAW_MAX_LEN, appear between <from> and <to> in view <v>. The bytes
+ * are not interpreted at all, which is what makes it cheap enough to discard
+ * records before parsing them.
+ */
+int json_raw_contains(const struct json_view *v, size_t from, size_t to, const char *n, size_t nlen)
+{
+	char tmp[2 * JSON_RAW_MAX_LEN];
+	size_t beg, end;
+
+	if (!nlen)
+		return 1;
+	if (to <= v->len1)
+		return json_raw_search(v->blk1 + from, to - from, n, nlen);
+	if (from >= v->len1)
+		return json_raw_search(v->blk2 + from - v->len1, to - from, n, nlen);
+
+	if (json_raw_search(v->blk1 + from, v->len1 - from, n, nlen) ||
+	    json_raw_search(v->blk2, to - v->len1, n, nlen))
+		return 1;
+
+	/* occurrences crossing the end of the first block */
+	beg = v->len1 - from < nlen - 1 ? v->len1 - from : nlen - 1;
+	end = to - v->len1 < nlen - 1 ? to - v->len1 : nlen - 1;
+	memcpy(tmp, v->blk1 + v->len1 - beg, beg);
+	memcpy(tmp + beg, v->blk2, end);
+	return json_raw_search(tmp, beg + end, n, nlen);
+}
+
+/* Returns the bitmap of the newlines found in the 64 bytes at <p>. */
+static inline uint64_t json_newline_mask(const char *p)
+{
+#if defined(__SSE2__)
+	const __m128i lf = _mm_set1_epi8('\n');
+	uint64_t m = 0;
+	int i;
+
+	for (i = 0; i < 64; i += 16)
+		m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), lf)) << i;
+	return m;
+#else
+	uint64_t m = 0;
+	int i;
+
+	for (i = 0; i < 64; i++)
+		m |= (uint64_t)(p[i] == '\n') << i;
+	return m;
+#endif
+}
+
+#if defined(JSON_HAVE_AVX2)
+__attribute__((target("avx2")))
+static inline uint64_t json_newline_mask_avx2(const char *p)
+{
+	const __m256i lf = _mm256_set1_epi8('\n');
+	uint32_t lo, hi;
+
+	lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), lf));
+	hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 32)), lf));
+	return lo | (uint64_t)hi << 32;
+}
+#endif
+
+/* Body of json_split_lines(), instantiated once per instruction set. The
+ * bitmap of each block gives all the newlines it contains at once, so the
+ * cost does not depend on the number of records.
+ */
+static inline __attribute__((always_inline))
+unsigned int json_split_lines_tpl(const struct json_view *v, size_t from, size_t to, size_t *end,
+                                  uint64_t (*mask)(const char *))
+{
+	char tmp[64] __attribute__((aligned(64)));
+	unsigned int count = 0;
+	size_t n;
+	uint64_t m;
+
+	*end = from;
+	for (; from < to; from += n) {
+		n = to - from < 64 ? to - from : 64;
+		m = mask(json_view_block(v, from, n, tmp));
+		if (m) {
+			count += __builtin_popcountll(m);
+			*end = from + 64 - __builtin_clzll(m);
+		}
+	}
+	return count;
+}
+
+static unsigned int json_split_lines_gen(const struct json_view *v, size_t from, size_t to, size_t *end)
+{
+	return json_split_lines_tpl(v, from, to, end, json_newline_mask);
+}
+
+#if defined(JSON_HAVE_AVX2)
+__attribute__((target("avx2,popcnt")))
+static unsigned int json_split_lines_avx2(const struct json_view *v, size_t from, size_t to, size_t *end)
+{
+	return json_split_lines_tpl(v, from, to, end, json_newline_mask_avx2);
+}
+#endif
+
+static unsigned int (*json_split_lines_fct)(const struct json_view *, size_t, size_t, size_t *) = json_split_lines_gen;
+
+/* picks the best implementation of json_split_lines() for this CPU */
+__attribute__((constructor))
+static void json_split_lines_select(void)
+{
+#if defined(JSON_HAVE_AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+		json_split_lines_fct = json_split_lines_avx2;
+#endif
+}
+
+/* Finds the newlines between <from> and <to> in view <v>, both blocks being
+ * covered by a single call. Returns how many there are and sets <end> to the
+ * offset following the last one, or to <from> if there is none.
+ */
+unsigned int json_split_lines(const struct json_view *v, size_t from, size_t to, size_t *end)
+{
+	return json_split_lines_fct(v, from, to, end);
+}
+
+/* Copies the records found between <from> and <to> in view <v>, which must be
+ * valid, to <out> without their insignificant whitespaces. Whitespaces
+ * between two records are turned into a single newline if they contain one,
+ * otherwise into a single space. Returns the number of bytes written, which
+ * is never more than <to> - <from>.
+ */
+size_t json_minify(const struct json_view *v, size_t from, size_t to, char *out)
+{
+	const char *p, *end;
+	char *o = out;
+	unsigned int depth = 0;
+	int in_str = 0, esc = 0;
+	char sep = 0;
+	int blk;
+
+	for (blk = 0; blk < 2; blk++) {
+		if (!blk) {
+			if (from >= v->len1)
+				continue;
+			p   = v->blk1 + from;
+			end = v->blk1 + (to < v->len1 ? to : v->len1);
+		}
+		else {
+			if (to <= v->len1)
+				break;
+			p   = v->blk2 + (from > v->len1 ? from - v->len1 : 0);
+			end = v->blk2 + (to - v->len1);
+		}
+
+		for (; p < end; p++) {
+			char c = *p;
+
+			if (in_str) {
+				*o++ = c;
+				if (esc)
+					esc = 0;
+				else if (c == '\\')
+					esc = 1;
+				else if (c == '"')
+					in_str = 0;
+				continue;
+			}
+			if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+				if (!depth && sep != '\n')
+					sep = (c == '\n') ? '\n' : ' ';
+				continue;
+			}
+			if (sep) {
+				*o++ = sep;
+				sep = 0;
+			}
+			if (c == '"')
+				in_str = 1;
+			else if (c == '{' || c == '[')
+				depth++;
+			else if (c == '}' || c == ']')
+				depth--;
+			*o++ = c;
+		}
+	}
+	if (sep)
+		*o++ = sep;
+	return o - out;
+}
+
+/* Returns a pointer to the byte following the string starting at <p> */
+static inline const char *json_min_str_end(const char *p)
+{
+	for (p++; *p != '"'; p++) {
+		if (*p == '\\')
+			p++;
+	}
+	return p + 1;
+}
+
+static inline int json_is_ws(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Returns a pointer to the byte following the valid value starting at <p>,
+ * <end> being the end of the input. Whitespaces are allowed in containers.
+ */
+static const char *json_min_skip(const char *p, const char *end)
+{
+	unsigned int depth = 0;
+
+	if (*p != '"' && *p != '{' && *p != '[') {
+		/* scalar */
+		while (p < end && *p != ',' && *p != '}' && *p != ']' && !json_is_ws(*p))
+			p++;
+		return p;
+	}
+	do {
+		if (*p == '"') {
+			p = json_min_str_end(p);
+			continue;
+		}
+		if (*p == '{' || *p == '[')
+			depth++;
+		else if (*p == '}' || *p == ']')
+			depth--;
+		p++;
+	} while (depth);
+	return p;
+}
+
+/* Compares the keys of the members starting at <a> and <b>, then their
+ * positions so that duplicate keys keep their order.
+ */
+static inline int json_member_cmp(const char *a, const char *b)
+{
+	size_t la = json_min_str_end(a) - a;
+	size_t lb = json_min_str_end(b) - b;
+	int ret;
+
+	ret = memcmp(a + 1, b + 1, (la < lb ? la : lb) - 2);
+	if (ret)
+		return ret;
+	if (la != lb)
+		return la < lb ? -1 : 1;
+	return (a > b) - (a < b);
+}
+
+/* Offsets of the members of the objects being canonicalized by the current
+ * thread, relative to <json_canon_in>. Each object sorts its own members at
+ * the top of the stack, and the objects nested in them go above.
+ */
+static __thread uint32_t *json_canon_stack = NULL;
+static __thread unsigned int json_canon_users = 0;
+static __thread const char *json_canon_in;
+
+/* Sets up the stack of the current thread for records of up to <len> bytes.
+ * A member takes at least 5 bytes ('"":0' and a comma or a brace). It may be
+ * called several times, each call must be matched by json_canon_thread_deinit().
+ * Returns 1 on success, 0 on error.
+ */
+int json_canon_thread_init(size_t len)
+{
+	if (!json_canon_stack) {
+		json_canon_stack = malloc((len / 5 + 1) * sizeof(*json_canon_stack));
+		if (!json_canon_stack)
+			return 0;
+	}
+	json_canon_users++;
+	return 1;
+}
+
+/* Releases the stack of the current thread once its last user is gone */
+void json_canon_thread_deinit(void)
+{
+	if (json_canon_stack && --json_canon_users == 0) {
+		free(json_canon_stack);
+		json_canon_stack = NULL;
+	}
+}
+
+/* qsort() callback comparing the members at offsets <a> and <b> */
+static int json_canon_cmp(const void *a, const void *b)
+{
+	return json_member_cmp(json_canon_in + *(const uint32_t *)a,
+	                       json_canon_in + *(const uint32_t *)b);
+}
+
+static const char *json_canon_value(const char *p, const char *end, char **out, uint32_t *ofs);
+
+/* Writes the object starting at <p> with its members sorted by key. Their
+ * offsets are stored at <ofs>, the top of the stack. Returns a pointer to the
+ * byte following the object.
+ */
+static const char *json_canon_object(const char *p, const char *end, char **out, uint32_t *ofs)
+{
+	const char *m;
+	unsigned int nb = 0, i;
+
+	for (m = p + 1; *m != '}'; m = json_min_skip(json_min_str_end(m) + 1, end)) {
+		if (*m == ',')
+			m++;
+		ofs[nb++] = m - json_canon_in;
+	}
+	p = m + 1;
+	qsort(ofs, nb, sizeof(*ofs), json_canon_cmp);
+
+	*(*out)++ = '{';
+	for (i = 0; i < nb; i++) {
+		const char *key = json_canon_in + ofs[i];
+
+		if (i)
+			*(*out)++ = ',';
+		m = json_min_str_end(key) + 1;
+		memcpy(*out, key, m - key);
+		*out += m - key;
+		json_canon_value(m, end, out, ofs + nb);
+	}
+	*(*out)++ = '}';
+	return p;
+}
+
+/* Writes the minified value starting at <p> in canonical form. Returns a
+ * pointer to the byte following it.
+ */
+static const char *json_canon_value(const char *p, const char *end, char **out, uint32_t *ofs)
+{
+	const char *q;
+
+	if (*p == '{')
+		return json_canon_object(p, end, out, ofs);
+	if (*p == '[') {
+		*(*out)++ = *p++;
+		while (*p != ']') {
+			if (*p == ',')
+				*(*out)++ = *p++;
+			p = json_canon_value(p, end, out, ofs);
+		}
+		*(*out)++ = *p++;
+		return p;
+	}
+	q = json_min_skip(p, end);
+	memcpy(*out, p, q - p);
+	*out += q - p;
+	return q;
+}
+
+/* Copies the <len> bytes of minified records at <in> to <out>, with the
+ * members of all their objects sorted by key. Keys are compared on their raw
+ * bytes, escape sequences included. json_canon_thread_init() must have been
+ * called with at least <len>. Returns the number of bytes written, which is
+ * always <len>.
+ */
+size_t json_canonicalize(const char *in, size_t len, char *out)
+{
+	const char *p = in, *end = in + len;
+	char *o = out;
+
+	json_canon_in = in;
+	while (p < end) {
+		if (*p == ' ' || *p == '\n')
+			*o++ = *p++;
+		else
+			p = json_canon_value(p, end, &o, json_canon_stack);
+	}
+	return o - out;
+}
+
+/* Appends <v> on <n> bytes in network order */
+static inline void json_enc_be(struct json_enc *e, uint64_t v, int n)
+{
+	while (n--)
+		*e->o++ = v >> (8 * n);
+}
+
+/* Returns non-zero if <n> more bytes fit in the output area, otherwise marks
+ * it full.
+ */
+static inline int json_enc_room(struct json_enc *e, size_t n)
+{
+	if ((size_t)(e->end - e->o) < n) {
+		e->full = 1;
+		return 0;
+	}
+	return 1;
+}
+
+/* Appends a CBOR head made of major type <major> and argument <n>. Returns 0
+ * if there is not enough room.
+ */
+static int json_enc_cbor_head(struct json_enc *e, int major, uint64_t n)
+{
+	int len = n < 24 ? 0 : n <= 0xff ? 1 : n <= 0xffff ? 2 : n <= 0xffffffffULL ? 4 : 8;
+
+	if (!json_enc_room(e, 1 + len))
+		return 0;
+	if (!len) {
+		*e->o++ = (major << 5) | n;
+		return 1;
+	}
+	*e->o++ = (major << 5) | (len == 1 ? 24 : len == 2 ? 25 : len == 4 ? 26 : 27);
+	json_enc_be(e, n, len);
+	return 1;
+}
+
+/* Appends a MessagePack head for a string, an array or a map of <n> elements,
+ * depending on <fix> (0xa0, 0x90 or 0x80). Returns 0 if there is not enough
+ * room.
+ */
+static int json_enc_mp_head(struct json_enc *e, unsigned char fix, uint64_t n)
+{
+	unsigned char c16 = fix == 0xa0 ? 0xda : fix == 0x90 ? 0xdc : 0xde;
+	uint64_t fixmax = fix == 0xa0 ? 31 : 15;
+	int len = n <= fixmax ? 0 : (fix == 0xa0 && n <= 0xff) ? 1 : n <= 0xffff ? 2 : 4;
+
+	if (!json_enc_room(e, 1 + len))
+		return 0;
+	if (!len)
+		*e->o++ = fix | n;
+	else
+		*e->o++ = len == 1 ? 0xd9 : len == 2 ? c16 : c16 + 1;
+	json_enc_be(e, n, len);
+	return 1;
+}
+
+/* Appends the head of a string, an array or a map of <n> elements */
+static inline int json_enc_head(struct json_enc *e, int major, uint64_t n)
+{
+	if (e->fmt == JSON_ENC_CBOR)
+		return json_enc_cbor_head(e, major, n);
+	return json_enc_mp_head(e, major == 3 ? 0xa0 : major == 4 ? 0x90 : 0x80, n);
+}
+
+/* Sets up encoder <e> to write to the <size> bytes at <out> in format <fmt> */
+void json_enc_init(struct json_enc *e, char *out, size_t size, int fmt)
+{
+	e->start = e->o = out;
+	e->end   = out + size;
+	e->fmt   = fmt;
+	e->full  = 0;
+	e->depth = 0;
+}
+
+/* Starts a record with room for its length. Returns 0 if there is not enough
+ * room.
+ */
+int json_enc_begin(struct json_enc *e)
+{
+	if (!json_enc_room(e, 4))
+		return 0;
+	e->depth = 0;
+	e->open[e->depth++] = e->o - e->start;
+	e->o += 4;
+	return 1;
+}
+
+/* Ends the record, which is complete, by writing its length before it */
+void json_enc_end(struct json_enc *e)
+{
+	char *head = e->start + e->open[0];
+	uint64_t len = e->o - head - 4;
+	char *o = e->o;
+
+	e->o = head;
+	json_enc_be(e, len, 4);
+	e->o = o;
+	e->depth = 0;
+}
+
+/* Removes the record being encoded, which is incomplete */
+void json_enc_cancel(struct json_enc *e)
+{
+	if (e->depth)
+		e->o = e->start + e->open[0];
+	e->depth = 0;
+}
+
+int json_enc_null(struct json_enc *e)
+{
+	if (!json_enc_room(e, 1))
+		return 0;
+	*e->o++ = e->fmt == JSON_ENC_CBOR ? 0xf6 : 0xc0;
+	return 1;
+}
+
+int json_enc_bool(struct json_enc *e, int b)
+{
+	if (!json_enc_room(e, 1))
+		return 0;
+	if (e->fmt == JSON_ENC_CBOR)
+		*e->o++ = b ? 0xf5 : 0xf4;
+	else
+		*e->o++ = b ? 0xc3 : 0xc2;
+	return 1;
+}
+
+/* Appends the integer whose absolute value is <n>, negative if <neg> is set,
+ * which must fit in an int64_t if it is negative. Returns 0 if there is not
+ * enough room.
+ */
+int json_enc_int(struct json_enc *e, uint64_t n, int neg)
+{
+	int len;
+
+	if (neg && !n)
+		neg = 0;
+	if (e->fmt == JSON_ENC_CBOR)
+		return json_enc_cbor_head(e, neg, neg ? n - 1 : n);
+
+	if (!neg) {
+		len = n <= 0x7f ? 0 : n <= 0xff ? 1 : n <= 0xffff ? 2 : n <= 0xffffffffULL ? 4 : 8;
+		if (!json_enc_room(e, 1 + len))
+			return 0;
+		if (!len)
+			*e->o++ = n;
+		else
+			*e->o++ = len == 1 ? 0xcc : len == 2 ? 0xcd : len == 4 ? 0xce : 0xcf;
+	}
+	else {
+		len = n <= 32 ? 0 : n <= 0x80 ? 1 : n <= 0x8000 ? 2 : n <= 0x80000000ULL ? 4 : 8;
+		if (!json_enc_room(e, 1 + len))
+			return 0;
+		if (!len)
+			*e->o++ = -(int64_t)n;
+		else
+			*e->o++ = len == 1 ? 0xd0 : len == 2 ? 0xd1 : len == 4 ? 0xd2 : 0xd3;
+		n = -n;
+	}
+	json_enc_be(e, n, len);
+	return 1;
+}
+
+/* Appends the number <d>, as a single precision float when it does not lose
+ * anything, otherwise as a double precision one. Returns 0 if there is not
+ * enough room.
+ */
+int json_enc_double(struct json_enc *e, double d)
+{
+	union { double d; uint64_t u; } dbl;
+	union { float f; uint32_t u; } flt;
+
+	dbl.d = d;
+	flt.f = (d >= -FLT_MAX && d <= FLT_MAX) ? d : 0;
+
+	if ((double)flt.f == dbl.d) {
+		if (!json_enc_room(e, 5))
+			return 0;
+		*e->o++ = e->fmt == JSON_ENC_CBOR ? 0xfa : 0xca;
+		json_enc_be(e, flt.u, 4);
+		return 1;
+	}
+	if (!json_enc_room(e, 9))
+		return 0;
+	*e->o++ = e->fmt == JSON_ENC_CBOR ? 0xfb : 0xcb;
+	json_enc_be(e, dbl.u, 8);
+	return 1;
+}
+
+/* Appends the <len> bytes of the decoded string <str>. Returns 0 if there is
+ * not enough room.
+ */
+int json_enc_string(struct json_enc *e, const char *str, size_t len)
+{
+	if (!json_enc_head(e, 3, len) || !json_enc_room(e, len))
+		return 0;
+	memcpy(e->o, str, len);
+	e->o += len;
+	return 1;
+}
+
+/* Starts an object or an array. Its number of elements is only known once it
+ * ends, so room is left for the longest head. Returns 0 if there is not enough
+ * room or if it is nested too deeply.
+ */
+int json_enc_open(struct json_enc *e)
+{
+	if (e->depth > JSON_SIMD_MAX_DEPTH)
+		return 0;
+	if (!json_enc_room(e, JSON_ENC_MAX_HEAD))
+		return 0;
+	e->open[e->depth++] = e->o - e->start;
+	e->o += JSON_ENC_MAX_HEAD;
+	return 1;
+}
+
+/* Ends the object or the array of <n> elements, or of <n> members if <obj> is
+ * set, by writing its head and moving its elements right after it.
+ */
+void json_enc_close(struct json_enc *e, int obj, uint64_t n)
+{
+	char *head = e->start + e->open[--e->depth];
+	char *data = head + JSON_ENC_MAX_HEAD;
+	size_t len = e->o - data;
+
+	e->o = head;
+	json_enc_head(e, obj ? 5 : 4, n);
+	if (e->o != data)
+		memmove(e->o, data, len);
+	e->o += len;
+}
+
+static inline int json_hex_val(char c)
+{
+	return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+/* Decodes the <len> bytes of valid JSON string contents at <src> to <dst>,
+ * which must have room for <len> bytes. \u escapes are turned into UTF-8.
+ * Returns the decoded length.
+ */
+static size_t json_enc_unescape(char *dst, const char *src, size_t len)
+{
+	const char *end = src + len;
+	char *o = dst;
+	uint32_t cp, lo;
+
+	while (src < end) {
+		const char *bs = memchr(src, '\\', end - src);
+
+		if (!bs)
+			bs = end;
+		memcpy(o, src, bs - src);
+		o += bs - src;
+		src = bs;
+		if (src == end)
+			break;
+
+		src++;
+		switch (*src++) {
+		case 'b': *o++ = '\b'; continue;
+		case 'f': *o++ = '\f'; continue;
+		case 'n': *o++ = '\n'; continue;
+		case 'r': *o++ = '\r'; continue;
+		case 't': *o++ = '\t'; continue;
+		case 'u': break;
+		default:  *o++ = src[-1]; continue;
+		}
+
+		cp = json_hex_val(src[0]) << 12 | json_hex_val(src[1]) << 8 |
+		     json_hex_val(src[2]) << 4 | json_hex_val(src[3]);
+		src += 4;
+		if (cp >= 0xd800 && cp < 0xdc00 && end - src >= 6 && src[0] == '\\' && src[1] == 'u') {
+			lo = json_hex_val(src[2]) << 12 | json_hex_val(src[3]) << 8 |
+			     json_hex_val(src[4]) << 4 | json_hex_val(src[5]);
+			if (lo >= 0xdc00 && lo < 0xe000) {
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+				src += 6;
+			}
+		}
+		/* an escape sequence is at least as long as what it encodes */
+		if (cp < 0x80)
+			*o++ = cp;
+		else if (cp < 0x800) {
+			*o++ = 0xc0 | (cp >> 6);
+			*o++ = 0x80 | (cp & 0x3f);
+		}
+		else if (cp < 0x10000) {
+			*o++ = 0xe0 | (cp >> 12);
+			*o++ = 0x80 | ((cp >> 6) & 0x3f);
+			*o++ = 0x80 | (cp & 0x3f);
+		}
+		else {
+			*o++ = 0xf0 | (cp >> 18);
+			*o++ = 0x80 | ((cp >> 12) & 0x3f);
+			*o++ = 0x80 | ((cp >> 6) & 0x3f);
+			*o++ = 0x80 | (cp & 0x3f);
+		}
+	}
+	return o - dst;
+}
+
+static inline const char *json_enc_ws(const char *p, const char *end)
+{
+	while (p < end && json_is_ws(*p))
+		p++;
+	return p;
+}
+
+/* Value types, as named by the "type" keyword of a schema */
+#define JSON_SCH_T_NULL     0x01
+#define JSON_SCH_T_BOOLEAN  0x02
+#define JSON_SCH_T_OBJECT   0x04
+#define JSON_SCH_T_ARRAY    0x08
+#define JSON_SCH_T_NUMBER   0x10
+#define JSON_SCH_T_INTEGER  0x20
+#define JSON_SCH_T_STRING   0x40
+
+static const char * const json_sch_types[] = {
+	"null", "boolean", "object", "array", "number", "integer", "string", NULL
+};
+
+/* node flags */
+#define JSON_SCH_F_NEVER    0x01  /* the "false" schema, no value matches it */
+#define JSON_SCH_F_CLOSED   0x02  /* members not in "properties" are refused */
+#define JSON_SCH_F_MINIMUM  0x04  /* <minimum> is set */
+#define JSON_SCH_F_MAXIMUM  0x08  /* <maximum> is set */
+
+/* A compiled schema or subschema */
+struct json_sch_node {
+	unsigned int types;      /* JSON_SCH_T_* of the allowed values, 0 for all */
+	unsigned int flags;      /* JSON_SCH_F_* */
+	unsigned int props;      /* first member in the schema's <props> */
+	unsigned int nb_props;   /* number of members, sorted by name */
+	uint64_t     required;   /* one bit per required member */
+	unsigned int extra;      /* node of the members not in "properties" */
+	unsigned int items;      /* node of the array items */
+	unsigned int enums;      /* first allowed value in the schema's <enums> */
+	unsigned int nb_enums;   /* number of allowed values, 0 for all */
+	unsigned int min_len, max_len;     /* string length bounds, in characters */
+	unsigned int min_items, max_items; /* array length bounds */
+	double       minimum, maximum;     /* number bounds */
+};
+
+/* A member described by "properties" or "required" */
+struct json_sch_prop {
+	unsigned int name;   /* offset of its decoded name in the pool */
+	unsigned int len;    /* length of its name */
+	unsigned int node;   /* node its value must match */
+	int          req;    /* its bit in the node's <required>, or -1 */
+};
+
+/* A value allowed by "enum" or "const" */
+struct json_sch_enum {
+	unsigned int type;   /* JSON_SCH_T_NULL, _BOOLEAN, _NUMBER or _STRING */
+	unsigned int str;    /* offset of the decoded string in the pool */
+	unsigned int len;    /* its length */
+	double       num;    /* the number, or 1/0 for booleans */
+};
+
+/* A compiled schema. Node 0 is the empty schema which matches any value, and
+ * is referenced by all the places a schema does not constrain. The members of
+ * a node are contiguous in <props> so that keys are looked up by dichotomy.
+ */
+struct json_schema {
+	struct json_sch_node *nodes;
+	struct json_sch_prop *props;
+	struct json_sch_enum *enums;
+	char                 *pool;      /* member names and enum strings */
+	unsigned int nb_nodes, nb_props, nb_enums;
+	unsigned int root;               /* node records must match */
+	size_t       pool_len, pool_size;
+};
+
+/* Schema compiler state */
+struct json_sch_comp {
+	struct json_schema *s;
+	const char *end;      /* end of the schema text */
+	const char *err;      /* error message */
+	const char *err_at;   /* where the error was found */
+};
+
+/* Grows array <arr> of <nb> elements of <size> bytes so that it has room for
+ * one more. Its capacity doubles each time <nb> reaches a power of two.
+ * Returns the new array, or NULL if it could not be grown.
+ */
+static void *json_sch_grow(void *arr, unsigned int nb, size_t size)
+{
+	if (nb & (nb - 1))
+		return arr;
+	return realloc(arr, (nb ? nb * 2 : 1) * size);
+}
+
+static int json_sch_error(struct json_sch_comp *c, const char *p, const char *msg)
+{
+	c->err = msg;
+	c->err_at = p;
+	return -1;
+}
+
+/* Returns the first member or item of the container starting at <p>, or NULL
+ * if it is empty.
+ */
+static const char *json_sch_first(const struct json_sch_comp *c, const char *p)
+{
+	p = json_enc_ws(p + 1, c->end);
+	return (*p == '}' || *p == ']') ? NULL : p;
+}
+
+/* Returns the value of the member starting at <p> */
+static const char *json_sch_value(const struct json_sch_comp *c, const char *p)
+{
+	p = json_enc_ws(json_min_str_end(p), c->end);
+	return json_enc_ws(p + 1, c->end);
+}
+
+/* Returns the member, or the item if <member> is not set, following the one
+ * starting at <p>, or NULL if it was the last one.
+ */
+static const char *json_sch_next(const struct json_sch_comp *c, const char *p, int member)
+{
+	if (member)
+		p = json_sch_value(c, p);
+	p = json_enc_ws(json_min_skip(p, c->end), c->end);
+	return (*p == ',') ? json_enc_ws(p + 1, c->end) : NULL;
+}
+
+/* Tells if the key of the member starting at <p> is <kw>, which has no
+ * escape sequence.
+ */
+static inline int json_sch_key_is(const char *p, const char *kw)
+{
+	size_t len = strlen(kw);
+
+	return (size_t)(json_min_str_end(p) - p - 2) == len && memcmp(p + 1, kw, len) == 0;
+}
+
+/* Decodes the string starting at <p> to the pool. Its offset and length are
+ * returned in <ofs> and <len>. Returns 0 on success or -1 on error.
+ */
+static int json_sch_string(struct json_sch_comp *c, const char *p, unsigned int *ofs, unsigned int *len)
+{
+	struct json_schema *s = c->s;
+	size_t raw;
+
+	if (*p != '"')
+		return json_sch_error(c, p, "a string is expected");
+	raw = json_min_str_end(p) - p - 2;
+	if (s->pool_len + raw > s->pool_size) {
+		size_t size = s->pool_size ? s->pool_size : 256;
+		char *pool;
+
+		while (size < s->pool_len + raw)
+			size *= 2;
+		pool = realloc(s->pool, size);
+		if (!pool)
+			return json_sch_error(c, p, "out of memory");
+		s->pool = pool;
+		s->pool_size = size;
+	}
+	*ofs = s->pool_len;
+	*len = json_enc_unescape(s->pool + s->pool_len, p + 1, raw);
+	s->pool_len += *len;
+	return 0;
+}
+
+/* Parses the number starting at <p> to <num>. Returns 0 on success or -1 if
+ * it is not a number.
+ */
+static int json_sch_number(struct json_sch_comp *c, const char *p, double *num)
+{
+	const char *q = json_min_skip(p, c->end);
+	char tmp[64];
+
+	if (*p != '-' && (*p < '0' || *p > '9'))
+		return json_sch_error(c, p, "a number is expected");
+	if ((size_t)(q - p) >= sizeof(tmp))
+		return json_sch_error(c, p, "number too long");
+	memcpy(tmp, p, q - p);
+	tmp[q - p] = 0;
+	*num = strtod(tmp, NULL);
+	return 0;
+}
+
+/* Parses the non-negative integer starting at <p> to <val>. Returns 0 on
+ * success or -1 on error.
+ */
+static int json_sch_count(struct json_sch_comp *c, const char *p, unsigned int *val)
+{
+	unsigned long long n = 0;
+	const char *q;
+
+	for (q = p; *q >= '0' && *q <= '9'; q++) {
+		n = n * 10 + (*q - '0');
+		if (n >= UINT32_MAX)
+			return json_sch_error(c, p, "value too large");
+	}
+	if (q == p || *q == '.' || *q == 'e' || *q == 'E')
+		return json_sch_error(c, p, "a non-negative integer is expected");
+	*val = n;
+	return 0;
+}
+
+/* Appends to the enums of node <idx> the scalar starting at <p>. Returns 0 on
+ * success or -1 on error.
+ */
+static int json_sch_enum(struct json_sch_comp *c, unsigned int idx, const char *p)
+{
+	struct json_schema *s = c->s;
+	struct json_sch_enum *e;
+
+	if (*p == '{' || *p == '[')
+		return json_sch_error(c, p, "only scalars are supported in 'enum' and 'const'");
+	e = json_sch_grow(s->enums, s->nb_enums, sizeof(*e));
+	if (!e)
+		return json_sch_error(c, p, "out of memory");
+	s->enums = e;
+	e = &s->enums[s->nb_enums];
+	memset(e, 0, sizeof(*e));
+	switch (*p) {
+	case '"':
+		e->type = JSON_SCH_T_STRING;
+		if (json_sch_string(c, p, &e->str, &e->len) < 0)
+			return -1;
+		break;
+	case 't':
+	case 'f':
+		e->type = JSON_SCH_T_BOOLEAN;
+		e->num = (*p == 't');
+		break;
+	case 'n':
+		e->type = JSON_SCH_T_NULL;
+		break;
+	default:
+		e->type = JSON_SCH_T_NUMBER;
+		if (json_sch_number(c, p, &e->num) < 0)
+			return -1;
+	}
+	s->nb_enums++;
+	s->nodes[idx].nb_enums++;
+	return 0;
+}
+
+/* Parses the "type" keyword starting at <p> to <types>. Returns 0 on success
+ * or -1 on error.
+ */
+static int json_sch_types_of(struct json_sch_comp *c, const char *p, unsigned int *types)
+{
+	const char *it = p;
+	size_t len;
+	int i;
+
+	*types = 0;
+	if (*p == '[')
+		it = json_sch_first(c, p);
+	for (; it; it = (*p == '[') ? json_sch_next(c, it, 0) : NULL) {
+		if (*it != '"')
+			return json_sch_error(c, it, "a type name is expected");
+		len = json_min_str_end(it) - it - 2;
+		for (i = 0; json_sch_types[i]; i++) {
+			if (strlen(json_sch_types[i]) == len && memcmp(it + 1, json_sch_types[i], len) == 0)
+				break;
+		}
+		if (!json_sch_types[i])
+			return json_sch_error(c, it, "unknown type");
+		*types |= 1 << i;
+	}
+	if (!*types)
+		return json_sch_error(c, p, "at least one type is expected");
+	return 0;
+}
+
+/* Returns the member of node <n> named <name>, or NULL */
+static const struct json_sch_prop *json_sch_find(const struct json_schema *s, const struct json_sch_node *n,
+                                                 const char *name, size_t len)
+{
+	unsigned int lo = n->props, hi = n->props + n->nb_props;
+
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		const struct json_sch_prop *p = &s->props[mid];
+		int ret = memcmp(s->pool + p->name, name, p->len < len ? p->len : len);
+
+		if (!ret)
+			ret = (p->len > len) - (p->len < len);
+		if (!ret)
+			return p;
+		if (ret < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+static int json_sch_node(struct json_sch_comp *c, const char *p, unsigned int depth);
+
+/* Compiles the "properties" keyword starting at <p> for node <idx>. The
+ * subschemas are compiled first so that the members of the node are appended
+ * at once, then sorted by name. Returns 0 on success or -1 on error.
+ */
+static int json_sch_properties(struct json_sch_comp *c, unsigned int idx, const char *p, unsigned int depth)
+{
+	struct json_schema *s = c->s;
+	struct json_sch_prop *tmp = NULL, *prop, swap;
+	const char *m;
+	unsigned int nb = 0, i, j;
+	int node;
+
+	if (*p != '{')
+		return json_sch_error(c, p, "'properties' expects an object");
+	for (m = json_sch_first(c, p); m; m = json_sch_next(c, m, 1))
+		nb++;
+	if (!nb)
+		return 0;
+	tmp = calloc(nb, sizeof(*tmp));
+	if (!tmp)
+		return json_sch_error(c, p, "out of memory");
+
+	for (i = 0, m = json_sch_first(c, p); m; i++, m = json_sch_next(c, m, 1)) {
+		if (json_sch_string(c, m, &tmp[i].name, &tmp[i].len) < 0)
+			goto error;
+		node = json_sch_node(c, json_sch_value(c, m), depth + 1);
+		if (node < 0)
+			goto error;
+		tmp[i].node = node;
+		tmp[i].req = -1;
+	}
+
+	s->nodes[idx].props = s->nb_props;
+	for (i = 0; i < nb; i++) {
+		prop = json_sch_grow(s->props, s->nb_props, sizeof(*prop));
+		if (!prop) {
+			json_sch_error(c, p, "out of memory");
+			goto error;
+		}
+		s->props = prop;
+		s->props[s->nb_props++] = tmp[i];
+
+		/* insertion sort, schemas are small */
+		prop = &s->props[s->nodes[idx].props];
+		for (j = i; j > 0; j--) {
+			int ret = memcmp(s->pool + prop[j - 1].name, s->pool + prop[j].name,
+			                 prop[j - 1].len < prop[j].len ? prop[j - 1].len : prop[j].len);
+
+			if (ret < 0 || (!ret && prop[j - 1].len <= prop[j].len))
+				break;
+			swap = prop[j - 1];
+			prop[j - 1] = prop[j];
+			prop[j] = swap;
+		}
+	}
+	s->nodes[idx].nb_props = nb;
+	free(tmp);
+	return 0;
+
+  error:
+	free(tmp);
+	return -1;
+}
+
+/* Compiles the "required" keyword starting at <p> for node <idx>, once its
+ * "properties" were compiled. Members which are not described are appended
+ * to the node with the empty schema, and sorted by name. Returns 0 on success
+ * or -1 on error.
+ */
+static int json_sch_required(struct json_sch_comp *c, unsigned int idx, const char *p)
+{
+	struct json_schema *s = c->s;
+	struct json_sch_node *n = &s->nodes[idx];
+	struct json_sch_prop *prop, swap;
+	const char *it;
+	unsigned int name, len, nb_req = 0, i;
+
+	if (*p != '[')
+		return json_sch_error(c, p, "'required' expects an array");
+	if (!n->nb_props)
+		n->props = s->nb_props;
+	for (it = json_sch_first(c, p); it; it = json_sch_next(c, it, 0)) {
+		if (json_sch_string(c, it, &name, &len) < 0)
+			return -1;
+		prop = (struct json_sch_prop *)json_sch_find(s, n, s->pool + name, len);
+		if (prop) {
+			/* the name is already in the pool */
+			s->pool_len -= len;
+			if (prop->req >= 0)
+				continue;
+		}
+		else {
+			prop = json_sch_grow(s->props, s->nb_props, sizeof(*prop));
+			if (!prop)
+				return json_sch_error(c, it, "out of memory");
+			s->props = prop;
+			prop = &s->props[s->nb_props++];
+			prop->name = name;
+			prop->len  = len;
+			prop->node = 0;
+			n->nb_props++;
+		}
+		if (nb_req == 64)
+			return json_sch_error(c, it, "too many required members");
+		prop->req = nb_req++;
+		n->required |= 1ULL << prop->req;
+
+		/* move a new member to its place */
+		for (i = prop - s->props; i > n->props; i--) {
+			struct json_sch_prop *a = &s->props[i - 1], *b = &s->props[i];
+			int ret = memcmp(s->pool + a->name, s->pool + b->name, a->len < b->len ? a->len : b->len);
+
+			if (ret < 0 || (!ret && a->len <= b->len))
+				break;
+			swap = *a;
+			*a = *b;
+			*b = swap;
+		}
+	}
+	return 0;
+}
+
+/* Compiles the schema starting at <p>, at nesting level <depth>. Returns the
+ * index of its node on success, or -1 on error.
+ */
+static int json_sch_node(struct json_sch_comp *c, const char *p, unsigned int depth)
+{
+	struct json_schema *s = c->s;
+	struct json_sch_node *n;
+	const char *m, *v, *props = NULL, *req = NULL;
+	unsigned int idx;
+	int node;
+
+	/* "true" is the empty schema */
+	if (*p == 't')
+		return 0;
+	if (*p != '{' && *p != 'f')
+		return json_sch_error(c, p, "a schema must be an object or a boolean");
+	if (depth > JSON_SCHEMA_MAX_DEPTH)
+		return json_sch_error(c, p, "schema nested too deeply");
+
+	n = json_sch_grow(s->nodes, s->nb_nodes, sizeof(*n));
+	if (!n)
+		return json_sch_error(c, p, "out of memory");
+	s->nodes = n;
+	idx = s->nb_nodes++;
+	n = &s->nodes[idx];
+	memset(n, 0, sizeof(*n));
+	n->max_len = n->max_items = UINT32_MAX;
+	if (*p == 'f') {
+		n->flags = JSON_SCH_F_NEVER;
+		return idx;
+	}
+
+	/* nodes may move while subschemas are compiled, so <n> is only used
+	 * for the keywords which do not have any */
+	for (m = json_sch_first(c, p); m; m = json_sch_next(c, m, 1)) {
+		v = json_sch_value(c, m);
+		n = &s->nodes[idx];
+
+		if (json_sch_key_is(m, "type")) {
+			if (json_sch_types_of(c, v, &n->types) < 0)
+				return -1;
+		}
+		else if (json_sch_key_is(m, "properties"))
+			props = v;
+		else if (json_sch_key_is(m, "required"))
+			req = v;
+		else if (json_sch_key_is(m, "additionalProperties")) {
+			if (*v == 'f')
+				n->flags |= JSON_SCH_F_CLOSED;
+			else {
+				node = json_sch_node(c, v, depth + 1);
+				if (node < 0)
+					return -1;
+				s->nodes[idx].extra = node;
+			}
+		}
+		else if (json_sch_key_is(m, "items")) {
+			if (*v == '[')
+				return json_sch_error(c, v, "the array form of 'items' is not supported");
+			node = json_sch_node(c, v, depth + 1);
+			if (node < 0)
+				return -1;
+			s->nodes[idx].items = node;
+		}
+		else if (json_sch_key_is(m, "enum") || json_sch_key_is(m, "const")) {
+			const char *it = v;
+			int is_enum = (m[1] == 'e');
+
+			if (is_enum && *v != '[')
+				return json_sch_error(c, v, "'enum' expects an array");
+			n->enums = s->nb_enums;
+			n->nb_enums = 0;
+			if (is_enum)
+				it = json_sch_first(c, v);
+			for (; it; it = is_enum ? json_sch_next(c, it, 0) : NULL) {
+				if (json_sch_enum(c, idx, it) < 0)
+					return -1;
+			}
+			if (!s->nodes[idx].nb_enums)
+				s->nodes[idx].flags |= JSON_SCH_F_NEVER;
+		}
+		else if (json_sch_key_is(m, "minLength")) {
+			if (json_sch_count(c, v, &n->min_len) < 0)
+				return -1;
+		}
+		else if (json_sch_key_is(m, "maxLength")) {
+			if (json_sch_count(c, v, &n->max_len) < 0)
+				return -1;
+		}
+		else if (json_sch_key_is(m, "minItems")) {
+			if (json_sch_count(c, v, &n->min_items) < 0)
+				return -1;
+		}
+		else if (json_sch_key_is(m, "maxItems")) {
+			if (json_sch_count(c, v, &n->max_items) < 0)
+				return -1;
+		}
+		else if (json_sch_key_is(m, "minimum")) {
+			if (json_sch_number(c, v, &n->minimum) < 0)
+				return -1;
+			n->flags |= JSON_SCH_F_MINIMUM;
+		}
+		else if (json_sch_key_is(m, "maximum")) {
+			if (json_sch_number(c, v, &n->maximum) < 0)
+				return -1;
+			n->flags |= JSON_SCH_F_MAXIMUM;
+		}
+		else if (!json_sch_key_is(m, "$schema") && !json_sch_key_is(m, "$id") &&
+		         !json_sch_key_is(m, "id") && !json_sch_key_is(m, "$comment") &&
+		         !json_sch_key_is(m, "title") && !json_sch_key_is(m, "description") &&
+		         !json_sch_key_is(m, "default") && !json_sch_key_is(m, "examples") &&
+		         !json_sch_key_is(m, "format")) {
+			/* refused rather than ignored, records would pass
+			 * checks the user expects to be made */
+			return json_sch_error(c, m, "unsupported keyword");
+		}
+	}
+
+	/* the members of the node must be contiguous */
+	if (props && json_sch_properties(c, idx, props, depth) < 0)
+		return -1;
+	if (req && json_sch_required(c, idx, req) < 0)
+		return -1;
+	return idx;
+}
+
+/* Releases schema <s>, which may be NULL */
+void json_schema_free(struct json_schema *s)
+{
+	if (!s)
+		return;
+	free(s->nodes);
+	free(s->props);
+	free(s->enums);
+	free(s->pool);
+	free(s);
+}
+
+/* Compiles the JSON schema made of the <len> bytes at <in>. The supported
+ * keywords are "type", "properties", "required", "additionalProperties",
+ * "items", "enum", "const", "minLength", "maxLength", "minItems", "maxItems",
+ * "minimum" and "maximum", and the annotations are ignored. Returns the
+ * compiled schema, or NULL with <err> set to an error message and <err_ofs>
+ * to where it was found in the input.
+ */
+struct json_schema *json_schema_compile(const char *in, size_t len, const char **err, size_t *err_ofs)
+{
+	struct json_simd_state st;
+	struct json_view v;
+	struct json_sch_comp c;
+	struct json_sch_node *any;
+	int root;
+
+	v.blk1 = in;
+	v.len1 = len;
+	v.blk2 = NULL;
+	v.len2 = 0;
+	json_simd_init(&st);
+	if (json_simd_scan(&st, &v) == JSON_FAIL) {
+		*err = "invalid JSON";
+		*err_ofs = st.error;
+		return NULL;
+	}
+	if (!json_simd_suspend(&st, &v) || json_simd_end(&st) == JSON_FAIL || st.records != 1) {
+		*err = "the schema must be a single JSON value";
+		*err_ofs = len;
+		return NULL;
+	}
+
+	c.s = calloc(1, sizeof(*c.s));
+	c.end = in + len;
+	c.err = "out of memory";
+	c.err_at = in;
+	if (!c.s)
+		goto error;
+
+	/* node 0, the empty schema */
+	any = json_sch_grow(NULL, 0, sizeof(*any));
+	if (!any)
+		goto error;
+	memset(any, 0, sizeof(*any));
+	any->max_len = any->max_items = UINT32_MAX;
+	c.s->nodes = any;
+	c.s->nb_nodes = 1;
+
+	root = json_sch_node(&c, json_enc_ws(in, c.end), 1);
+	if (root < 0)
+		goto error;
+	c.s->root = root;
+	return c.s;
+
+  error:
+	json_schema_free(c.s);
+	*err = c.err;
+	*err_ofs = c.err_at - in;
+	return NULL;
+}
+
+/* Prepares <ctx> to check a record against schema <s> */
+void json_schema_start(struct json_schema_ctx *ctx, const struct json_schema *s)
+{
+	ctx->schema = s;
+	ctx->next   = s->root;
+	ctx->depth  = 0;
+	ctx->skip   = 0;
+}
+
+/* Checks that a value of type <type> may come next. Returns its node, which is
+ * node 0 when it needs no check, or NULL if it breaks the schema.
+ */
+static inline const struct json_sch_node *json_schema_value(struct json_schema_ctx *ctx, unsigned int type)
+{
+	const struct json_sch_node *nodes = ctx->schema->nodes;
+	const struct json_sch_node *n;
+	struct json_schema_frame *f;
+
+	if (ctx->skip)
+		return nodes;
+	if (ctx->depth) {
+		f = &ctx->frames[ctx->depth - 1];
+		if (!f->object && ++f->count > nodes[f->node].max_items)
+			return NULL;
+	}
+	n = &nodes[ctx->next];
+	if (unlikely(n->flags & JSON_SCH_F_NEVER))
+		return NULL;
+	/* integers are numbers too */
+	if (n->types && !(n->types & type) &&
+	    !(type == JSON_SCH_T_INTEGER && (n->types & JSON_SCH_T_NUMBER)))
+		return NULL;
+	return n;
+}
+
+/* Tells if the scalar of type <type> is among the values allowed by node <n> */
+static int json_schema_enum(const struct json_schema *s, const struct json_sch_node *n,
+                            unsigned int type, double num, const char *str, size_t len)
+{
+	const struct json_sch_enum *e = &s->enums[n->enums];
+	unsigned int i;
+
+	for (i = 0; i < n->nb_enums; i++, e++) {
+		if (e->type != type)
+			continue;
+		if (type != JSON_SCH_T_STRING) {
+			if (e->num == num)
+				return 1;
+		}
+		else if (e->len == len && memcmp(s->pool + e->str, str, len) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/* The json_schema_*() callbacks below are called for each event of the record,
+ * in order. They return 1 as long as it matches the schema, otherwise 0.
+ */
+int json_schema_open(struct json_schema_ctx *ctx, int object)
+{
+	const struct json_sch_node *n;
+	struct json_schema_frame *f;
+
+	if (ctx->skip) {
+		ctx->skip++;
+		return 1;
+	}
+	n = json_schema_value(ctx, object ? JSON_SCH_T_OBJECT : JSON_SCH_T_ARRAY);
+	if (!n || n->nb_enums)
+		return 0;
+	if (n == ctx->schema->nodes) {
+		/* nothing to check inside */
+		ctx->skip = 1;
+		return 1;
+	}
+	/* cannot happen, the schema is not deeper */
+	if (unlikely(ctx->depth == JSON_SCHEMA_MAX_DEPTH))
+		return 0;
+	f = &ctx->frames[ctx->depth++];
+	f->seen   = 0;
+	f->node   = n - ctx->schema->nodes;
+	f->count  = 0;
+	f->object = object;
+	ctx->next = n->items;
+	return 1;
+}
+
+int json_schema_close(struct json_schema_ctx *ctx)
+{
+	const struct json_sch_node *nodes = ctx->schema->nodes;
+	struct json_schema_frame *f;
+
+	if (ctx->skip) {
+		ctx->skip--;
+		return 1;
+	}
+	f = &ctx->frames[--ctx->depth];
+	if (f->object ? (f->seen != nodes[f->node].required) : (f->count < nodes[f->node].min_items))
+		return 0;
+	if (ctx->depth) {
+		/* next item of the enclosing array */
+		f--;
+		if (!f->object)
+			ctx->next = nodes[f->node].items;
+	}
+	return 1;
+}
+
+int json_schema_key(struct json_schema_ctx *ctx, const char *key, size_t len)
+{
+	const struct json_sch_node *n;
+	const struct json_sch_prop *p;
+	struct json_schema_frame *f;
+
+	if (ctx->skip)
+		return 1;
+	f = &ctx->frames[ctx->depth - 1];
+	n = &ctx->schema->nodes[f->node];
+	p = json_sch_find(ctx->schema, n, key, len);
+	if (p) {
+		if (p->req >= 0)
+			f->seen |= 1ULL << p->req;
+		ctx->next = p->node;
+		return 1;
+	}
+	if (n->flags & JSON_SCH_F_CLOSED)
+		return 0;
+	ctx->next = n->extra;
+	return 1;
+}
+
+int json_schema_string(struct json_schema_ctx *ctx, const char *str, size_t len)
+{
+	const struct json_sch_node *n = json_schema_value(ctx, JSON_SCH_T_STRING);
+	size_t chars, i;
+
+	if (!n)
+		return 0;
+	if (n->min_len || n->max_len != UINT32_MAX) {
+		/* lengths are in characters, continuation bytes do not count */
+		for (chars = i = 0; i < len; i++)
+			chars += ((str[i] & 0xc0) != 0x80);
+		if (chars < n->min_len || chars > n->max_len)
+			return 0;
+	}
+	return !n->nb_enums || json_schema_enum(ctx->schema, n, JSON_SCH_T_STRING, 0, str, len);
+}
+
+int json_schema_number(struct json_schema_ctx *ctx, double num, int is_int)
+{
+	const struct json_sch_node *n;
+
+	/* 1.0 is an integer too */
+	if (!is_int && num >= -9.2e18 && num <= 9.2e18 && num == (double)(long long)num)
+		is_int = 1;
+	n = json_schema_value(ctx, is_int ? JSON_SCH_T_INTEGER : JSON_SCH_T_NUMBER);
+	if (!n)
+		return 0;
+	if (((n->flags & JSON_SCH_F_MINIMUM) && num < n->minimum) ||
+	    ((n->flags & JSON_SCH_F_MAXIMUM) && num > n->maximum))
+		return 0;
+	return !n->nb_enums || json_schema_enum(ctx->schema, n, JSON_SCH_T_NUMBER, num, NULL, 0);
+}
+
+int json_schema_bool(struct json_schema_ctx *ctx, int val)
+{
+	const struct json_sch_node *n = json_schema_value(ctx, JSON_SCH_T_BOOLEAN);
+
+	if (!n)
+		return 0;
+	return !n->nb_enums || json_schema_enum(ctx->schema, n, JSON_SCH_T_BOOLEAN, !!val, NULL, 0);
+}
+
+int json_schema_null(struct json_schema_ctx *ctx)
+{
+	const struct json_sch_node *n = json_schema_value(ctx, JSON_SCH_T_NULL);
+
+	if (!n)
+		return 0;
+	return !n->nb_enums || json_schema_enum(ctx->schema, n, JSON_SCH_T_NULL, 0, NULL, 0);
+}
@@ -0,0 +1,172 @@
+/*
+ * Structural index based JSON validator.
+ *
+ * The input is seen as a logical stream made of at most two contiguous
+ * blocks, which is exactly what a wrapping channel buffer gives us. A first
+ * stage classifies the input 64 bytes at a time with vector instructions and
+ * extracts the offsets of structural characters (braces, brackets, colons,
+ * commas, quotes and the start of each scalar). A second stage walks these
+ * offsets only and checks the grammar, so bytes inside strings are never
+ * looked at one by one.
+ */
+#ifndef _JSONSIMD_H
+#define _JSONSIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jsonwrapper.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* maximum nesting level of objects and arrays */
+#define JSON_SIMD_MAX_DEPTH  1024
+
+/* maximum length of a scalar saved by json_simd_suspend() */
+#define JSON_SIMD_MAX_SCALAR 128
+
+/* a logical view of up to two contiguous blocks */
+struct json_view {
+	const char *blk1;
+	size_t      len1;
+	const char *blk2;
+	size_t      len2;
+};
+
+/* Scanner state. Offsets are relative to the beginning of the view passed to
+ * json_simd_scan(). All fields are private to the scanner except <done>,
+ * <scanned>, <records>, <last> and <last_end>.
+ */
+struct json_simd_state {
+	/* stage 1 carries, describing the byte right after the last indexed one */
+	uint64_t prev_in_string;  /* all ones if it is inside a string */
+	uint64_t prev_escaped;    /* 1 if it is escaped by a backslash */
+	uint64_t prev_scalar;     /* 1 if the previous byte belongs to a scalar */
+	uint64_t prev_hexneed;    /* bits that must be hex digits (\uXXXX) */
+
+	/* stage 2 */
+	unsigned int state;       /* JSON_ST_* */
+	unsigned int depth;       /* current nesting level */
+	uint64_t     stack[JSON_SIMD_MAX_DEPTH / 64]; /* 1=object, 0=array */
+
+	size_t   scanned;         /* first byte not indexed yet */
+	size_t   done;            /* end of the last complete record and its trailing whitespaces */
+	size_t   error;           /* offset of the first error if any */
+	unsigned int records;     /* number of complete records found */
+	size_t   last;            /* start of the last complete record */
+	size_t   last_end;        /* end of the last complete record, 0 if none */
+
+	/* partial scalar saved by json_simd_suspend(), with room for the
+	 * byte following it */
+	unsigned int pend_len;
+	char     pend[JSON_SIMD_MAX_SCALAR + 1];
+};
+
+/* returns the byte at offset <ofs> of view <v> */
+static inline unsigned char json_view_byte(const struct json_view *v, size_t ofs)
+{
+	return (ofs < v->len1) ? v->blk1[ofs] : v->blk2[ofs - v->len1];
+}
+
+void json_simd_init(struct json_simd_state *st);
+json_passed_t json_simd_scan(struct json_simd_state *st, const struct json_view *v);
+void json_simd_consume(struct json_simd_state *st, size_t len);
+void json_simd_restart(struct json_simd_state *st, size_t ofs);
+int json_simd_suspend(struct json_simd_state *st, const struct json_view *v);
+json_passed_t json_simd_end(struct json_simd_state *st);
+
+/* return codes of json_path_lookup() */
+#define JSON_LOOKUP_FOUND      1   /* the element was found */
+#define JSON_LOOKUP_NOTFOUND   0   /* the element does not exist in the record */
+#define JSON_LOOKUP_MISSING   -1   /* the record is incomplete, more data are needed */
+#define JSON_LOOKUP_INVALID   -2   /* the record is not valid JSON */
+
+int json_path_check(const char *path);
+int json_path_lookup(const struct json_view *v, const char *path, size_t *start, size_t *end);
+
+/* maximum length of a string looked for by json_raw_contains() */
+#define JSON_RAW_MAX_LEN     256
+
+int json_raw_contains(const struct json_view *v, size_t from, size_t to, const char *n, size_t nlen);
+size_t json_view_chr(const struct json_view *v, size_t from, size_t to, char c);
+unsigned int json_split_lines(const struct json_view *v, size_t from, size_t to, size_t *end);
+size_t json_minify(const struct json_view *v, size_t from, size_t to, char *out);
+int json_canon_thread_init(size_t len);
+void json_canon_thread_deinit(void);
+size_t json_canonicalize(const char *in, size_t len, char *out);
+
+/* output formats of the record encoder */
+#define JSON_ENC_CBOR        1
+#define JSON_ENC_MSGPACK     2
+
+/* longest head of a string, an array or a map in both formats */
+#define JSON_ENC_MAX_HEAD    9
+
+/* Record encoder, fed with the events of the parser while it validates the
+ * record. Each record is written as its length on 4 bytes in network order,
+ * followed by a single CBOR data item or MessagePack object.
+ */
+struct json_enc {
+	char *start;         /* beginning of the output area */
+	char *o;             /* next byte to write */
+	char *end;           /* end of the output area */
+	int   fmt;           /* JSON_ENC_* */
+	int   full;          /* set once something did not fit */
+	unsigned int depth;  /* number of entries in <open> */
+	unsigned int open[JSON_SIMD_MAX_DEPTH + 1]; /* offsets of the record and of the
+	                                             * open containers, to complete */
+};
+
+void json_enc_init(struct json_enc *e, char *out, size_t size, int fmt);
+int json_enc_begin(struct json_enc *e);
+void json_enc_end(struct json_enc *e);
+void json_enc_cancel(struct json_enc *e);
+int json_enc_null(struct json_enc *e);
+int json_enc_bool(struct json_enc *e, int b);
+int json_enc_int(struct json_enc *e, uint64_t n, int neg);
+int json_enc_double(struct json_enc *e, double d);
+int json_enc_string(struct json_enc *e, const char *str, size_t len);
+int json_enc_open(struct json_enc *e);
+void json_enc_close(struct json_enc *e, int obj, uint64_t n);
+
+/* maximum nesting level of a schema */
+#define JSON_SCHEMA_MAX_DEPTH  32
+
+/* an object or an array being checked against a schema */
+struct json_schema_frame {
+	uint64_t     seen;     /* required members seen so far */
+	unsigned int node;     /* schema it must match */
+	unsigned int count;    /* items seen so far */
+	unsigned int object;   /* 1 for an object, 0 for an array */
+};
+
+/* State of the check of a record against a compiled schema. Values which are
+ * deeper than the schema describes are only counted in <skip>, so the frames
+ * never outnumber the nesting levels of the schema.
+ */
+struct json_schema_ctx {
+	const struct json_schema *schema;
+	unsigned int next;     /* schema the next value must match */
+	unsigned int depth;    /* frames in use */
+	unsigned int skip;     /* nesting level inside a value which is not checked */
+	struct json_schema_frame frames[JSON_SCHEMA_MAX_DEPTH];
+};
+
+struct json_schema *json_schema_compile(const char *in, size_t len, const char **err, size_t *err_ofs);
+void json_schema_free(struct json_schema *s);
+void json_schema_start(struct json_schema_ctx *ctx, const struct json_schema *s);
+int json_schema_open(struct json_schema_ctx *ctx, int object);
+int json_schema_close(struct json_schema_ctx *ctx);
+int json_schema_key(struct json_schema_ctx *ctx, const char *key, size_t len);
+int json_schema_string(struct json_schema_ctx *ctx, const char *str, size_t len);
+int json_schema_number(struct json_schema_ctx *ctx, double num, int is_int);
+int json_schema_bool(struct json_schema_ctx *ctx, int val);
+int json_schema_null(struct json_schema_ctx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JSONSIMD_H */
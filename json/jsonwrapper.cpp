@@ -1,7 +1,12 @@
+#include <new>
+#include <stdint.h>
+
 #include "./jsonwrapper.h"
+#include "./jsonsimd.h"
 //#include "rapidjson/include/rapidjson/rapidjson.h"
 #include "rapidjson/document.h"
 #include "rapidjson/error/en.h"
+#include "rapidjson/reader.h"
 #include "rapidjson/stream.h"
 using namespace rapidjson;
 
@@ -146,16 +151,180 @@ namespace rapidjson {
 		};
 };
 
+/* Validation only needs a yes/no answer, so records are fed to a SAX handler
+ * which ignores all events instead of being built into a Document. The only
+ * memory the reader needs is its stack, where strings are copied before being
+ * passed to the handler. It is taken from a per-thread arena which is reset
+ * before each record, so no heap allocation happens as long as the arena is
+ * large enough for the longest string of the record.
+ */
+typedef GenericReader<UTF8<>, UTF8<>, MemoryPoolAllocator<> > ArenaReader;
+
+/* default size of an arena created on first use */
+#define JSON_ARENA_DEF_SIZE   65536
+
+struct JsonArena {
+	JsonArena(uint64_t *buffer, size_t size)
+		: buffer_(buffer)
+		, allocator_(buffer, size)
+		, reader_(&allocator_)
+		, users_(0)
+	{
+	}
+	~JsonArena() { allocator_.Clear(); delete[] buffer_; }
+
+	uint64_t *buffer_;                 //!< Arena, aligned for the allocator's chunk headers
+	MemoryPoolAllocator<> allocator_;  //!< Allocates from the arena, only falls back to malloc when it is full
+	ArenaReader reader_;               //!< Its stack is allocated from allocator_
+	unsigned int users_;               //!< Number of filters that set it up
+};
+
+static __thread JsonArena *json_arena = NULL;
+
+/* Sets up the arena of the current thread with <size> bytes. It may be called
+ * several times, each call must be matched by json_parse_thread_deinit().
+ * Returns 1 on success, 0 on error.
+ */
+int json_parse_thread_init(size_t size){
+	if(!json_arena){
+		uint64_t *buffer = new (std::nothrow) uint64_t[(size + 7) / 8];
+
+		if(!buffer)
+			return 0;
+		json_arena = new (std::nothrow) JsonArena(buffer, (size + 7) / 8 * 8);
+		if(!json_arena){
+			delete[] buffer;
+			return 0;
+		}
+	}
+	json_arena->users_++;
+	return 1;
+}
+
+/* Releases the arena of the current thread once its last user is gone */
+void json_parse_thread_deinit(void){
+	if(json_arena && --json_arena->users_ == 0){
+		delete json_arena;
+		json_arena = NULL;
+	}
+}
+
+/* SAX handler checking the record against a compiled schema while it is
+ * parsed. A callback returning false makes the reader stop with an error, so
+ * a record breaking the schema fails exactly like an invalid one.
+ */
+struct SchemaHandler : public BaseReaderHandler<UTF8<>, SchemaHandler> {
+	SchemaHandler(const struct json_schema *schema) { json_schema_start(&ctx_, schema); }
+
+	bool Null() { return json_schema_null(&ctx_); }
+	bool Bool(bool b) { return json_schema_bool(&ctx_, b); }
+	bool Int(int i) { return json_schema_number(&ctx_, i, 1); }
+	bool Uint(unsigned u) { return json_schema_number(&ctx_, u, 1); }
+	bool Int64(int64_t i) { return json_schema_number(&ctx_, static_cast<double>(i), 1); }
+	bool Uint64(uint64_t u) { return json_schema_number(&ctx_, static_cast<double>(u), 1); }
+	bool Double(double d) { return json_schema_number(&ctx_, d, 0); }
+	bool String(const Ch* str, SizeType len, bool) { return json_schema_string(&ctx_, str, len); }
+	bool StartObject() { return json_schema_open(&ctx_, 1); }
+	bool Key(const Ch* str, SizeType len, bool) { return json_schema_key(&ctx_, str, len); }
+	bool EndObject(SizeType) { return json_schema_close(&ctx_); }
+	bool StartArray() { return json_schema_open(&ctx_, 0); }
+	bool EndArray(SizeType) { return json_schema_close(&ctx_); }
+
+	struct json_schema_ctx ctx_;
+};
+
+/* SAX handler encoding the record to CBOR or MessagePack as it is parsed,
+ * once the events were accepted by the handler <next> which validates it. A
+ * callback returning false when the output is full makes the reader stop
+ * with an error, the caller tells it from an invalid record with enc->full.
+ */
+template <typename Next>
+struct EncodeHandler : public BaseReaderHandler<UTF8<>, EncodeHandler<Next> > {
+	typedef typename Next::Ch Ch;
+
+	EncodeHandler(Next& next, struct json_enc *enc) : next_(next), enc_(enc) {}
+
+	bool Null() { return next_.Null() && json_enc_null(enc_); }
+	bool Bool(bool b) { return next_.Bool(b) && json_enc_bool(enc_, b); }
+	bool Int(int i) { return next_.Int(i) && json_enc_int(enc_, i < 0 ? 0 - static_cast<uint64_t>(i) : i, i < 0); }
+	bool Uint(unsigned u) { return next_.Uint(u) && json_enc_int(enc_, u, 0); }
+	bool Int64(int64_t i) { return next_.Int64(i) && json_enc_int(enc_, i < 0 ? 0 - static_cast<uint64_t>(i) : i, i < 0); }
+	bool Uint64(uint64_t u) { return next_.Uint64(u) && json_enc_int(enc_, u, 0); }
+	bool Double(double d) { return next_.Double(d) && json_enc_double(enc_, d); }
+	bool String(const Ch* str, SizeType len, bool copy) { return next_.String(str, len, copy) && json_enc_string(enc_, str, len); }
+	bool StartObject() { return next_.StartObject() && json_enc_open(enc_); }
+	bool Key(const Ch* str, SizeType len, bool copy) { return next_.Key(str, len, copy) && json_enc_string(enc_, str, len); }
+	bool EndObject(SizeType n) { if (!next_.EndObject(n)) return false; json_enc_close(enc_, 1, n); return true; }
+	bool StartArray() { return next_.StartArray() && json_enc_open(enc_); }
+	bool EndArray(SizeType n) { if (!next_.EndArray(n)) return false; json_enc_close(enc_, 0, n); return true; }
+
+	Next& next_;
+	struct json_enc *enc_;
+};
+
+/* Validates the next record of <is> with the arena of the current thread,
+ * which is created if it was not set up. Events are passed to <handler>.
+ * Returns non-zero if it is valid.
+ */
+template <typename InputStream, typename Handler>
+static bool json_validate(InputStream& is, Handler& handler){
+	if(RAPIDJSON_UNLIKELY(!json_arena)){
+		if(!json_parse_thread_init(JSON_ARENA_DEF_SIZE))
+			return false;
+	}
+	/* The reader only rewinds its stack when it returns, it still points
+	 * to memory of the allocator, possibly to a chunk allocated once the
+	 * arena was full. Clear() releases such chunks and hands the whole
+	 * arena out again, so the reader is rebuilt around it to drop its
+	 * stack, which costs nothing since the stack is allocated on first use.
+	 */
+	json_arena->reader_.~ArenaReader();
+	json_arena->allocator_.Clear();
+	new (&json_arena->reader_) ArenaReader(&json_arena->allocator_);
+	json_arena->reader_.Parse<kParseStopWhenDoneFlag>(is, handler);
+	return !json_arena->reader_.HasParseError();
+}
+
+/* Same as json_validate(), but the record is also encoded to <enc> unless it
+ * is NULL. Nothing is left in <enc> if it is invalid or does not fit.
+ */
+template <typename InputStream, typename Handler>
+static bool json_validate_encode(InputStream& is, Handler& handler, struct json_enc *enc){
+	if(!enc)
+		return json_validate(is, handler);
+
+	EncodeHandler<Handler> encoder(handler, enc);
+
+	if(!json_enc_begin(enc))
+		return false;
+	if(!json_validate(is, encoder)){
+		json_enc_cancel(enc);
+		return false;
+	}
+	json_enc_end(enc);
+	return true;
+}
+
 /* parser interface that supports wrapping buffers from haproxy.
  *
  * EOF is implicit when parse_start == parse_end
  * parsed_til is set to the next unparsed byte in the stream
+ * the record must also match <schema> unless it is NULL
+ * the record is encoded to <enc> unless it is NULL
  * */
-json_passed_t json_parse_wrap(char* origin, char* parse_start, char* parse_end, char* buffer_end, char** parsed_til){
-	ParseFlag pf = kParseNoFlags; // = kParseStopWhenDoneFlag;
-	Document d;
+json_passed_t json_parse_wrap(char* origin, char* parse_start, char* parse_end, char* buffer_end, char** parsed_til,
+                              const struct json_schema *schema, struct json_enc *enc){
 	WrappedMemoryStream ms(origin, parse_start, parse_end, buffer_end);
 	EncodedInputStream<UTF8<char>, WrappedMemoryStream> is(ms);
+	bool valid;
+
+	if(schema){
+		SchemaHandler handler(schema);
+		valid = json_validate_encode(is, handler, enc);
+	} else {
+		BaseReaderHandler<UTF8<> > handler;
+		valid = json_validate_encode(is, handler, enc);
+	}
 
 #ifdef DEBUG
 	printf("json_parse_wrap: origin: %p (%d)  parse_start: %p (%d) parse_end: %p (%d) buffer_end: %p (%d) parsed_til: %p\n",
@@ -165,14 +334,12 @@ json_passed_t json_parse_wrap(char* origin, char* parse_start, char* parse_end,
 			buffer_end, *buffer_end,
 			parsed_til);
 #endif
-	d.ParseStream<kParseStopWhenDoneFlag>(is);
-
-    if (d.HasParseError()) {
+    if (!valid) {
 #ifdef DEBUG
         fprintf(stderr, "\nError(offset %u): %s\n",
-                (unsigned)d.GetErrorOffset(),
-                GetParseError_En(d.GetParseError()));
-		int offset = d.GetErrorOffset();
+                (unsigned)json_arena->reader_.GetErrorOffset(),
+                GetParseError_En(json_arena->reader_.GetParseErrorCode()));
+		int offset = json_arena->reader_.GetErrorOffset();
 		int offset_len;
 
 		WrappedMemoryStream error_ms(origin, parse_start, parse_end, buffer_end);
@@ -209,18 +376,15 @@ json_passed_t json_parse_wrap(char* origin, char* parse_start, char* parse_end,
 }
 
 json_passed_t json_parse(char** start, size_t maxlength, int* eof){
-	ParseFlag pf = kParseNoFlags; // = kParseStopWhenDoneFlag;
-	Document d;
 	MemoryStream ms(reinterpret_cast<const char*>(*start), maxlength);
 	EncodedInputStream<UTF8<char>, MemoryStream> is(ms);
+	BaseReaderHandler<UTF8<> > handler;
 
-	d.ParseStream<kParseStopWhenDoneFlag>(is);
-
-    if (d.HasParseError()) {
+    if (!json_validate(is, handler)) {
 #ifdef DEBUG
         fprintf(stderr, "\nError(offset %u): %s\n",
-                (unsigned)d.GetErrorOffset(),
-                GetParseError_En(d.GetParseError()));
+                (unsigned)json_arena->reader_.GetErrorOffset(),
+                GetParseError_En(json_arena->reader_.GetParseErrorCode()));
 #endif
 		return JSON_FAIL;
 	}
@@ -268,7 +432,7 @@ void test_wrapped_string(int argc, char* argv[]){
 	printf("parse_end: %p\n", parse_end);
 	while(r && parse_start != parse_end){
 		printf("start: %p start[0]: %c\n", parse_start, parse_start[0]);
-		r = json_parse_wrap(origin, parse_start, parse_end, buffer_end, &parse_start);
+		r = json_parse_wrap(origin, parse_start, parse_end, buffer_end, &parse_start, NULL);
 		/* third iteration should fail */
 		if(r == JSON_FAIL){
 			printf("parse failed\n");
@@ -288,7 +452,7 @@ void test_wrapped_string(int argc, char* argv[]){
 	r = 1;
 	do {
 		printf("start: %p start[0]: %c\n", parse_start, parse_start[0]);
-		r = json_parse_wrap(origin, parse_start, parse_end, buffer_end, &parse_start);
+		r = json_parse_wrap(origin, parse_start, parse_end, buffer_end, &parse_start, NULL);
 		if(r == JSON_FAIL){
 			printf("parse failed\n");
 			break;
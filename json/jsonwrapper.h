@@ -1,10 +1,29 @@
+#ifndef _JSONWRAPPER_H
+#define _JSONWRAPPER_H
+
 /* Borrowed from Sparser */
 typedef enum {
     JSON_FAIL = 0,
     JSON_PASS = 1,
 } json_passed_t;
 
+#include <stddef.h>
+
+/* compiled JSON schema, see json_schema_compile() */
+struct json_schema;
+
+/* record encoder, see json_enc_init() */
+struct json_enc;
+
 #ifdef __cplusplus
-extern "C" 
+extern "C" {
 #endif
-json_passed_t json_parse_wrap(char* origin, char* parse_start, char* parse_end, char* buffer_end, char** parsed_til);
+json_passed_t json_parse_wrap(char* origin, char* parse_start, char* parse_end, char* buffer_end, char** parsed_til,
+                              const struct json_schema *schema, struct json_enc *enc);
+int json_parse_thread_init(size_t size);
+void json_parse_thread_deinit(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JSONWRAPPER_H */
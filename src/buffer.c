@@ -20,20 +20,27 @@
 
 #include <types/global.h>
 
+#include <proto/log.h>
+
 struct pool_head *pool_head_buffer;
+struct pool_head *pool_head_buffer_class[BUF_CLASSES];
+int nb_buffer_classes = 0;
 
 /* list of objects waiting for at least one buffer */
 struct list buffer_wq = LIST_HEAD_INIT(buffer_wq);
 __decl_hathreads(HA_SPINLOCK_T __attribute__((aligned(64))) buffer_wq_lock);
 
-/* perform minimal intializations, report 0 in case of error, 1 if OK. */
-int init_buffer()
+/* Creates the pool for buffers of <size> bytes and appends it to the enabled
+ * size classes. Returns the pool or NULL in case of error.
+ */
+static struct pool_head *init_buffer_class(char *name, unsigned int size)
 {
+	struct pool_head *pool;
 	void *buffer;
 
-	pool_head_buffer = create_pool("buffer", global.tune.bufsize, MEM_F_SHARED|MEM_F_EXACT);
-	if (!pool_head_buffer)
-		return 0;
+	pool = create_pool(name, size, MEM_F_SHARED|MEM_F_EXACT);
+	if (!pool)
+		return NULL;
 
 	/* The reserved buffer is what we leave behind us. Thus we always need
 	 * at least one extra buffer in minavail otherwise we'll end up waking
@@ -42,23 +49,96 @@ int init_buffer()
 	 * (2 for current session, one for next session that might be needed to
 	 * release a server connection).
 	 */
-	pool_head_buffer->minavail = MAX(global.tune.reserved_bufs, 3);
+	pool->minavail = MAX(global.tune.reserved_bufs, 3);
 	if (global.tune.buf_limit)
-		pool_head_buffer->limit = global.tune.buf_limit;
+		pool->limit = global.tune.buf_limit;
+
+	buffer = pool_refill_alloc(pool, pool->minavail - 1);
+	if (!buffer)
+		return NULL;
+
+	pool_free(pool, buffer);
+	pool_head_buffer_class[nb_buffer_classes++] = pool;
+	return pool;
+}
+
+/* Checks that the optional size class <name> of <size> bytes fits between the
+ * rewrite reserve and the next larger class of <next> bytes. Returns the size
+ * to use, or zero if the class is disabled.
+ */
+static int check_buffer_class(const char *name, int size, int next)
+{
+	if (!size)
+		return 0;
+
+	if (size <= global.tune.maxrewrite || size >= next) {
+		ha_warning("%s (%d) must be larger than tune.maxrewrite (%d) and smaller than %d, ignoring it.\n",
+			   name, size, global.tune.maxrewrite, next);
+		return 0;
+	}
+	return size;
+}
+
+/* perform minimal intializations, report 0 in case of error, 1 if OK. */
+int init_buffer()
+{
+	int medium, small;
 
 	HA_SPIN_INIT(&buffer_wq_lock);
 
-	buffer = pool_refill_alloc(pool_head_buffer, pool_head_buffer->minavail - 1);
-	if (!buffer)
+	medium = check_buffer_class("tune.bufsize.medium", global.tune.bufsize_medium, global.tune.bufsize);
+	small  = check_buffer_class("tune.bufsize.small", global.tune.bufsize_small, medium ? medium : global.tune.bufsize);
+
+	if (small && !init_buffer_class("buf_small", small))
+		return 0;
+
+	if (medium && !init_buffer_class("buf_medium", medium))
+		return 0;
+
+	pool_head_buffer = init_buffer_class("buffer", global.tune.bufsize);
+	if (!pool_head_buffer)
 		return 0;
 
-	pool_free(pool_head_buffer, buffer);
 	return 1;
 }
 
 void deinit_buffer()
 {
-	pool_destroy(pool_head_buffer);
+	while (nb_buffer_classes)
+		pool_destroy(pool_head_buffer_class[--nb_buffer_classes]);
+}
+
+/* Tries to replace allocated buffer <buf> with one of the smallest size class
+ * which is larger than it and holds at least <size> bytes, keeping <margin>
+ * buffers available in the new class' pool as b_alloc_margin() does. An empty
+ * buffer is simply replaced, otherwise its contents are copied and realigned
+ * at the beginning of the new area, which preserves all relative offsets.
+ * Returns non-zero on success, or zero if no such class exists or if no buffer
+ * is available, in which case <buf> is left untouched.
+ */
+int b_grow(struct buffer *buf, size_t size, int margin)
+{
+	struct buffer new = BUF_NULL;
+	struct pool_head *pool = NULL;
+	int cls;
+
+	for (cls = 0; cls < nb_buffer_classes; cls++) {
+		if (pool_head_buffer_class[cls]->size > buf->size &&
+		    pool_head_buffer_class[cls]->size >= size) {
+			pool = pool_head_buffer_class[cls];
+			break;
+		}
+	}
+
+	if (!pool || !b_alloc_pool_margin(&new, pool, margin))
+		return 0;
+
+	if (b_data(buf))
+		new.data = b_getblk(buf, b_orig(&new), b_data(buf), 0);
+
+	__b_drop(buf);
+	*buf = new;
+	return 1;
 }
 
 /*
@@ -106,7 +186,7 @@ void buffer_dump(FILE *o, struct buffer *b, int from, int to)
 void __offer_buffer(void *from, unsigned int threshold)
 {
 	struct buffer_wait *wait, *bak;
-	int avail;
+	int avail, cls;
 
 	/* For now, we consider that all objects need 1 buffer, so we can stop
 	 * waking up them once we have enough of them to eat all the available
@@ -115,9 +195,12 @@ void __offer_buffer(void *from, unsigned int threshold)
 	 * event we'll need 1 buffer. If no buffer is currently used, always
 	 * wake up the number of tasks we can offer a buffer based on what is
 	 * allocated, and in any case at least one task per two reserved
-	 * buffers.
+	 * buffers. All size classes are counted since waiters may start with
+	 * any of them.
 	 */
-	avail = pool_head_buffer->allocated - pool_head_buffer->used - global.tune.reserved_bufs / 2;
+	avail = -global.tune.reserved_bufs / 2;
+	for (cls = 0; cls < nb_buffer_classes; cls++)
+		avail += pool_head_buffer_class[cls]->allocated - pool_head_buffer_class[cls]->used;
 
 	list_for_each_entry_safe(wait, bak, &buffer_wq, list) {
 		if (avail <= threshold)
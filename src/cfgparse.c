@@ -774,6 +774,11 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		global.tune.options &= ~GTUNE_USE_EPOLL;
 	}
+	else if (!strcmp(args[0], "nouring")) {
+		if (alertif_too_many_args(0, file, linenum, args, &err_code))
+			goto out;
+		global.tune.options &= ~GTUNE_USE_URING;
+	}
 	else if (!strcmp(args[0], "nokqueue")) {
 		if (alertif_too_many_args(0, file, linenum, args, &err_code))
 			goto out;
@@ -915,6 +920,27 @@ int cfg_parse_global(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		}
 	}
+	else if (!strcmp(args[0], "tune.bufsize.small") || !strcmp(args[0], "tune.bufsize.medium")) {
+		int size;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code))
+			goto out;
+		if (*(args[1]) == 0) {
+			ha_alert("parsing [%s:%d] : '%s' expects an integer argument.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		size = atol(args[1]);
+		if (size < 0) {
+			ha_alert("parsing [%s:%d] : '%s' expects a positive integer argument or zero.\n", file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		if (!strcmp(args[0], "tune.bufsize.small"))
+			global.tune.bufsize_small = size;
+		else
+			global.tune.bufsize_medium = size;
+	}
 	else if (!strcmp(args[0], "tune.maxrewrite")) {
 		if (alertif_too_many_args(1, file, linenum, args, &err_code))
 			goto out;
@@ -69,8 +69,10 @@ unsigned long long __channel_forward(struct channel *chn, unsigned long long byt
 }
 
 /* writes <len> bytes from message <msg> to the channel's buffer. Returns -1 in
- * case of success, -2 if the message is larger than the buffer size, or the
- * number of bytes available otherwise. The send limit is automatically
+ * case of success, -2 if the message is larger than the largest buffer size,
+ * or the number of bytes available otherwise, including when a smaller buffer
+ * could not be promoted yet, in which case the stream is queued to be woken up
+ * once a buffer is released. The send limit is automatically
  * adjusted to the amount of data written. FIXME-20060521: handle unaligned
  * data. Note: this function appends data to the buffer's output and possibly
  * overwrites any pending input data which are assumed not to exist.
@@ -82,7 +84,20 @@ int co_inject(struct channel *chn, const char *msg, int len)
 	if (len == 0)
 		return -1;
 
+	/* a buffer of a small size class may have to be promoted first. On
+	 * failure the stream waits for a buffer to be released.
+	 */
+	if (len > 0 && len > b_room(&chn->buf))
+		channel_grow_buffer(chn, MIN(b_data(&chn->buf) + len, pool_head_buffer->size),
+		                    &chn_strm(chn)->buffer_wait);
+
 	if (len < 0 || len > c_size(chn)) {
+		/* a buffer which could not be promoted yet may still receive
+		 * it later, so only report the space currently available.
+		 */
+		if (len > 0 && len <= pool_head_buffer->size && b_may_grow(&chn->buf))
+			return b_room(&chn->buf);
+
 		/* we can't write this chunk and will never be able to, because
 		 * it is larger than the buffer. This must be reported as an
 		 * error. Then we return -2 so that writers that don't care can
@@ -106,15 +121,18 @@ int co_inject(struct channel *chn, const char *msg, int len)
 /* Tries to copy character <c> into the channel's buffer after some length
  * controls. The chn->o and to_forward pointers are updated. If the channel
  * input is closed, -2 is returned. If there is not enough room left in the
- * buffer, -1 is returned. Otherwise the number of bytes copied is returned
- * (1). Channel flag READ_PARTIAL is updated if some data can be transferred.
+ * buffer, -1 is returned, and if the buffer could not be promoted to a larger
+ * size class, the stream is queued to be woken up once a buffer is released.
+ * Otherwise the number of bytes copied is returned (1). Channel flag
+ * READ_PARTIAL is updated if some data can be transferred.
  */
 int ci_putchr(struct channel *chn, char c)
 {
 	if (unlikely(channel_input_closed(chn)))
 		return -2;
 
-	if (!channel_may_recv(chn))
+	if (!channel_may_recv(chn) &&
+	    !channel_grow_buffer(chn, c_size(chn) + 1, &chn_strm(chn)->buffer_wait))
 		return -1;
 
 	*ci_tail(chn) = c;
@@ -136,9 +154,10 @@ int ci_putchr(struct channel *chn, char c)
  * controls. The chn->o and to_forward pointers are updated. If the channel
  * input is closed, -2 is returned. If the block is too large for this buffer,
  * -3 is returned. If there is not enough room left in the buffer, -1 is
- * returned. Otherwise the number of bytes copied is returned (0 being a valid
- * number). Channel flag READ_PARTIAL is updated if some data can be
- * transferred.
+ * returned, and if the buffer could not be promoted to a larger size class,
+ * the stream is queued to be woken up once a buffer is released. Otherwise the
+ * number of bytes copied is returned (0 being a valid number). Channel flag
+ * READ_PARTIAL is updated if some data can be transferred.
  */
 int ci_putblk(struct channel *chn, const char *blk, int len)
 {
@@ -151,12 +170,18 @@ int ci_putblk(struct channel *chn, const char *blk, int len)
 		return -3;
 
 	max = channel_recv_limit(chn);
+	if (unlikely(len > max - c_data(chn)) &&
+	    channel_grow_buffer(chn, MIN(c_size(chn) - max + c_data(chn) + len, pool_head_buffer->size),
+	                        &chn_strm(chn)->buffer_wait))
+		max = channel_recv_limit(chn);
+
 	if (unlikely(len > max - c_data(chn))) {
 		/* we can't write this chunk right now because the buffer is
 		 * almost full or because the block is too large. Return the
-		 * available space or -2 if impossible.
+		 * available space or -2 if impossible. A buffer which could
+		 * not be promoted yet may still receive it later.
 		 */
-		if (len > max)
+		if (len > max && !b_may_grow(&chn->buf))
 			return -3;
 
 		return -1;
@@ -45,6 +45,7 @@
 #include <types/dns.h>
 #include <types/stats.h>
 
+#include <proto/applet.h>
 #include <proto/backend.h>
 #include <proto/channel.h>
 #include <proto/checks.h>
@@ -868,7 +869,7 @@ static int cli_io_handler_show_fd(struct appctx *appctx)
 			li = fdt.owner;
 
 		chunk_printf(&trash,
-			     "  %5d : st=0x%02x(R:%c%c%c W:%c%c%c) ev=0x%02x(%c%c%c%c%c) [%c%c] cnext=%d cprev=%d tmask=0x%lx umask=0x%lx owner=%p iocb=%p(%s)",
+			     "  %5d : st=0x%02x(R:%c%c%c W:%c%c%c) ev=0x%02x(%c%c%c%c%c) [%c%c] cache=%d tmask=0x%lx umask=0x%lx owner=%p iocb=%p(%s)",
 			     fd,
 			     fdt.state,
 			     (fdt.state & FD_EV_POLLED_R) ? 'P' : 'p',
@@ -885,8 +886,7 @@ static int cli_io_handler_show_fd(struct appctx *appctx)
 			     (fdt.ev & FD_POLL_IN)  ? 'I' : 'i',
 			     fdt.linger_risk ? 'L' : 'l',
 			     fdt.cloned ? 'C' : 'c',
-			     fdt.cache.next,
-			     fdt.cache.prev,
+			     fd_in_cache(fd),
 			     fdt.thread_mask, fdt.update_mask,
 			     fdt.owner,
 			     fdt.iocb,
@@ -972,6 +972,9 @@ static int cli_io_handler_show_activity(struct appctx *appctx)
 	chunk_appendf(&trash, "\nstream:");       for (thr = 0; thr < global.nbthread; thr++) chunk_appendf(&trash, " %u", activity[thr].stream);
 	chunk_appendf(&trash, "\nempty_rq:");     for (thr = 0; thr < global.nbthread; thr++) chunk_appendf(&trash, " %u", activity[thr].empty_rq);
 	chunk_appendf(&trash, "\nlong_rq:");      for (thr = 0; thr < global.nbthread; thr++) chunk_appendf(&trash, " %u", activity[thr].long_rq);
+	chunk_appendf(&trash, "\ninbox:");        for (thr = 0; thr < global.nbthread; thr++) chunk_appendf(&trash, " %u", activity[thr].inbox);
+	chunk_appendf(&trash, "\nsteal_req:");    for (thr = 0; thr < global.nbthread; thr++) chunk_appendf(&trash, " %u", activity[thr].steal_req);
+	chunk_appendf(&trash, "\nstolen:");       for (thr = 0; thr < global.nbthread; thr++) chunk_appendf(&trash, " %u", activity[thr].stolen);
 
 	chunk_appendf(&trash, "\n");
 
@@ -985,6 +988,109 @@ static int cli_io_handler_show_activity(struct appctx *appctx)
 	return 1;
 }
 
+/* returns the name of task handler <func> if it is a well-known one, or NULL */
+static const char *task_handler_name(const void *func)
+{
+	return  (func == process_stream)  ? "process_stream" :
+		(func == task_run_applet) ? "task_run_applet" :
+		(func == si_cs_io_cb)     ? "si_cs_io_cb" :
+		(func == manage_proxy)    ? "manage_proxy" :
+		NULL;
+}
+
+/* This function dumps the per-handler task profiling counters of all threads
+ * merged together, the most CPU-intensive handlers first. Handlers are named
+ * when they are well known, otherwise their address may be looked up in the
+ * executable's symbol table. It returns 0 if the output buffer is full and it
+ * needs to be called again, otherwise non-zero. It dumps everything at once in
+ * the buffer and is not designed to do it in multiple passes.
+ */
+static int cli_io_handler_show_profiling(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	struct task_prof *tot, *p, tmp;
+	const char *name;
+	int thr, i, j, b, n = 0;
+
+	if (unlikely(si_ic(si)->flags & (CF_WRITE_ERROR|CF_SHUTW)))
+		return 1;
+
+	tot = calloc(TASK_PROF_HANDLERS, sizeof(*tot));
+	if (!tot) {
+		appctx->ctx.cli.severity = LOG_ERR;
+		appctx->ctx.cli.msg = "Out of memory.\n";
+		appctx->st0 = CLI_ST_PRINT;
+		return 1;
+	}
+
+	/* merge the threads' tables, the handlers may be in any slot */
+	for (thr = 0; thr < global.nbthread; thr++) {
+		for (i = 0; i < TASK_PROF_HANDLERS; i++) {
+			p = &task_prof[thr][i];
+			if (!p->func)
+				continue;
+			for (j = 0; j < n && tot[j].func != p->func; j++)
+				;
+			if (j == n)
+				tot[n++].func = p->func;
+			tot[j].calls     += p->calls;
+			tot[j].cycles    += p->cycles;
+			tot[j].lat_calls += p->lat_calls;
+			tot[j].lat_ns    += p->lat_ns;
+			for (b = 0; b < TASK_PROF_BUCKETS; b++)
+				tot[j].lat_hist[b] += p->lat_hist[b];
+		}
+	}
+
+	/* most expensive first */
+	for (i = 1; i < n; i++) {
+		tmp = tot[i];
+		for (j = i; j > 0 && tot[j - 1].cycles < tmp.cycles; j--)
+			tot[j] = tot[j - 1];
+		tot[j] = tmp;
+	}
+
+	chunk_reset(&trash);
+	chunk_appendf(&trash, "Per-task CPU usage and wakeup to run latency (profiling.tasks: %s):\n",
+	              (profiling & HA_PROF_TASKS) ? "on" : "off");
+	chunk_appendf(&trash, "  %-26s %12s %16s %10s %10s\n", "function", "calls", "cycles", "cyc/call", "lat_avg_us");
+
+	for (i = 0; i < n; i++) {
+		p = &tot[i];
+		name = task_handler_name(p->func);
+		if (name)
+			chunk_appendf(&trash, "  %-26s", name);
+		else
+			chunk_appendf(&trash, "  %-26p", p->func);
+		chunk_appendf(&trash, " %12llu %16llu %10llu %10llu\n",
+		              p->calls, p->cycles, p->calls ? p->cycles / p->calls : 0,
+		              p->lat_calls ? p->lat_ns / p->lat_calls / 1000 : 0);
+
+		if (!p->lat_calls)
+			continue;
+		chunk_appendf(&trash, "    lat:");
+		for (b = 0; b < TASK_PROF_BUCKETS; b++) {
+			if (!p->lat_hist[b])
+				continue;
+			if (b == TASK_PROF_BUCKETS - 1)
+				chunk_appendf(&trash, " >=%uus:%u", 1U << (b - 1), p->lat_hist[b]);
+			else
+				chunk_appendf(&trash, " <%uus:%u", 1U << b, p->lat_hist[b]);
+		}
+		chunk_appendf(&trash, "\n");
+	}
+	free(tot);
+
+	if (ci_putchk(si_ic(si), &trash) == -1) {
+		chunk_reset(&trash);
+		chunk_printf(&trash, "[output too large, cannot dump]\n");
+		si_applet_cant_put(si);
+	}
+
+	/* dump complete */
+	return 1;
+}
+
 /*
  * CLI IO handler for `show cli sockets`.
  * Uses ctx.cli.p0 to store the restart pointer.
@@ -1170,6 +1276,31 @@ static int cli_parse_set_timeout(char **args, char *payload, struct appctx *appc
 	}
 }
 
+/* parse a "set profiling" command. It always returns 1. */
+static int cli_parse_set_profiling(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
+		return 1;
+
+	if (strcmp(args[2], "tasks") != 0) {
+		appctx->ctx.cli.severity = LOG_ERR;
+		appctx->ctx.cli.msg = "Expects 'tasks'.\n";
+		appctx->st0 = CLI_ST_PRINT;
+		return 1;
+	}
+
+	if (strcmp(args[3], "on") == 0)
+		HA_ATOMIC_OR(&profiling, HA_PROF_TASKS);
+	else if (strcmp(args[3], "off") == 0)
+		HA_ATOMIC_AND(&profiling, ~HA_PROF_TASKS);
+	else {
+		appctx->ctx.cli.severity = LOG_ERR;
+		appctx->ctx.cli.msg = "Expects either 'on' or 'off'.\n";
+		appctx->st0 = CLI_ST_PRINT;
+	}
+	return 1;
+}
+
 /* parse a "set maxconn global" command. It always returns 1. */
 static int cli_parse_set_maxconn_global(char **args, char *payload, struct appctx *appctx, void *private)
 {
@@ -1575,6 +1706,7 @@ static struct cli_kw_list cli_kws = {{ },{
 	{ { "prompt", NULL }, NULL, cli_parse_simple, NULL },
 	{ { "quit", NULL }, NULL, cli_parse_simple, NULL },
 	{ { "set", "maxconn", "global",  NULL }, "set maxconn global : change the per-process maxconn setting", cli_parse_set_maxconn_global, NULL },
+	{ { "set", "profiling", NULL }, "set profiling tasks {on|off} : enable or disable per-handler task profiling", cli_parse_set_profiling, NULL },
 	{ { "set", "rate-limit", NULL }, "set rate-limit : change a rate limiting value", cli_parse_set_ratelimit, NULL },
 	{ { "set", "severity-output",  NULL }, "set severity-output [none|number|string] : set presence of severity level in feedback information", cli_parse_set_severity_output, NULL, NULL },
 	{ { "set", "timeout",  NULL }, "set timeout    : change a timeout setting", cli_parse_set_timeout, NULL, NULL },
@@ -1582,6 +1714,7 @@ static struct cli_kw_list cli_kws = {{ },{
 	{ { "show", "cli", "sockets",  NULL }, "show cli sockets : dump list of cli sockets", cli_parse_default, cli_io_handler_show_cli_sock, NULL },
 	{ { "show", "fd", NULL }, "show fd [num] : dump list of file descriptors in use", cli_parse_show_fd, cli_io_handler_show_fd, NULL },
 	{ { "show", "activity", NULL }, "show activity : show per-thread activity stats (for support/developers)", cli_parse_default, cli_io_handler_show_activity, NULL },
+	{ { "show", "profiling", "tasks", NULL }, "show profiling tasks : show per-handler task CPU usage and latency", cli_parse_default, cli_io_handler_show_profiling, NULL },
 	{ { "_getsocks", NULL }, NULL,  _getsocks, NULL },
 	{{},}
 }};
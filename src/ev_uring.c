@@ -0,0 +1,750 @@
+/*
+ * FD polling functions for Linux io_uring
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ * Each thread owns a ring on which every FD it polls has one multishot
+ * IORING_OP_POLL_ADD request. Polling changes are queued as submissions in
+ * the ring and are all passed to the kernel by the single io_uring_enter()
+ * call which also waits for the completions, so that a loop costs one
+ * syscall instead of one epoll_ctl() per change plus one epoll_wait().
+ *
+ * A multishot poll request reports each wakeup of the file after it is
+ * armed, and checks the file's state when it is armed. Since an FD is only
+ * waited for once it was found not to be ready, this is enough to never miss
+ * an event even though the request does not report a file which stays ready.
+ *
+ * Each request carries the FD and a per-thread generation number in its
+ * user_data, so that the completions of a request which was replaced or
+ * cancelled in the mean time are recognized and ignored. Since a pending
+ * request holds a reference to the file, it must be cancelled before the FD
+ * is closed for the connection to be effectively released. The thread closing
+ * an FD cannot see the requests still queued in the other threads' rings, so
+ * each thread checks the requests it just submitted and cancels those whose
+ * FD was closed in the mean time.
+ */
+
+#define _GNU_SOURCE  // for POLLRDHUP on Linux
+
+#include <errno.h>
+#include <endian.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <linux/io_uring.h>
+
+#include <common/compat.h>
+#include <common/config.h>
+#include <common/hathreads.h>
+#include <common/standard.h>
+#include <common/ticks.h>
+#include <common/time.h>
+
+#include <types/global.h>
+
+#include <proto/fd.h>
+
+
+#ifndef POLLRDHUP
+/* POLLRDHUP was defined late in libc, and it appeared in kernel 2.6.17 */
+#define POLLRDHUP 0
+#endif
+
+/* features the poller cannot work without */
+#define URING_REQUIRED_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG)
+
+/* user_data of the requests whose completion is ignored */
+#define URING_DATA_NONE (~0ULL)
+
+/* the submission and completion queues of one thread */
+struct uring {
+	int fd;                          /* ring fd, or -1 */
+	unsigned int sq_tail;            /* local copy of the SQ tail */
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int *sq_khead;          /* SQ head, updated by the kernel */
+	unsigned int *sq_ktail;          /* SQ tail, updated by us */
+	unsigned int cq_mask;
+	unsigned int *cq_khead;          /* CQ head, updated by us */
+	unsigned int *cq_ktail;          /* CQ tail, updated by the kernel */
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *ring_map;                  /* SQ and CQ rings, mapped at once */
+	size_t ring_len;
+	size_t sqes_len;
+};
+
+/* per-thread state of each FD */
+struct uring_fd {
+	unsigned int gen;                /* generation of the last request armed */
+	unsigned int events;             /* events of the request if polled */
+};
+
+/* private data */
+static struct uring uring[MAX_THREADS];  // per-thread ring, reachable from other threads
+static THREAD_LOCAL struct uring_fd *uring_fds = NULL;
+static unsigned int uring_features;      // features reported by the kernel
+
+static inline int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                                     unsigned int flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Releases ring <r> if it exists */
+static void uring_term(struct uring *r)
+{
+	if (r->fd < 0)
+		return;
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_len);
+	if (r->ring_map)
+		munmap(r->ring_map, r->ring_len);
+	close(r->fd);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+/* Creates ring <r> with at least <entries> submissions. Returns 1 if OK,
+ * otherwise 0 with <r> left unset.
+ */
+static int uring_init(struct uring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	unsigned int *array;
+	char *map;
+	unsigned int i;
+
+	memset(r, 0, sizeof(*r));
+
+	/* COOP_TASKRUN saves an IPI per completion but only appeared in 5.19 */
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = entries * 4;
+	r->fd = sys_io_uring_setup(entries, &p);
+	if (r->fd < 0 && errno == EINVAL) {
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = entries * 4;
+		r->fd = sys_io_uring_setup(entries, &p);
+	}
+	if (r->fd < 0)
+		goto fail;
+
+	uring_features = p.features;
+	if ((p.features & URING_REQUIRED_FEATURES) != URING_REQUIRED_FEATURES)
+		goto fail;
+
+	r->ring_len = MAX(p.sq_off.array + p.sq_entries * sizeof(unsigned int),
+	                  p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+	map = mmap(NULL, r->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	           r->fd, IORING_OFF_SQ_RING);
+	if (map == MAP_FAILED)
+		goto fail;
+	r->ring_map = map;
+
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	               r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	r->sq_khead   = (unsigned int *)(map + p.sq_off.head);
+	r->sq_ktail   = (unsigned int *)(map + p.sq_off.tail);
+	r->sq_mask    = *(unsigned int *)(map + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->cq_khead   = (unsigned int *)(map + p.cq_off.head);
+	r->cq_ktail   = (unsigned int *)(map + p.cq_off.tail);
+	r->cq_mask    = *(unsigned int *)(map + p.cq_off.ring_mask);
+	r->cqes       = (struct io_uring_cqe *)(map + p.cq_off.cqes);
+
+	/* submissions are always used in order */
+	array = (unsigned int *)(map + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++)
+		array[i] = i;
+	r->sq_tail = *r->sq_ktail;
+	return 1;
+
+ fail:
+	if (r->fd >= 0)
+		uring_term(r);
+	r->fd = -1;
+	return 0;
+}
+
+/* Synchronously cancels the request identified by <data> in ring <r>. Returns
+ * the number of requests cancelled, or <0 if there were none.
+ */
+static int uring_cancel_data(struct uring *r, __u64 data)
+{
+	struct io_uring_sync_cancel_reg reg;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = data;
+	reg.timeout.tv_sec  = -1;
+	reg.timeout.tv_nsec = -1;
+	return sys_io_uring_register(r->fd, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+}
+
+/* Cancels the poll requests of the current thread's ring <r> which were just
+ * submitted, from <head> to the SQ head, and which do not match the FD's state
+ * anymore. This happens when another thread closed the FD while the request
+ * was still queued, in which case the request was armed on a closed or reused
+ * FD. Once submitted, a request is either seen here or by the synchronous
+ * cancellation performed by __fd_clo() after clearing the polled_mask.
+ */
+static void uring_drop_closed(struct uring *r, unsigned int head)
+{
+	unsigned int end = __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+	unsigned int fd;
+
+	for (; head != end; head++) {
+		sqe = &r->sqes[head & r->sq_mask];
+		if (sqe->opcode != IORING_OP_POLL_ADD)
+			continue;
+		fd = (unsigned int)sqe->user_data;
+		if ((polled_mask[fd] & tid_bit) && uring_fds[fd].gen == (unsigned int)(sqe->user_data >> 32))
+			continue;
+		uring_cancel_data(r, sqe->user_data);
+	}
+}
+
+/* Calls io_uring_enter() on ring <r> with the same arguments, then drops the
+ * requests of the current thread which were submitted for a closed FD. The
+ * result and errno of io_uring_enter() are returned.
+ */
+static int uring_enter(struct uring *r, unsigned int to_submit, unsigned int min_complete,
+                       unsigned int flags, void *arg, size_t argsz)
+{
+	unsigned int head = __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+	int ret, err;
+
+	ret = sys_io_uring_enter(r->fd, to_submit, min_complete, flags, arg, argsz);
+	if (r == &uring[tid] && uring_fds && head != __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE)) {
+		err = errno;
+		uring_drop_closed(r, head);
+		errno = err;
+	}
+	return ret;
+}
+
+/* Passes the pending submissions of ring <r> to the kernel and waits for at
+ * most <wait_time> milliseconds for a completion if there is none yet. A zero
+ * <wait_time> does not wait. Returns the number of completions available.
+ */
+static unsigned int uring_submit_wait(struct uring *r, int wait_time)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	unsigned int to_submit;
+
+	to_submit = r->sq_tail - __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+
+	memset(&arg, 0, sizeof(arg));
+	ts.tv_sec  = wait_time / 1000;
+	ts.tv_nsec = (wait_time % 1000) * 1000000;
+	arg.ts = (unsigned long)&ts;
+
+	/* errors are ETIME on timeout and EINTR on signals, none of which
+	 * matters here. Submissions not consumed are passed again next time.
+	 */
+	uring_enter(r, to_submit, wait_time ? 1 : 0,
+	            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+	return __atomic_load_n(r->cq_ktail, __ATOMIC_ACQUIRE) - *r->cq_khead;
+}
+
+/* Makes room for <n> more submissions in ring <r>, passing the pending ones to
+ * the kernel if needed. Returns 0 if the kernel does not consume them now,
+ * for example with EBUSY when the completion queue overflows, in which case
+ * the completions have to be reaped before trying again. Otherwise returns 1.
+ */
+static int uring_reserve(struct uring *r, unsigned int n)
+{
+	unsigned int queued;
+	int ret;
+
+	while ((queued = r->sq_tail - __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE)) + n > r->sq_entries) {
+		ret = uring_enter(r, queued, 0, 0, NULL, 0);
+		if (ret == 0 || (ret < 0 && errno != EINTR))
+			return 0;
+	}
+	return 1;
+}
+
+/* Returns a blank submission queued in ring <r>, in which room must have been
+ * made with uring_reserve(). The kernel only reads it on the next
+ * io_uring_enter() from the same thread, so it may be filled after being
+ * queued.
+ */
+static struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = &r->sqes[r->sq_tail & r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_tail++;
+	__atomic_store_n(r->sq_ktail, r->sq_tail, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+/* Queues in ring <r> a multishot poll request for <events> on <fd> with
+ * generation <gen>. Room must have been made with uring_reserve().
+ */
+static void uring_poll_add(struct uring *r, int fd, unsigned int gen, unsigned int events)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = events;
+	sqe->user_data = ((__u64)gen << 32) | (unsigned int)fd;
+}
+
+/* Queues in ring <r> the removal of the poll request of generation <gen> on
+ * <fd>. Room must have been made with uring_reserve().
+ */
+static void uring_poll_del(struct uring *r, int fd, unsigned int gen)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = ((__u64)gen << 32) | (unsigned int)fd;
+	sqe->user_data = URING_DATA_NONE;
+	if (uring_features & IORING_FEAT_CQE_SKIP)
+		sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+}
+
+/* Synchronously cancels the requests on <fd> in ring <r>, which may belong
+ * to another thread. Returns the number of requests cancelled, or <0 if there
+ * were none.
+ */
+static int uring_cancel_fd(struct uring *r, int fd)
+{
+	struct io_uring_sync_cancel_reg reg;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.fd = fd;
+	reg.flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+	reg.timeout.tv_sec  = -1;
+	reg.timeout.tv_nsec = -1;
+	return sys_io_uring_register(r->fd, IORING_REGISTER_SYNC_CANCEL, &reg, 1);
+}
+
+/*
+ * Cancel the poll requests on the file descriptor before it is closed, as
+ * they hold a reference to the file. Ours is cancelled with the next
+ * submissions, the other threads' ones immediately. The polled_mask is
+ * cleared first so that the other threads drop the requests they still
+ * have queued for this FD once they submit them (see uring_drop_closed()).
+ */
+REGPRM1 static void __fd_clo(int fd)
+{
+	unsigned long m;
+	int i;
+
+	m = HA_ATOMIC_XCHG(&polled_mask[fd], 0);
+	if (!m)
+		return;
+	__ha_barrier_full();
+
+	for (i = global.nbthread - 1; i >= 0; i--) {
+		if (!(m & (1UL << i)) || uring[i].fd < 0)
+			continue;
+		if (i == tid) {
+			if (!uring_fds)
+				continue;
+			if (uring_reserve(&uring[tid], 1))
+				uring_poll_del(&uring[tid], fd, uring_fds[fd].gen);
+			else
+				uring_cancel_data(&uring[tid], ((__u64)uring_fds[fd].gen << 32) | (unsigned int)fd);
+		}
+		else
+			uring_cancel_fd(&uring[i], fd);
+	}
+}
+
+/* Updates the poll request of the current thread on <fd>. At least two
+ * submissions must have been reserved with uring_reserve().
+ */
+static void _update_fd(int fd)
+{
+	struct uring_fd *st = &uring_fds[fd];
+	unsigned int events = 0;
+	int en;
+
+	en = fdtab[fd].state;
+
+	if (fdtab[fd].thread_mask & tid_bit) {
+		if (en & FD_EV_POLLED_R)
+			events |= POLLIN | POLLRDHUP;
+		if (en & FD_EV_POLLED_W)
+			events |= POLLOUT;
+	}
+
+	if (polled_mask[fd] & tid_bit) {
+		if (st->events == events)
+			return;
+		/* fd status changed or fd removed from poll list */
+		uring_poll_del(&uring[tid], fd, st->gen);
+		if (!events)
+			HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
+	}
+	else if (events) {
+		/* new fd in the poll list */
+		HA_ATOMIC_OR(&polled_mask[fd], tid_bit);
+	}
+	else
+		return;
+
+	st->events = events;
+	if (events)
+		uring_poll_add(&uring[tid], fd, ++st->gen, events);
+}
+
+/*
+ * Linux io_uring() poller
+ */
+REGPRM2 static void _do_poll(struct poller *p, int exp)
+{
+	struct uring *r = &uring[tid];
+	unsigned int head;
+	int avail;
+	int fd;
+	int count;
+	int updt_idx;
+	int wait_time;
+	int old_fd;
+	int stuck = 0;
+
+	/* first, scan the update list to find polling changes. If the ring
+	 * cannot take them all, the remaining ones are kept for the next call.
+	 */
+	for (updt_idx = 0; updt_idx < fd_nbupdt; updt_idx++) {
+		fd = fd_updt[updt_idx];
+
+		if (!uring_reserve(r, 2)) {
+			stuck = 1;
+			break;
+		}
+
+		HA_ATOMIC_AND(&fdtab[fd].update_mask, ~tid_bit);
+		if (!fdtab[fd].owner) {
+			activity[tid].poll_drop++;
+			continue;
+		}
+
+		_update_fd(fd);
+	}
+	if (updt_idx < fd_nbupdt)
+		memmove(fd_updt, fd_updt + updt_idx, (fd_nbupdt - updt_idx) * sizeof(*fd_updt));
+	fd_nbupdt -= updt_idx;
+	/* Scan the global update list */
+	for (old_fd = fd = update_list.first; !stuck && fd != -1; fd = fdtab[fd].update.next) {
+		if (fd == -2) {
+			fd = old_fd;
+			continue;
+		}
+		else if (fd <= -3)
+			fd = -fd -4;
+		if (fd == -1)
+			break;
+		if (!(fdtab[fd].update_mask & tid_bit))
+			continue;
+		if (!uring_reserve(r, 2)) {
+			stuck = 1;
+			break;
+		}
+		done_update_polling(fd);
+		if (!fdtab[fd].owner)
+			continue;
+		_update_fd(fd);
+	}
+
+	thread_harmless_now();
+
+	/* compute the io_uring_enter() timeout */
+	if (stuck)
+		wait_time = 0;
+	else if (!exp)
+		wait_time = MAX_DELAY_MS;
+	else if (tick_is_expired(exp, now_ms)) {
+		activity[tid].poll_exp++;
+		wait_time = 0;
+	}
+	else {
+		wait_time = TICKS_TO_MS(tick_remain(now_ms, exp)) + 1;
+		if (wait_time > MAX_DELAY_MS)
+			wait_time = MAX_DELAY_MS;
+	}
+
+	/* now let's submit the changes and wait for polled events */
+
+	gettimeofday(&before_poll, NULL);
+	avail = uring_submit_wait(r, wait_time);
+	if (avail > global.tune.maxpollevents)
+		avail = global.tune.maxpollevents;
+	tv_update_date(wait_time, avail);
+	measure_idle();
+
+	thread_harmless_end();
+
+	/* process polled events */
+
+	head = *r->cq_khead;
+	for (count = 0; count < avail; count++, head++) {
+		struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+		struct uring_fd *st;
+		unsigned int n, e;
+		int rearm;
+
+		if (cqe->user_data == URING_DATA_NONE)
+			continue;
+
+		fd = (unsigned int)cqe->user_data;
+		st = &uring_fds[fd];
+		if (!(polled_mask[fd] & tid_bit) || st->gen != (unsigned int)(cqe->user_data >> 32)) {
+			/* replaced or cancelled request */
+			continue;
+		}
+
+		/* the request stops after this one if the kernel could not keep
+		 * it, it will have to be armed again.
+		 */
+		rearm = !(cqe->flags & IORING_CQE_F_MORE);
+		if (rearm)
+			HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
+
+		if (!fdtab[fd].owner) {
+			activity[tid].poll_dead++;
+			continue;
+		}
+
+		if (!(fdtab[fd].thread_mask & tid_bit)) {
+			/* FD has been migrated */
+			activity[tid].poll_skip++;
+			if (!rearm && uring_reserve(r, 1)) {
+				uring_poll_del(r, fd, st->gen);
+				HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
+			}
+			continue;
+		}
+
+		if (cqe->res > 0) {
+			e = cqe->res;
+
+			/* it looks complicated but gcc can optimize it away when constants
+			 * have same values... In fact it depends on gcc :-(
+			 */
+			if (POLLIN == FD_POLL_IN && POLLOUT == FD_POLL_OUT &&
+			    POLLPRI == FD_POLL_PRI && POLLERR == FD_POLL_ERR &&
+			    POLLHUP == FD_POLL_HUP) {
+				n = e & (POLLIN|POLLOUT|POLLPRI|POLLERR|POLLHUP);
+			}
+			else {
+				n =	((e & POLLIN ) ? FD_POLL_IN  : 0) |
+					((e & POLLPRI) ? FD_POLL_PRI : 0) |
+					((e & POLLOUT) ? FD_POLL_OUT : 0) |
+					((e & POLLERR) ? FD_POLL_ERR : 0) |
+					((e & POLLHUP) ? FD_POLL_HUP : 0);
+			}
+
+			/* always remap RDHUP to HUP as they're used similarly */
+			if (e & POLLRDHUP) {
+				HA_ATOMIC_OR(&cur_poller.flags, HAP_POLL_F_RDHUP);
+				n |= FD_POLL_HUP;
+			}
+			fd_update_events(fd, n);
+		}
+
+		if (rearm) {
+			if (uring_reserve(r, 2))
+				_update_fd(fd);
+			else
+				updt_fd_polling(fd);
+		}
+	}
+	__atomic_store_n(r->cq_khead, head, __ATOMIC_RELEASE);
+	/* the caller will take care of cached events */
+}
+
+static int init_uring_per_thread()
+{
+	int fd;
+
+	uring_fds = calloc(global.maxsock, sizeof(*uring_fds));
+	if (uring_fds == NULL)
+		goto fail_alloc;
+
+	if (MAX_THREADS > 1 && tid) {
+		if (!uring_init(&uring[tid], global.tune.maxpollevents))
+			goto fail_ring;
+	}
+
+	/* this ring knows no FD yet, whatever the polled mask may say if it
+	 * was inherited. Let's mark them all as updated, the poller will
+	 * register the ones it has to.
+	 */
+	for (fd = 0; fd < global.maxsock; fd++) {
+		HA_ATOMIC_AND(&polled_mask[fd], ~tid_bit);
+		updt_fd_polling(fd);
+	}
+
+	return 1;
+ fail_ring:
+	free(uring_fds);
+	uring_fds = NULL;
+ fail_alloc:
+	return 0;
+}
+
+static void deinit_uring_per_thread()
+{
+	if (MAX_THREADS > 1 && tid)
+		uring_term(&uring[tid]);
+
+	free(uring_fds);
+	uring_fds = NULL;
+}
+
+/*
+ * Initialization of the io_uring() poller.
+ * Returns 0 in case of failure, non-zero in case of success. If it fails, it
+ * disables the poller by setting its pref to 0.
+ */
+REGPRM1 static int _do_init(struct poller *p)
+{
+	p->private = NULL;
+
+	if (!uring_init(&uring[tid], global.tune.maxpollevents))
+		goto fail_ring;
+
+	hap_register_per_thread_init(init_uring_per_thread);
+	hap_register_per_thread_deinit(deinit_uring_per_thread);
+
+	return 1;
+
+ fail_ring:
+	p->pref = 0;
+	return 0;
+}
+
+/*
+ * Termination of the io_uring() poller.
+ * Memory is released and the poller is marked as unselectable.
+ */
+REGPRM1 static void _do_term(struct poller *p)
+{
+	uring_term(&uring[tid]);
+
+	p->private = NULL;
+	p->pref = 0;
+}
+
+/*
+ * Check that the poller works. Beyond io_uring itself, it needs multishot
+ * poll requests (kernel 5.13) and synchronous cancellation (kernel 6.0),
+ * which are checked on a pipe which is always writable.
+ * Returns 1 if OK, otherwise 0.
+ */
+REGPRM1 static int _do_test(struct poller *p)
+{
+	struct uring r;
+	int pipefd[2];
+	int ret = 0;
+
+	if (!uring_init(&r, 4))
+		return 0;
+
+	if (pipe(pipefd) < 0)
+		goto out;
+
+	uring_poll_add(&r, pipefd[1], 1, POLLOUT);
+	if (uring_submit_wait(&r, 1000) &&
+	    r.cqes[*r.cq_khead & r.cq_mask].res > 0 &&
+	    (r.cqes[*r.cq_khead & r.cq_mask].flags & IORING_CQE_F_MORE) &&
+	    uring_cancel_fd(&r, pipefd[1]) == 1)
+		ret = 1;
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+ out:
+	uring_term(&r);
+	return ret;
+}
+
+/*
+ * Recreate the ring after a fork(). Returns 1 if OK, otherwise 0. It will
+ * ensure that all processes will not share their ring.
+ */
+REGPRM1 static int _do_fork(struct poller *p)
+{
+	uring_term(&uring[tid]);
+	return uring_init(&uring[tid], global.tune.maxpollevents);
+}
+
+/*
+ * It is a constructor, which means that it will automatically be called before
+ * main(). This is GCC-specific but it works at least since 2.95.
+ * Special care must be taken so that it does not need any uninitialized data.
+ */
+__attribute__((constructor))
+static void _do_register(void)
+{
+	struct poller *p;
+	int i;
+
+	if (nbpollers >= MAX_POLLERS)
+		return;
+
+	for (i = 0; i < MAX_THREADS; i++)
+		uring[i].fd = -1;
+
+	p = &pollers[nbpollers++];
+
+	p->name = "uring";
+	p->pref = 350;
+	p->flags = 0;
+	p->private = NULL;
+
+	p->clo  = __fd_clo;
+	p->test = _do_test;
+	p->init = _do_init;
+	p->term = _do_term;
+	p->poll = _do_poll;
+	p->fork = _do_fork;
+}
+
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -169,8 +169,8 @@ struct poller pollers[MAX_POLLERS];
 struct poller cur_poller;
 int nbpollers = 0;
 
-volatile struct fdlist fd_cache ; // FD events cache
-volatile struct fdlist fd_cache_local[MAX_THREADS]; // FD events local for each thread
+struct fdset fd_cache; // FD events cache
+struct fdset fd_cache_local[MAX_THREADS]; // FD events local for each thread
 volatile struct fdlist update_list; // Global update list
 
 unsigned long fd_cache_mask = 0; // Mask of threads with events in the cache
@@ -402,62 +402,108 @@ void fd_remove(int fd)
 	fd_dodelete(fd, 0);
 }
 
-static inline void fdlist_process_cached_events(volatile struct fdlist *fdlist)
+/* Allocates set <set> for <maxfd> FDs. Returns 0 on failure. */
+static int fdset_alloc(struct fdset *set, int maxfd)
 {
-	int fd, old_fd, e;
-
-	for (old_fd = fd = fdlist->first; fd != -1; fd = fdtab[fd].cache.next) {
-		if (fd == -2) {
-			fd = old_fd;
-			continue;
-		} else if (fd <= -3)
-			fd = -fd - 4;
-		if (fd == -1)
-			break;
-		old_fd = fd;
-		if (!(fdtab[fd].thread_mask & tid_bit))
-			continue;
-		if (fdtab[fd].cache.next < -3)
-			continue;
+	unsigned int nbwords = (maxfd + LONGBITS - 1) / LONGBITS;
 
-		HA_ATOMIC_OR(&fd_cache_mask, tid_bit);
-		if (atleast2(fdtab[fd].thread_mask) && HA_SPIN_TRYLOCK(FD_LOCK, &fdtab[fd].lock)) {
-			activity[tid].fd_lock++;
-			continue;
-		}
+	set->nbsum = (nbwords + LONGBITS - 1) / LONGBITS;
+	set->bits = calloc(nbwords, sizeof(*set->bits));
+	set->summary = calloc(set->nbsum, sizeof(*set->summary));
+	return set->bits && set->summary;
+}
 
-		e = fdtab[fd].state;
-		fdtab[fd].ev &= FD_POLL_STICKY;
+static void fdset_free(struct fdset *set)
+{
+	free(set->bits);    set->bits = NULL;
+	free(set->summary); set->summary = NULL;
+	set->nbsum = 0;
+}
 
-		if ((e & (FD_EV_READY_R | FD_EV_ACTIVE_R)) == (FD_EV_READY_R | FD_EV_ACTIVE_R))
-			fdtab[fd].ev |= FD_POLL_IN;
+/* Processes the FDs of set <set> which belong to the current thread. FDs
+ * added during the walk are processed if they come later in the set, or on
+ * the next call otherwise. Returns non-zero if some FDs of the current
+ * thread were found in the set, FDs of other threads being ignored.
+ */
+static inline int fdset_process_cached_events(struct fdset *set)
+{
+	unsigned long sum, bits, sbit;
+	unsigned int s, w;
+	int fd, e, found = 0;
+
+	for (s = 0; s < set->nbsum; s++) {
+		for (sum = ((volatile unsigned long *)set->summary)[s]; sum; sum &= sum - 1) {
+			sbit = sum & -sum;
+			w = s * LONGBITS + my_ffsl(sum) - 1;
+			bits = ((volatile unsigned long *)set->bits)[w];
+			if (!bits) {
+				/* empty word: clear its summary bit, then check
+				 * again in case an FD was added in the mean time.
+				 */
+				HA_ATOMIC_AND(&set->summary[s], ~sbit);
+				bits = ((volatile unsigned long *)set->bits)[w];
+				if (!bits)
+					continue;
+				HA_ATOMIC_OR(&set->summary[s], sbit);
+			}
 
-		if ((e & (FD_EV_READY_W | FD_EV_ACTIVE_W)) == (FD_EV_READY_W | FD_EV_ACTIVE_W))
-			fdtab[fd].ev |= FD_POLL_OUT;
+			for (; bits; bits &= bits - 1) {
+				fd = w * LONGBITS + my_ffsl(bits) - 1;
 
-		if (fdtab[fd].iocb && fdtab[fd].owner && fdtab[fd].ev) {
-			if (atleast2(fdtab[fd].thread_mask))
-				HA_SPIN_UNLOCK(FD_LOCK, &fdtab[fd].lock);
-			fdtab[fd].iocb(fd);
-		}
-		else {
-			fd_release_cache_entry(fd);
-			if (atleast2(fdtab[fd].thread_mask))
-				HA_SPIN_UNLOCK(FD_LOCK, &fdtab[fd].lock);
+				if (!(fdtab[fd].thread_mask & tid_bit))
+					continue;
+
+				/* it may have left the cache since the word was read */
+				if (!fdset_isset(set, fd))
+					continue;
+
+				found = 1;
+				if (atleast2(fdtab[fd].thread_mask) && HA_SPIN_TRYLOCK(FD_LOCK, &fdtab[fd].lock)) {
+					activity[tid].fd_lock++;
+					continue;
+				}
+
+				e = fdtab[fd].state;
+				fdtab[fd].ev &= FD_POLL_STICKY;
+
+				if ((e & (FD_EV_READY_R | FD_EV_ACTIVE_R)) == (FD_EV_READY_R | FD_EV_ACTIVE_R))
+					fdtab[fd].ev |= FD_POLL_IN;
+
+				if ((e & (FD_EV_READY_W | FD_EV_ACTIVE_W)) == (FD_EV_READY_W | FD_EV_ACTIVE_W))
+					fdtab[fd].ev |= FD_POLL_OUT;
+
+				if (fdtab[fd].iocb && fdtab[fd].owner && fdtab[fd].ev) {
+					if (atleast2(fdtab[fd].thread_mask))
+						HA_SPIN_UNLOCK(FD_LOCK, &fdtab[fd].lock);
+					fdtab[fd].iocb(fd);
+				}
+				else {
+					fd_release_cache_entry(fd);
+					if (atleast2(fdtab[fd].thread_mask))
+						HA_SPIN_UNLOCK(FD_LOCK, &fdtab[fd].lock);
+				}
+			}
 		}
 	}
+	return found;
 }
 
 /* Scan and process the cached events. This should be called right after
  * the poller. The loop may cause new entries to be created, for example
  * if a listener causes an accept() to initiate a new incoming connection
- * wanting to attempt an recv().
+ * wanting to attempt an recv(). The thread's bit in fd_cache_mask is kept
+ * as long as some FDs are found in its sets so that it does not sleep while
+ * some of them remain.
  */
 void fd_process_cached_events()
 {
+	int found;
+
 	HA_ATOMIC_AND(&fd_cache_mask, ~tid_bit);
-	fdlist_process_cached_events(&fd_cache_local[tid]);
-	fdlist_process_cached_events(&fd_cache);
+	found  = fdset_process_cached_events(&fd_cache_local[tid]);
+	found |= fdset_process_cached_events(&fd_cache);
+	if (found)
+		HA_ATOMIC_OR(&fd_cache_mask, tid_bit);
 }
 
 /* disable the specified poller */
@@ -524,19 +570,22 @@ int init_pollers()
 	if ((fdinfo = calloc(global.maxsock, sizeof(struct fdinfo))) == NULL)
 		goto fail_info;
 
-	fd_cache.first = fd_cache.last = -1;
+	if (!fdset_alloc(&fd_cache, global.maxsock))
+		goto fail_cache;
+	for (p = 0; p < global.nbthread; p++) {
+		if (!fdset_alloc(&fd_cache_local[p], global.maxsock))
+			goto fail_cache;
+	}
+
 	update_list.first = update_list.last = -1;
 	hap_register_per_thread_init(init_pollers_per_thread);
 	hap_register_per_thread_deinit(deinit_pollers_per_thread);
 
 	for (p = 0; p < global.maxsock; p++) {
 		HA_SPIN_INIT(&fdtab[p].lock);
-		/* Mark the fd as out of the fd cache */
-		fdtab[p].cache.next = -3;
+		/* Mark the fd as out of the update list */
 		fdtab[p].update.next = -3;
 	}
-	for (p = 0; p < global.nbthread; p++)
-		fd_cache_local[p].first = fd_cache_local[p].last = -1;
 
 	do {
 		bp = NULL;
@@ -555,6 +604,9 @@ int init_pollers()
 	return 0;
 
  fail_cache:
+	for (p = 0; p < global.nbthread; p++)
+		fdset_free(&fd_cache_local[p]);
+	fdset_free(&fd_cache);
 	free(fdinfo);
  fail_info:
 	free(fdtab);
@@ -582,6 +634,10 @@ void deinit_pollers() {
 			bp->term(bp);
 	}
 
+	for (p = 0; p < global.nbthread; p++)
+		fdset_free(&fd_cache_local[p]);
+	fdset_free(&fd_cache);
+
 	free(fdinfo);   fdinfo   = NULL;
 	free(fdtab);    fdtab    = NULL;
 	free(polled_mask); polled_mask = NULL;
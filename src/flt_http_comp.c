@@ -191,6 +191,13 @@ comp_http_data(struct stream *s, struct filter *filter, struct http_msg *msg)
 	if (!st->initialized) {
 		unsigned int fwd = flt_rsp_fwd(filter) + st->hdrs_len;
 
+		/* the channel's buffer will be swapped with zbuf, so it must
+		 * first be promoted to the same size class.
+		 */
+		if (c_size(chn) < b_size(&zbuf) &&
+		    !channel_grow_buffer(chn, b_size(&zbuf), &s->buffer_wait))
+			return 0;
+
 		b_reset(&tmpbuf);
 		c_adv(chn, fwd);
 		ret = http_compression_buffer_init(chn, &zbuf, &buf_output);
@@ -242,6 +249,13 @@ comp_http_chunk_trailers(struct stream *s, struct filter *filter,
 			struct channel *chn = msg->chn;
 			unsigned int   fwd = flt_rsp_fwd(filter) + st->hdrs_len;
 
+			/* see comp_http_data(), but we cannot wait here */
+			if (c_size(chn) < b_size(&zbuf) &&
+			    !channel_grow_buffer(chn, b_size(&zbuf), NULL)) {
+				ha_warning("HTTP compression failed: no buffer available to compress the trailers\n");
+				return -1;
+			}
+
 			b_reset(&tmpbuf);
 			c_adv(chn, fwd);
 			http_compression_buffer_init(chn, &zbuf, &buf_output);
@@ -6,48 +6,201 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
+#include <common/buffer.h>
 #include <common/standard.h>
 #include <common/time.h>
 #include <common/tools.h>
 #include <common/hathreads.h>
+#include <common/memory.h>
 
+#include <types/applet.h>
 #include <types/channel.h>
+#include <types/cli.h>
 #include <types/filters.h>
 #include <types/global.h>
 #include <types/proxy.h>
+#include <types/sample.h>
+#include <types/stats.h>
 #include <types/stream.h>
 
+#include <proto/applet.h>
+#include <proto/arg.h>
+#include <proto/channel.h>
+#include <proto/cli.h>
 #include <proto/filters.h>
+#include <proto/flt_json.h>
+#include <proto/frontend.h>
 #include <proto/hdr_idx.h>
 #include <proto/log.h>
+#include <proto/proxy.h>
+#include <proto/sample.h>
+#include <proto/session.h>
+#include <proto/stats.h>
 #include <proto/stream.h>
+#include <proto/stream_interface.h>
+#include <proto/task.h>
 
 #include <jsonwrapper.h>
-
-struct flt_ops json_ops;
+#include <jsonsimd.h>
 
 enum json_version {
 	JSON_PARSER
 	, JSON_NOOP
 	, JSON_NEWLINE
 	, JSON_NEWLINE_SIMD
+	, JSON_SIMD
 };
 char* json_version_str[] = {
 	"full json parser (rapidjson)"
 	, "noop"
 	, "newline"
 	, "newline with simd"
+	, "simd structural index"
+};
+
+/* number of buckets of the histograms, the last one counts all larger values */
+#define JSON_HIST_BUCKETS        16
+/* the first bucket of the bytes histogram counts calls which looked at less
+ * than 64 bytes, the first one of the latency histogram calls which took less
+ * than 256ns. The bound of each next bucket is twice the previous one.
+ */
+#define JSON_HIST_BYTES_SHIFT    6
+#define JSON_HIST_NS_SHIFT       8
+
+/* Counters of a filter for one thread. Each thread only ever writes its own,
+ * which sit on cache lines of their own, so they need no atomic operation.
+ * Readers sum them without locking and may see them slightly off.
+ */
+struct json_counters {
+	unsigned long long records_parsed;
+	unsigned long long records_failed;
+	unsigned long long records_dropped;
+	unsigned long long bytes;          /* input bytes looked at by the data callbacks */
+	unsigned long long calls;          /* calls to the data callbacks */
+	unsigned long long time_ns;        /* time spent in these calls */
+	unsigned long long bytes_hist[JSON_HIST_BUCKETS]; /* input bytes looked at per call */
+	unsigned long long lat_hist[JSON_HIST_BUCKETS];   /* time spent per call */
+} __attribute__((aligned(64)));
+
+/* what is done with an invalid record */
+enum json_on_error {
+	JSON_ERR_BLOCK = 0,   /* stop forwarding data, the default */
+	JSON_ERR_PASS,        /* forward it as is */
+	JSON_ERR_DROP,        /* remove it */
+	JSON_ERR_QUARANTINE,  /* remove it and keep a copy for the CLI */
+};
+
+/* number of records and of bytes of each record kept in quarantine */
+#define JSON_QUARANTINE_MAX      16
+#define JSON_QUARANTINE_LEN      128
+
+/* A record removed with "on-error quarantine" */
+struct json_quarantined {
+	struct timeval date;                /* date it was found */
+	unsigned int   sid;                 /* id of the stream it came from */
+	unsigned int   len;                 /* its whole length */
+	char           data[JSON_QUARANTINE_LEN]; /* its first bytes */
+};
+
+/* The last records removed with "on-error quarantine", shared by all threads */
+struct json_quarantine {
+	__decl_hathreads(HA_SPINLOCK_T lock);
+	unsigned int total;                 /* records ever quarantined, the next one goes to total % MAX */
+	struct json_quarantined recs[JSON_QUARANTINE_MAX];
 };
 
 struct json_config {
 	struct proxy *proxy;
 	char         *name;
 	enum json_version version;
-	int stats_records_parsed;
-	int stats_records_failed;
+	struct json_counters *counters; /* one per thread, allocated at init time */
+	enum json_on_error on_error;    /* what is done with invalid records */
+	struct json_quarantine *quarantine; /* only with "on-error quarantine" */
+	int minify;                  /* rewrite records without insignificant whitespaces */
+	int canonical;               /* also sort the members of objects by key */
+	int transcode;               /* JSON_ENC_* format records are rewritten to, 0 for none */
+	struct json_schema *schema;  /* records must match it, NULL if none */
+
+	/* raw predicates run on each record before it is parsed */
+	struct list preds;
+
+	/* fan-out of the records over several server connections */
+	struct {
+		char         *be_name; /* name of the backend */
+		struct proxy *be;      /* backend, resolved at check time */
+		struct proxy  fe;      /* frontend the extra connections belong to */
+		unsigned int  conns;   /* connections per stream, including its own */
+		unsigned int  batch;   /* max bytes of records sent in a row to a connection */
+	} fanout;
+
+	/* coalescing of the records sent to the server */
+	struct {
+		unsigned int size;     /* bytes of records to hold before sending them, 0 if disabled */
+		unsigned int delay;    /* max time the records are held, in ms */
+	} coalesce;
+};
+
+/* A raw predicate. The record is dropped if it does not contain <str>, or if
+ * it contains it when <drop_if> is set.
+ */
+struct json_pred {
+	struct list list;
+	int         drop_if;  /* "drop-if" instead of "drop-unless" */
+	char       *str;      /* the string to look for */
+	size_t      len;      /* its length */
+};
+
+/* maximum and default number of connections records are fanned out to */
+#define JSON_FANOUT_MAX_CONNS   64
+#define JSON_FANOUT_DEF_CONNS   4
+
+/* default time records are held when they are coalesced, in ms */
+#define JSON_COALESCE_DEF_DELAY 2
+
+/* An extra server connection of the fan-out. It is made of an applet feeding
+ * the records to a stream of its own, so the backend picks its server as for
+ * any other stream. The sink belongs to the filter as long as <owner> is set,
+ * then to the applet which releases it once all records were sent.
+ */
+struct json_sink {
+	struct appctx     *appctx; /* NULL once the applet was released */
+	struct json_state *owner;  /* NULL once the client's stream is gone */
+	struct buffer      buf;    /* records waiting to be sent */
+};
+
+/* json_sink applet states */
+enum {
+	JSON_SINK_ST_RUN = 0,
+	JSON_SINK_ST_END,
+};
+
+/* per-stream filter context, allocated when the filter is attached */
+struct json_state {
+	struct json_simd_state scan; /* resumable scanner, offsets relative to FLT_NXT */
+	unsigned int failed;         /* an invalid record was found. Parsing stops, unless the
+	                              * record is skipped, and then it starts the input */
+	unsigned int raw_ofs;        /* bytes of the partial record already searched for its end */
+	unsigned int rec_len;        /* length of the last validated record, 0 if none */
+	unsigned int rec_tail;       /* bytes validated after it, it ends that many bytes before FLT_NXT */
+	unsigned int fanout_cur;     /* connection the next batch of records goes to */
+	int coalesce_exp;            /* date the held records are sent at, if any */
+	struct json_sink *sinks[JSON_FANOUT_MAX_CONNS - 1]; /* extra connections */
 };
 
+static struct pool_head *pool_head_json_state = NULL;
+static struct pool_head *pool_head_json_sink = NULL;
+
+const char *json_flt_id = "json filter";
+
+/* counters of the current thread */
+#define JSON_CNT(conf)   (&(conf)->counters[tid])
+
+/* common/debug.h has its own, stream oriented, one */
+#undef TRACE
 #define TRACE(conf, fmt, ...)						\
 	fprintf(stderr, "%d.%06d [%-20s] " fmt "\n",			\
 		(int)now.tv_sec, (int)now.tv_usec, (conf)->name,	\
@@ -136,6 +289,450 @@ json_hexdump(struct buffer *buf, int len, int out)
 }
 #endif
 
+/* returns a monotonic timestamp in nanoseconds */
+static inline unsigned long long
+json_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* returns the histogram bucket of value <v>, the first one being for values
+ * below 1 << <shift> */
+static inline unsigned int
+json_hist_bucket(unsigned long long v, unsigned int shift)
+{
+	unsigned int b = 0;
+
+	for (v >>= shift; v && b < JSON_HIST_BUCKETS - 1; v >>= 1)
+		b++;
+	return b;
+}
+
+/* Accounts for a call to a data callback which looked at <bytes> bytes of
+ * input and started at <start>, as returned by json_now_ns().
+ */
+static inline void
+json_count_call(struct json_config *conf, unsigned long long bytes, unsigned long long start)
+{
+	struct json_counters *cnt = JSON_CNT(conf);
+	unsigned long long    ns = json_now_ns() - start;
+
+	cnt->calls++;
+	cnt->bytes += bytes;
+	cnt->time_ns += ns;
+	cnt->bytes_hist[json_hist_bucket(bytes, JSON_HIST_BYTES_SHIFT)]++;
+	cnt->lat_hist[json_hist_bucket(ns, JSON_HIST_NS_SHIFT)]++;
+}
+
+/* Sums the counters of all threads of <conf> into <sum> */
+static void
+json_sum_counters(const struct json_config *conf, struct json_counters *sum)
+{
+	const struct json_counters *cnt;
+	int i, b;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < global.nbthread; i++) {
+		cnt = &conf->counters[i];
+		sum->records_parsed  += cnt->records_parsed;
+		sum->records_failed  += cnt->records_failed;
+		sum->records_dropped += cnt->records_dropped;
+		sum->bytes           += cnt->bytes;
+		sum->calls           += cnt->calls;
+		sum->time_ns         += cnt->time_ns;
+		for (b = 0; b < JSON_HIST_BUCKETS; b++) {
+			sum->bytes_hist[b] += cnt->bytes_hist[b];
+			sum->lat_hist[b]   += cnt->lat_hist[b];
+		}
+	}
+}
+
+/* Makes sure the stream is woken up when the records it holds must be sent.
+ * An expired date of the task is replaced, since it would be ignored.
+ */
+static inline void
+json_coalesce_arm(struct stream *s, struct json_state *st)
+{
+	s->task->expire = tick_first((tick_is_expired(s->task->expire, now_ms) ? 0 : s->task->expire),
+				     st->coalesce_exp);
+}
+
+/* Fills <v> with the input data of <chn> the filter did not consume yet */
+static inline void
+json_get_view(struct filter *filter, struct channel *chn, int avail, struct json_view *v)
+{
+	v->blk1 = v->blk2 = NULL;
+	v->len1 = v->len2 = 0;
+	b_getblk_nc(&chn->buf, &v->blk1, &v->len1, &v->blk2, &v->len2,
+		    co_data(chn) + FLT_NXT(filter, chn), avail);
+}
+
+/***************************************************************************
+ * Fan-out of the records over extra server connections
+ **************************************************************************/
+static void
+json_sink_free(struct json_sink *sink)
+{
+	if (sink->buf.size) {
+		b_free(&sink->buf);
+		offer_buffers(NULL, tasks_run_queue);
+	}
+	pool_free(pool_head_json_sink, sink);
+}
+
+/* I/O handler of a sink. It pushes the pending records to its stream, and
+ * closes the connection once the client's stream is gone and everything was
+ * sent.
+ */
+static void
+json_sink_io_handler(struct appctx *appctx)
+{
+	struct stream_interface *si   = appctx->owner;
+	struct json_sink        *sink = appctx->ctx.json.ptr;
+	struct channel          *ic   = si_ic(si);
+	struct channel          *oc   = si_oc(si);
+	size_t len;
+
+	if (!sink || appctx->st0 == JSON_SINK_ST_END)
+		return;
+	if (unlikely(si->state == SI_ST_DIS || si->state == SI_ST_CLO))
+		return;
+
+	/* servers are not expected to answer, drop anything they send */
+	if (co_data(oc))
+		co_skip(oc, co_data(oc));
+
+	while (b_data(&sink->buf)) {
+		len = b_contig_data(&sink->buf, 0);
+		if (len > (size_t)channel_recv_max(ic))
+			len = channel_recv_max(ic);
+		if (!len || ci_putblk(ic, b_head(&sink->buf), len) <= 0) {
+			si_applet_cant_put(si);
+			goto out;
+		}
+		b_del(&sink->buf, len);
+	}
+	si_applet_stop_put(si);
+
+	if (!sink->owner) {
+		/* no more records, the stream closes the server connection
+		 * once everything is forwarded */
+		appctx->st0 = JSON_SINK_ST_END;
+		si_shutr(si);
+		ic->flags |= CF_READ_NULL;
+	}
+  out:
+	task_wakeup(si_strm(si)->task, TASK_WOKEN_IO);
+}
+
+/* Called when the connection of a sink is closed */
+static void
+json_sink_release(struct appctx *appctx)
+{
+	struct json_sink *sink = appctx->ctx.json.ptr;
+
+	if (!sink)
+		return;
+	appctx->ctx.json.ptr = NULL;
+	sink->appctx = NULL;
+
+	/* otherwise the filter notices it and releases it */
+	if (!sink->owner)
+		json_sink_free(sink);
+}
+
+static struct applet json_sink_applet = {
+	.obj_type = OBJ_TYPE_APPLET,
+	.name = "<JSON>", /* used for logging */
+	.fct = json_sink_io_handler,
+	.release = json_sink_release,
+};
+
+/* Opens an extra connection to the fan-out backend for the stream the filter
+ * state <st> belongs to. Returns the new sink or NULL on error.
+ */
+static struct json_sink *
+json_sink_new(struct json_config *conf, struct json_state *st)
+{
+	struct json_sink *sink;
+	struct appctx    *appctx;
+	struct session   *sess;
+	struct stream    *strm;
+
+	sink = pool_alloc_dirty(pool_head_json_sink);
+	if (!sink)
+		goto out_error;
+	sink->owner = st;
+	sink->buf   = BUF_NULL;
+	if (!b_alloc_margin(&sink->buf, global.tune.reserved_bufs))
+		goto out_free_sink;
+
+	if ((appctx = appctx_new(&json_sink_applet, tid_bit)) == NULL)
+		goto out_free_sink;
+	appctx->st0 = JSON_SINK_ST_RUN;
+	appctx->ctx.json.ptr = sink;
+	sink->appctx = appctx;
+
+	sess = session_new(&conf->fanout.fe, NULL, &appctx->obj_type);
+	if (!sess)
+		goto out_free_appctx;
+
+	if ((strm = stream_new(sess, &appctx->obj_type)) == NULL)
+		goto out_free_sess;
+
+	stream_set_backend(strm, conf->fanout.be);
+
+	/* applet is waiting for data */
+	si_applet_cant_get(&strm->si[0]);
+	appctx_wakeup(appctx);
+
+	strm->do_log = NULL;
+	strm->res.flags |= CF_READ_DONTWAIT;
+
+	task_wakeup(strm->task, TASK_WOKEN_INIT);
+	return sink;
+
+	/* Error unrolling */
+ out_free_sess:
+	session_free(sess);
+ out_free_appctx:
+	appctx_free(appctx);
+ out_free_sink:
+	json_sink_free(sink);
+ out_error:
+	return NULL;
+}
+
+/* Moves <len> bytes of input data of <chn> from offset <src> to offset <dst>
+ * of the input, taking care of the buffer wrapping. When moving forward, the
+ * last bytes are moved first.
+ */
+static void
+json_move_input(struct channel *chn, size_t dst, size_t src, size_t len)
+{
+	struct buffer *buf = &chn->buf;
+	char *d, *s;
+	size_t n;
+
+	dst += co_data(chn);
+	src += co_data(chn);
+	if (dst > src) {
+		while (len) {
+			d = b_peek(buf, dst + len - 1);
+			s = b_peek(buf, src + len - 1);
+			n = MIN(len, (size_t)(d - b_orig(buf)) + 1);
+			n = MIN(n, (size_t)(s - b_orig(buf)) + 1);
+			memmove(d + 1 - n, s + 1 - n, n);
+			len -= n;
+		}
+		return;
+	}
+	while (len) {
+		d = b_peek(buf, dst);
+		s = b_peek(buf, src);
+		n = MIN(len, (size_t)(b_wrap(buf) - d));
+		n = MIN(n, (size_t)(b_wrap(buf) - s));
+		memmove(d, s, n);
+		dst += n;
+		src += n;
+		len -= n;
+	}
+}
+
+/* Removes <len> bytes of input data from <chn>, <ofs> bytes after the
+ * beginning of the input. The data that follow are moved back.
+ */
+static void
+json_del_input(struct channel *chn, size_t ofs, size_t len)
+{
+	json_move_input(chn, ofs, ofs + len, ci_data(chn) - ofs - len);
+	b_sub(&chn->buf, len);
+}
+
+/* Replaces the <old> bytes of input data of <chn> found at offset <ofs> with
+ * the <len> bytes at <blk>. The caller must make sure there is enough room.
+ */
+static void
+json_replace_input(struct channel *chn, size_t ofs, size_t old, const char *blk, size_t len)
+{
+	struct buffer *buf = &chn->buf;
+	size_t pos, n;
+	char *dst;
+
+	if (len > old) {
+		b_add(buf, len - old);
+		json_move_input(chn, ofs + len, ofs + old, ci_data(chn) - ofs - len);
+	}
+	else if (len < old)
+		json_del_input(chn, ofs + len, old - len);
+
+	pos = co_data(chn) + ofs;
+	while (len) {
+		dst = b_peek(buf, pos);
+		n = MIN(len, (size_t)(b_wrap(buf) - dst));
+		memcpy(dst, blk, n);
+		blk += n;
+		pos += n;
+		len -= n;
+	}
+}
+
+/* Keeps a copy of the first bytes of the invalid record found between <from>
+ * and <to> in view <v> of stream <s>, in place of the oldest one.
+ */
+static void
+json_quarantine(struct json_config *conf, struct stream *s, const struct json_view *v,
+		size_t from, size_t to)
+{
+	struct json_quarantine  *q = conf->quarantine;
+	struct json_quarantined *rec;
+	size_t len = MIN(to - from, (size_t)JSON_QUARANTINE_LEN);
+	size_t n;
+
+	HA_SPIN_LOCK(JSON_QUARANTINE_LOCK, &q->lock);
+	rec = &q->recs[q->total++ % JSON_QUARANTINE_MAX];
+	rec->date = now;
+	rec->sid = s->uniq_id;
+	rec->len = to - from;
+	n = 0;
+	if (from < v->len1) {
+		n = MIN(len, v->len1 - from);
+		memcpy(rec->data, v->blk1 + from, n);
+	}
+	if (n < len)
+		memcpy(rec->data + n, v->blk2 + from + n - v->len1, len - n);
+	if (len < JSON_QUARANTINE_LEN)
+		rec->data[len] = 0;
+	HA_SPIN_UNLOCK(JSON_QUARANTINE_LOCK, &q->lock);
+}
+
+/* Applies the error policy of the filter to the invalid record found at offset
+ * <ofs> of the <avail> bytes of input. It ends with the first newline following
+ * its first non blank byte, or with the input once it is closed. With "on-error
+ * pass" it is kept and its length is returned. Otherwise it is removed, <avail>
+ * is updated and 0 is returned. Returns -1 if its end was not received yet.
+ */
+static int
+json_skip_invalid(struct stream *s, struct filter *filter, struct channel *chn, size_t ofs, int *avail)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_view    v;
+	size_t from, end;
+
+	json_get_view(filter, chn, *avail, &v);
+	for (from = ofs; from < (size_t)*avail && isspace(json_view_byte(&v, from)); from++)
+		;
+	end = json_view_chr(&v, from, *avail, '\n') + 1;
+	if (end > (size_t)*avail) {
+		if (!(chn->flags & CF_SHUTR))
+			return -1;
+		end = *avail;
+	}
+
+	if (conf->on_error == JSON_ERR_PASS)
+		return end - ofs;
+	/* the blanks before it end the previous record */
+	if (conf->on_error == JSON_ERR_QUARANTINE)
+		json_quarantine(conf, s, &v, from, end);
+	json_del_input(chn, FLT_NXT(filter, chn) + from, end - from);
+	*avail -= end - from;
+	return 0;
+}
+
+/* Called when the record at offset <ofs> of the input is invalid. Unless the
+ * stream is blocked, the error policy is applied to the record and the scanner
+ * restarts right after it, then 1 is returned. Otherwise 0 is returned with
+ * <st->failed> set, the valid records before <ofs> may be forwarded, and the
+ * invalid one then starts the input. It is handled by the next call once its
+ * end is received.
+ */
+static int
+json_handle_invalid(struct stream *s, struct filter *filter, struct channel *chn, size_t ofs, int *avail)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
+	int                 len;
+
+	st->failed = 1;
+	if (conf->on_error == JSON_ERR_BLOCK)
+		return 0;
+	len = json_skip_invalid(s, filter, chn, ofs, avail);
+	if (len < 0)
+		return 0;
+	st->failed = 0;
+	/* the last record indexed may be the invalid one */
+	if (st->scan.last_end > ofs)
+		st->scan.last = st->scan.last_end = ofs;
+	json_simd_restart(&st->scan, ofs + len);
+	return 1;
+}
+
+/* Returns how many of the <avail> bytes of input of <chn> must be looked at to
+ * find the end of the next batch of records. Once the input is closed, all
+ * the remaining records are sent at once because the stream closes the
+ * server side as soon as no more output is pending.
+ */
+static inline int
+json_fanout_window(const struct json_config *conf, struct channel *chn, int avail)
+{
+	if (conf->fanout.be && avail > (int)conf->fanout.batch && !(chn->flags & CF_SHUTR))
+		return conf->fanout.batch;
+	return avail;
+}
+
+/* Hands the batch made of the <len> first bytes of the filter's input, which
+ * are complete records, to the next connection of the fan-out. The stream's
+ * own server connection is part of it. Returns the number of bytes to forward
+ * on the stream's own connection, either <len> or 0 when the records were
+ * moved to an extra connection. <avail> is the amount of input data.
+ */
+static int
+json_fanout(struct stream *s, struct filter *filter, struct channel *chn, int len, int avail)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
+	struct json_sink   *sink;
+	struct json_view    v;
+	unsigned int slot;
+
+	/* other records may follow this batch */
+	if (len < avail)
+		task_wakeup(s->task, TASK_WOKEN_MSG);
+
+	slot = st->fanout_cur++;
+	if (st->fanout_cur >= conf->fanout.conns)
+		st->fanout_cur = 0;
+	if (!slot)
+		return len;
+
+	sink = st->sinks[slot - 1];
+	if (sink && !sink->appctx) {
+		/* its connection was closed, open a new one */
+		json_sink_free(sink);
+		sink = NULL;
+	}
+	if (!sink)
+		sink = st->sinks[slot - 1] = json_sink_new(conf, st);
+
+	/* the stream's own connection takes the batch when the extra one
+	 * cannot, so that the client is slowed down by the usual means */
+	if (!sink || b_room(&sink->buf) < (size_t)len)
+		return len;
+
+	json_get_view(filter, chn, len, &v);
+	b_putblk(&sink->buf, v.blk1, v.len1);
+	if (v.len2)
+		b_putblk(&sink->buf, v.blk2, v.len2);
+	json_del_input(chn, FLT_NXT(filter, chn), len);
+
+	si_applet_want_put(sink->appctx->owner);
+	appctx_wakeup(sink->appctx);
+	return 0;
+}
+
 /***************************************************************************
  * Hooks that manage the filter lifecycle (init/check/deinit)
  **************************************************************************/
@@ -150,12 +747,54 @@ json_init(struct proxy *px, struct flt_conf *fconf)
 	else
 		memprintf(&conf->name, "TRACE/%s", px->id);
 	fconf->conf = conf;
+
+	if (posix_memalign((void **)&conf->counters, __alignof__(*conf->counters),
+	                   global.nbthread * sizeof(*conf->counters)) != 0) {
+		conf->counters = NULL;
+		return -1;
+	}
+	memset(conf->counters, 0, global.nbthread * sizeof(*conf->counters));
+
+	if (conf->on_error == JSON_ERR_QUARANTINE) {
+		conf->quarantine = calloc(1, sizeof(*conf->quarantine));
+		if (!conf->quarantine)
+			return -1;
+		HA_SPIN_INIT(&conf->quarantine->lock);
+	}
+
+	if (conf->fanout.be_name) {
+		/* conf->fanout.fe was initialized during the config parsing,
+		 * finish its initialization. */
+		conf->fanout.fe.id = conf->fanout.be_name;
+		conf->fanout.fe.last_change = now.tv_sec;
+		conf->fanout.fe.cap = PR_CAP_FE;
+		conf->fanout.fe.mode = PR_MODE_TCP;
+		conf->fanout.fe.maxconn = 0;
+		conf->fanout.fe.options2 |= PR_O2_INDEPSTR;
+		conf->fanout.fe.conn_retries = CONN_RETRIES;
+		conf->fanout.fe.accept = frontend_accept;
+		conf->fanout.fe.srv = NULL;
+		conf->fanout.fe.timeout.client = TICK_ETERNITY;
+		conf->fanout.fe.fe_req_ana = AN_REQ_SWITCHING_RULES;
+	}
 	TRACE(conf, "filter initialized [version=%s]",
 	      (json_version_str[conf->version])
 	);
 	return 0;
 }
 
+static void
+json_free_preds(struct json_config *conf)
+{
+	struct json_pred *pred, *back;
+
+	list_for_each_entry_safe(pred, back, &conf->preds, list) {
+		LIST_DEL(&pred->list);
+		free(pred->str);
+		free(pred);
+	}
+}
+
 /* Free ressources allocated by the trace filter. */
 static void
 json_deinit(struct proxy *px, struct flt_conf *fconf)
@@ -165,6 +804,14 @@ json_deinit(struct proxy *px, struct flt_conf *fconf)
 	if (conf) {
 		TRACE(conf, "filter deinitialized");
 		free(conf->name);
+		free(conf->fanout.be_name);
+		json_free_preds(conf);
+		json_schema_free(conf->schema);
+		free(conf->counters);
+		if (conf->quarantine) {
+			HA_SPIN_DESTROY(&conf->quarantine->lock);
+			free(conf->quarantine);
+		}
 		free(conf);
 	}
 	fconf->conf = NULL;
@@ -175,8 +822,114 @@ json_deinit(struct proxy *px, struct flt_conf *fconf)
 static int
 json_check(struct proxy *px, struct flt_conf *fconf)
 {
-	if(px->mode != PR_MODE_TCP){
-		ha_alert("json filter can only be used in HTTP mode");
+	struct json_config *conf = fconf->conf;
+	struct flt_conf    *first;
+
+	/* HTTP bodies may not fit in the buffer and are cut by chunk envelopes,
+	 * only the resumable scanner can follow them */
+	if (px->mode == PR_MODE_HTTP &&
+	    (conf->version != JSON_SIMD || conf->fanout.be_name || conf->minify || conf->transcode ||
+	     conf->coalesce.size)) {
+		ha_alert("Proxy %s : json filter in HTTP mode requires the simd mode, without 'fanout', 'minify', 'canonical', 'transcode' nor 'coalesce'.\n",
+			 px->id);
+		return 1;
+	}
+
+	/* the other modes do not validate the records */
+	if (conf->on_error != JSON_ERR_BLOCK &&
+	    ((conf->version != JSON_PARSER && conf->version != JSON_SIMD) || px->mode == PR_MODE_HTTP)) {
+		ha_alert("Proxy %s : json filter 'on-error' requires the default parser or the simd mode, and the TCP mode.\n",
+			 px->id);
+		return 1;
+	}
+
+	/* rewritten records must be valid */
+	if (conf->on_error == JSON_ERR_PASS && (conf->minify || conf->transcode)) {
+		ha_alert("Proxy %s : json filter 'on-error pass' cannot be used with 'minify', 'canonical' nor 'transcode'.\n",
+			 px->id);
+		return 1;
+	}
+
+	/* held records must end on a record boundary */
+	if (conf->coalesce.size) {
+		if (conf->version == JSON_NOOP) {
+			ha_alert("Proxy %s : json filter 'coalesce' is not supported by the noop mode.\n",
+				 px->id);
+			return 1;
+		}
+		if (conf->coalesce.size > (unsigned int)(global.tune.bufsize - global.tune.maxrewrite)) {
+			ha_alert("Proxy %s : json filter 'coalesce' cannot exceed tune.bufsize minus tune.maxrewrite (%d).\n",
+				 px->id, global.tune.bufsize - global.tune.maxrewrite);
+			return 1;
+		}
+	}
+
+	/* the schema is checked by rapidjson while it parses */
+	if (conf->schema && conf->version != JSON_PARSER) {
+		ha_alert("Proxy %s : json filter 'schema' requires the default parser mode.\n",
+			 px->id);
+		return 1;
+	}
+
+	if (!LIST_ISEMPTY(&conf->preds) && conf->version != JSON_PARSER) {
+		ha_alert("Proxy %s : json filter 'drop-if' and 'drop-unless' require the default parser mode.\n",
+			 px->id);
+		return 1;
+	}
+
+	/* minified records must be valid and delimited by the scanner */
+	if (conf->minify &&
+	    ((conf->version != JSON_PARSER && conf->version != JSON_SIMD) || !LIST_ISEMPTY(&conf->preds))) {
+		ha_alert("Proxy %s : json filter 'minify' and 'canonical' require the default parser or the simd mode, without 'drop-if' nor 'drop-unless'.\n",
+			 px->id);
+		return 1;
+	}
+
+	/* records are transcoded by rapidjson while it validates them */
+	if (conf->transcode &&
+	    (conf->version != JSON_PARSER || !LIST_ISEMPTY(&conf->preds) || conf->minify)) {
+		ha_alert("Proxy %s : json filter 'transcode' requires the default parser, without 'drop-if', 'drop-unless', 'minify' nor 'canonical'.\n",
+			 px->id);
+		return 1;
+	}
+
+	/* records are removed from the channel once dropped or moved to an
+	 * extra connection, and change size once rewritten, which is only safe
+	 * when no other filter saw them */
+	first = LIST_NEXT(&px->filter_configs, struct flt_conf *, list);
+	if ((conf->fanout.be_name || !LIST_ISEMPTY(&conf->preds) || conf->minify || conf->transcode ||
+	     conf->on_error == JSON_ERR_DROP || conf->on_error == JSON_ERR_QUARANTINE) && first != fconf) {
+		ha_alert("Proxy %s : json filter with 'fanout', 'drop-if', 'drop-unless', 'minify', 'canonical', 'transcode' or 'on-error drop|quarantine' must be the first declared filter.\n",
+			 px->id);
+		return 1;
+	}
+
+	if (!conf->fanout.be_name)
+		return 0;
+
+	if (conf->version == JSON_NOOP) {
+		ha_alert("Proxy %s : json filter 'fanout' requires a mode that finds record boundaries.\n",
+			 px->id);
+		return 1;
+	}
+
+	conf->fanout.be = proxy_be_by_name(conf->fanout.be_name);
+	if (conf->fanout.be == NULL) {
+		ha_alert("Proxy %s : unknown backend '%s' used by json filter 'fanout'.\n",
+			 px->id, conf->fanout.be_name);
+		return 1;
+	}
+	if (conf->fanout.be->mode != PR_MODE_TCP) {
+		ha_alert("Proxy %s : backend '%s' used by json filter 'fanout' does not support HTTP mode.\n",
+			 px->id, conf->fanout.be->id);
+		return 1;
+	}
+
+	if (!conf->fanout.batch)
+		conf->fanout.batch = global.tune.bufsize / 2;
+	if (conf->fanout.batch > (unsigned int)(global.tune.bufsize - global.tune.maxrewrite)) {
+		ha_alert("Proxy %s : json filter 'fanout-batch' cannot exceed tune.bufsize minus tune.maxrewrite (%d).\n",
+			 px->id, global.tune.bufsize - global.tune.maxrewrite);
 		return 1;
 	}
 	return 0;
@@ -188,6 +941,22 @@ json_init_per_thread(struct proxy *px, struct flt_conf *fconf)
 {
 	struct json_config *conf = fconf->conf;
 
+	/* A record's strings are copied to the parser's arena, and a record
+	 * never spans more than a buffer. Twice that leaves room for the
+	 * allocator's headers and the reader's own stack.
+	 */
+	if (!json_parse_thread_init(2 * global.tune.bufsize)) {
+		ha_alert("Proxy %s : json filter failed to allocate its parser arena for thread %u.\n",
+			 px->id, tid);
+		return -1;
+	}
+	/* records are canonicalized one buffer at a time */
+	if (conf->canonical && !json_canon_thread_init(global.tune.bufsize)) {
+		ha_alert("Proxy %s : json filter failed to allocate its canonicalization stack for thread %u.\n",
+			 px->id, tid);
+		json_parse_thread_deinit();
+		return -1;
+	}
 	TRACE(conf, "filter initialized for thread tid %u", tid);
 	return 0;
 }
@@ -198,6 +967,9 @@ json_deinit_per_thread(struct proxy *px, struct flt_conf *fconf)
 {
 	struct json_config *conf = fconf->conf;
 
+	json_parse_thread_deinit();
+	if (conf && conf->canonical)
+		json_canon_thread_deinit();
 	if (conf)
 		TRACE(conf, "filter deinitialized for thread tid %u", tid);
 }
@@ -210,9 +982,23 @@ static int
 json_attach(struct stream *s, struct filter *filter)
 {
 	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st;
 
 	STRM_TRACE(conf, s, "%-25s: filter-type=%s",
 		   __FUNCTION__, filter_type(filter));
+
+	st = pool_alloc_dirty(pool_head_json_state);
+	if (!st)
+		return -1;
+	json_simd_init(&st->scan);
+	st->failed = 0;
+	st->raw_ofs = 0;
+	st->rec_len = 0;
+	st->fanout_cur = 0;
+	st->coalesce_exp = TICK_ETERNITY;
+	memset(st->sinks, 0, sizeof(st->sinks));
+	filter->ctx = st;
+
 	/* can return 0 here to ignore the filter */
 	return 1;
 }
@@ -223,9 +1009,29 @@ static void
 json_detach(struct stream *s, struct filter *filter)
 {
 	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
+	struct json_sink   *sink;
+	int i;
+
+	STRM_TRACE(conf, s, "%-25s: filter-type=%s records_parsed=%llu records_failed=%llu records_dropped=%llu",
+		   __FUNCTION__, filter_type(filter), JSON_CNT(conf)->records_parsed,
+		   JSON_CNT(conf)->records_failed, JSON_CNT(conf)->records_dropped);
+
+	/* the extra connections send their pending records then close */
+	for (i = 0; i < JSON_FANOUT_MAX_CONNS - 1; i++) {
+		sink = st->sinks[i];
+		if (!sink)
+			continue;
+		if (!sink->appctx) {
+			json_sink_free(sink);
+			continue;
+		}
+		sink->owner = NULL;
+		appctx_wakeup(sink->appctx);
+	}
 
-	STRM_TRACE(conf, s, "%-25s: filter-type=%s records_parsed=%d records_failed=%d",
-		   __FUNCTION__, filter_type(filter), conf->stats_records_parsed, conf->stats_records_failed);
+	pool_free(pool_head_json_state, filter->ctx);
+	filter->ctx = NULL;
 }
 
 /* Called when a stream is created */
@@ -266,10 +1072,14 @@ json_stream_stop(struct stream *s, struct filter *filter)
 static void
 json_check_timeouts(struct stream *s, struct filter *filter)
 {
-	struct json_config *conf = FLT_CONF(filter);
-
-	STRM_TRACE(conf, s, "%-25s",
-		   __FUNCTION__);
+	struct json_state *st = filter->ctx;
+
+	/* the held records must be sent now, or the stream was woken up for
+	 * another timer and they must still wait */
+	if (tick_is_expired(st->coalesce_exp, now_ms))
+		s->pending_events |= TASK_WOKEN_MSG;
+	else if (tick_isset(st->coalesce_exp))
+		json_coalesce_arm(s, st);
 }
 
 /**************************************************************************
@@ -289,6 +1099,14 @@ json_chn_start_analyze(struct stream *s, struct filter *filter,
 	filter->post_analyzers |= (AN_REQ_ALL | AN_RES_ALL);
 	/* only register filter on request channel (incoming) */ 
 	if( !(chn->flags & CF_ISRESP) ){
+		struct json_state *st = filter->ctx;
+
+		/* FLT_NXT was just reset, so must be the scanner state and
+		 * the resume offsets */
+		json_simd_init(&st->scan);
+		st->failed = 0;
+		st->raw_ofs = 0;
+		st->rec_len = 0;
 		register_data_filter(s, chn, filter);
 	}
 	return 1;
@@ -381,113 +1199,543 @@ json_chn_end_analyze(struct stream *s, struct filter *filter,
 	STRM_TRACE(conf, s, "%-25s: channel=%-10s - mode=%-5s (%s)",
 		   __FUNCTION__,
 		   channel_label(chn), proxy_mode(s), stream_pos(s));
+	if (!(chn->flags & CF_ISRESP))
+		((struct json_state *)filter->ctx)->rec_len = 0;
 	unregister_data_filter(s, chn, filter);
 	return 1;
 }
 
 /**************************************************************************
- * Hooks to filter TCP data
+ * Hooks to filter HTTP messages
  *************************************************************************/
+/* Called when the headers of a message were parsed. The body of each request
+ * of a keep-alive connection is validated from scratch. */
 static int
-json_tcp_data_parser(struct stream *s, struct filter *filter, struct channel *chn)
+json_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
 {
-	struct json_config *conf = FLT_CONF(filter);
-	int                  avail = ci_data(chn) - FLT_NXT(filter, chn);
-	int                  ret  = avail;
-	int left;
+	struct json_state *st = filter->ctx;
 
-	if(avail == 0){
-		return 0;
+	if (!(msg->chn->flags & CF_ISRESP)) {
+		json_simd_init(&st->scan);
+		st->failed = 0;
 	}
+	return 1;
+}
 
-	left = ci_contig_data(chn);
-	/*STRM_TRACE(conf, s, "%-25s: START channel=%-10s - mode=%-5s (%s) - next=%u - avail=%u",*/
-		   /*__FUNCTION__,*/
-		   /*channel_label(chn), proxy_mode(s), stream_pos(s),*/
-		   /*FLT_NXT(filter, chn), avail);*/
-
-	/* handle wrapped buffer */
-	char* parse_start = ci_head(chn) + FLT_NXT(filter, chn);
-	char* origin =  c_orig(chn);
-	char* buffer_end = parse_start + left;  //the first byte after the last valid byte in the buffer
-	char* parse_end; //should be the last character to parse
-	char* parsed_til;
-	if(unlikely(left < avail)){
-		parse_end = c_orig(chn) + (avail-left) - 1;
-		JSON_PARSE_TRACE("wrapped parse end: %p \n", parse_end);
-		//guaranteed to be non zero because of above
-	} else {
-		parse_end = parse_start + (left) - 1;
-		JSON_PARSE_TRACE("unwrapped parse end: %p \n", parse_end);
-	}
+/* Checks that the body ends between two records. Returns -1 if it does not,
+ * so that the request is rejected, otherwise 1.
+ */
+static int
+json_http_end_body(struct filter *filter)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
 
-	int parsed_records = 0;
-	int failed_records = 0;
-	ret = 0;
-	while(parse_start != parse_end){
-		JSON_PARSE_TRACE("parsing json\n");
-		json_passed_t r = json_parse_wrap(origin, parse_start, parse_end, buffer_end, &parsed_til);
-		if(r == JSON_PASS){
-			//move up the pointer because we successfully parsed a record
-			int change;
-			if(unlikely( parsed_til < parse_start )){
-				/* wrapped */
-				change = (buffer_end - parse_start) + (parsed_til - origin);
-			} else {
-				change = (parsed_til - parse_start); 
-			}
-			ret += change;
-			JSON_PARSE_TRACE("success, ret += %ld\n", (change));
-			JSON_PARSE_TRACE("parsed_til: %p (%d)\n", parsed_til, *parsed_til);
-			parse_start = parsed_til;
-			parsed_records++;
-		} else {
-			JSON_PARSE_TRACE("json parse failed at: %p\n", parsed_til);
-			failed_records++;
-			/* on a failed record, we don't move the ret up, we have to reparse */
-			break;
-		}
-	}
-	if(unlikely(parsed_til == parse_end)){
-		/* in the unlikely case we parsed the entire buffer, parsed_til points
-		 * at the final byte parsed */
-		JSON_PARSE_TRACE("parsed entire buffer, ret +=1\n");
-		ret += 1;
+	if (json_simd_end(&st->scan) == JSON_FAIL) {
+		JSON_CNT(conf)->records_failed++;
+		st->failed = 1;
+		return -1;
 	}
-	/* forward through remaining whitespace, TODO support wrapping */
-	/*while(ret < left && *parse_start == '\n'){*/
-		/*parse_start++;*/
-		/*ret++;*/
-	/*}*/
+	JSON_CNT(conf)->records_parsed += st->scan.records;
+	st->scan.records = 0;
+	return 1;
+}
+
+/* Validates the body with the resumable scanner. The whole chunk data must
+ * be consumed before the next chunk is parsed, so everything that was scanned
+ * is consumed and a scalar cut at the end of a chunk is saved in the scanner
+ * state. The request is rejected with a 400 as soon as invalid JSON is found.
+ */
+static int
+json_http_data(struct stream *s, struct filter *filter, struct http_msg *msg)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
+	struct channel     *chn = msg->chn;
+	unsigned long long  end = msg->chunk_len + msg->next;
+	int                 avail = MIN(end, ci_data(chn)) - FLT_NXT(filter, chn);
+	struct json_view    v;
+	unsigned long long  start = json_now_ns();
+	int                 ret;
+
+	if (st->failed)
+		return -1;
+
+	json_get_view(filter, chn, avail, &v);
+	if (json_simd_scan(&st->scan, &v) == JSON_FAIL)
+		goto fail;
+
+	/* the chunk data end here, the scalar continues after the envelope */
+	if (end <= ci_data(chn) && !json_simd_suspend(&st->scan, &v))
+		goto fail;
+	ret = st->scan.scanned;
+	json_simd_consume(&st->scan, ret);
+
+	JSON_CNT(conf)->records_parsed += st->scan.records;
+	st->scan.records = 0;
+	json_count_call(conf, avail, start);
 
 #ifdef FILTER_TRACE
-	STRM_TRACE(conf, s, "%-25s: channel=%-10s - mode=%-5s (%s) - next=%u - avail=%u - consume=%d - records_parsed=%d - records_failed=%d",
+	STRM_TRACE(conf, s, "%-25s: channel=%-10s - mode=%-5s (%s) - chunk_len=%llu - next=%u - avail=%d - consume=%d",
 		   __FUNCTION__,
 		   channel_label(chn), proxy_mode(s), stream_pos(s),
-		   FLT_NXT(filter, chn), avail, ret,
-		   parsed_records, failed_records);
+		   msg->chunk_len, FLT_NXT(filter, chn), avail, ret);
 #endif
-	conf->stats_records_parsed += parsed_records;
-	conf->stats_records_failed += failed_records;
 
-	if (ret != avail)
-		task_wakeup(s->task, TASK_WOKEN_MSG);
+	/* the end of chunked bodies is only known once the trailers come */
+	if (!(msg->flags & HTTP_MSGF_TE_CHNK) && (msg->flags & HTTP_MSGF_XFER_LEN) &&
+	    FLT_NXT(filter, chn) + ret == end && json_http_end_body(filter) < 0)
+		return -1;
 	return ret;
+
+  fail:
+	JSON_PARSE_TRACE("json http scan failed at: %lu\n", st->scan.error);
+	JSON_CNT(conf)->records_failed++;
+	json_count_call(conf, avail, start);
+	st->failed = 1;
+	return -1;
 }
 
+/* Called when the last chunk of a chunked body was received */
 static int
-json_tcp_data_newline(struct stream *s, struct filter *filter, struct channel *chn)
+json_http_chunk_trailers(struct stream *s, struct filter *filter, struct http_msg *msg)
 {
-	struct json_config *conf = FLT_CONF(filter);
-	int                  avail = ci_data(chn) - FLT_NXT(filter, chn);
+	return json_http_end_body(filter);
+}
+
+static int
+json_http_forward_data(struct stream *s, struct filter *filter, struct http_msg *msg,
+		       unsigned int len)
+{
+	return len;
+}
+
+/**************************************************************************
+ * Hooks to filter TCP data
+ *************************************************************************/
+/* Returns how many of the <len> first bytes of input the scanner may look at.
+ * When records are fanned out, they are only looked at up to the last newline,
+ * so that each batch ends with one. Otherwise the next record sent on the same
+ * connection would be glued to the last one of the batch. The end of the input
+ * is trusted once it is closed.
+ */
+static inline int
+json_scan_limit(struct filter *filter, struct channel *chn, int len, int avail)
+{
+	struct json_config *conf = FLT_CONF(filter);
+
+	if (conf->fanout.be && (len < avail || !(chn->flags & CF_SHUTR))) {
+		while (len && *b_peek(&chn->buf, co_data(chn) + FLT_NXT(filter, chn) + len - 1) != '\n')
+			len--;
+	}
+	return len;
+}
+
+/* Runs the resumable scanner over the <avail> bytes of input. When records
+ * are fanned out, only one batch is scanned first so that the end of the last
+ * complete record falls within the batch.
+ */
+static json_passed_t
+json_scan(struct filter *filter, struct channel *chn, struct json_state *st, int avail)
+{
+	struct json_view v;
+	json_passed_t    ret;
+	int              len = json_fanout_window(FLT_CONF(filter), chn, avail);
+
+	if (len < avail) {
+		len = json_scan_limit(filter, chn, len, avail);
+		if (st->scan.scanned < (size_t)len) {
+			json_get_view(filter, chn, len, &v);
+			ret = json_simd_scan(&st->scan, &v);
+			if (ret == JSON_FAIL || st->scan.done)
+				return ret;
+			/* the record is larger than a batch */
+		}
+	}
+	len = json_scan_limit(filter, chn, avail, avail);
+	json_get_view(filter, chn, len, &v);
+	ret = json_simd_scan(&st->scan, &v);
+	if (ret != JSON_FAIL && !st->scan.done && len < avail &&
+	    channel_full(chn, global.tune.maxrewrite)) {
+		/* a single record fills the buffer, its separator cannot be
+		 * received */
+		json_get_view(filter, chn, avail, &v);
+		ret = json_simd_scan(&st->scan, &v);
+	}
+	return ret;
+}
+
+/* Rewrites the <len> first bytes of input, which are complete and valid
+ * records, without their insignificant whitespaces, and with the members of
+ * their objects sorted by key if "canonical" is set. The bounds <rec> and
+ * <rec_end> of a record are updated to its new ones. Returns the new length.
+ */
+static int
+json_minify_input(struct filter *filter, struct channel *chn, int len, size_t *rec, size_t *rec_end)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct buffer      *tmp = get_trash_chunk();
+	struct json_view    v;
+	size_t n, start, end;
+
+	/* sorting the members keeps the length of each record, and the
+	 * minified text does not depend on where it is cut between records */
+	json_get_view(filter, chn, len, &v);
+	start = json_minify(&v, 0, *rec, tmp->area);
+	end = start + json_minify(&v, *rec, *rec_end, tmp->area + start);
+	n = end + json_minify(&v, *rec_end, len, tmp->area + end);
+	*rec = start;
+	*rec_end = end;
+	if (conf->canonical) {
+		struct buffer *tmp2 = get_trash_chunk();
+
+		n = json_canonicalize(tmp->area, n, tmp2->area);
+		tmp = tmp2;
+	}
+
+	json_replace_input(chn, FLT_NXT(filter, chn), len, tmp->area, n);
+	return n;
+}
+
+/* Remembers the record found between <rec> and <rec_end> in the <len> bytes
+ * about to be added to the validated input, for the json.path fetches. When
+ * none ends there, the previous one is kept as long as it may still be in the
+ * buffer. A record of length zero tells that the last one is not known.
+ */
+static inline void
+json_keep_record(struct json_state *st, int len, size_t rec, size_t rec_end)
+{
+	if (rec_end) {
+		st->rec_len = rec_end - rec;
+		st->rec_tail = len - rec_end;
+	}
+	else if (st->rec_len) {
+		st->rec_tail += len;
+		if (st->rec_tail >= global.tune.bufsize)
+			st->rec_len = 0;
+	}
+}
+
+/* Forwards the <len> bytes of complete records found at the beginning of the
+ * input data of <chn> once rewritten as configured, and moves them to the
+ * extra connections if any. <enc> is their transcoded form if any, produced
+ * while they were validated. <avail> is the amount of input data not analyzed
+ * yet. Returns the number of bytes to forward.
+ */
+static int
+json_forward(struct stream *s, struct filter *filter, struct channel *chn, int len, int avail,
+             const struct buffer *enc)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
+	size_t              rec = st->scan.last, rec_end = st->scan.last_end;
+	int                 out = len;
+
+	/* rapidjson may have stopped before the last record indexed */
+	if (rec_end > (size_t)len)
+		rec = rec_end = len;
+
+	if (enc && len > 0) {
+		/* the records are not JSON anymore */
+		json_replace_input(chn, FLT_NXT(filter, chn), len, enc->area, enc->data);
+		out = enc->data;
+		rec = rec_end = out;
+	}
+	json_simd_consume(&st->scan, len);
+	if (conf->minify && len > 0)
+		out = json_minify_input(filter, chn, len, &rec, &rec_end);
+	avail -= len - out;
+
+	if (conf->fanout.be && out > 0)
+		out = json_fanout(s, filter, chn, out, avail);
+	if (out > 0)
+		json_keep_record(st, out, rec, rec_end);
+	return out;
+}
+
+static int
+json_tcp_data_parser(struct stream *s, struct filter *filter, struct channel *chn)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
+	int                  avail = ci_data(chn) - FLT_NXT(filter, chn);
+	int                  ret;
+	char *origin, *buffer_end, *start, *parse_start, *parse_end, *parsed_til;
+	unsigned long long call_start = json_now_ns();
+	unsigned int i;
+	size_t from = 0, passed = 0, counted = 0;
+	int parsed_records = 0;
+	int failed_records = 0;
+	struct json_enc enc, *encp = NULL;
+	struct buffer *tmp = NULL;
+	char *mark;
+	int full = 0;
+
+	if(avail == 0){
+		return 0;
+	}
+	/* the invalid record found during the previous call starts the input */
+	if(st->failed && !json_handle_invalid(s, filter, chn, 0, &avail)){
+		return 0;
+	}
+
+	/* records are transcoded by rapidjson while it validates them */
+	if(conf->transcode){
+		tmp = get_trash_chunk();
+		json_enc_init(&enc, tmp->area, tmp->size, conf->transcode);
+		encp = &enc;
+	}
+
+	/* Rapidjson cannot be suspended in the middle of a record, so the
+	 * record boundaries are first found by the resumable scanner, which
+	 * only looks at the bytes received since the last call. Rapidjson then
+	 * only sees complete records and never reparses a partial one.
+	 * Rapidjson starts at <from>, after the records it already parsed.
+	 * An invalid record kept by "on-error pass" stays in the input, so
+	 * rapidjson stops before it and goes on after it, at <passed>. The
+	 * invalid records before <counted> were already counted. */
+ rescan:
+	passed = 0;
+	while(json_scan(filter, chn, st, avail) == JSON_FAIL){
+		JSON_PARSE_TRACE("json scan failed at: %lu\n", st->scan.error);
+		ret = st->scan.done;
+		if((size_t)ret >= counted)
+			failed_records++;
+		if(!json_handle_invalid(s, filter, chn, ret, &avail))
+			break;
+		if(st->scan.done != (size_t)ret){
+			passed = counted = st->scan.done;
+			break;
+		}
+	}
+	if(!passed)
+		ret = st->scan.done;
+	if(ret == (int)from)
+		goto next;
+
+	/* handle wrapped buffer, parse_end is the last byte to parse */
+	origin = b_orig(&chn->buf);
+	buffer_end = b_wrap(&chn->buf);
+	start = parse_start = b_peek(&chn->buf, co_data(chn) + FLT_NXT(filter, chn) + from);
+	parse_end = b_peek(&chn->buf, co_data(chn) + FLT_NXT(filter, chn) + ret - 1);
+
+	/* the scanner tells how many records there are, anything after the
+	 * last one is whitespace */
+	for(i = 0; i < st->scan.records; i++){
+		JSON_PARSE_TRACE("parsing json\n");
+		mark = encp ? enc.o : NULL;
+		if(json_parse_wrap(origin, parse_start, parse_end, buffer_end, &parsed_til, conf->schema, encp) == JSON_FAIL){
+			if(encp && enc.full){
+				/* it is valid so far but does not fit */
+				ret = from + b_dist(&chn->buf, start, parse_start);
+				full = 1;
+				passed = 0;
+				break;
+			}
+			JSON_PARSE_TRACE("json parse failed at: %p\n", parse_start);
+			failed_records++;
+			ret = from + b_dist(&chn->buf, start, parse_start);
+			if(json_handle_invalid(s, filter, chn, ret, &avail)){
+				from = st->scan.done;
+				st->scan.records = 0;
+				goto rescan;
+			}
+			passed = 0;
+			break;
+		}
+		JSON_PARSE_TRACE("parsed_til: %p (%d)\n", parsed_til, *parsed_til);
+		/* the encoded records replace the input, they may not need more
+		 * than the room left in the buffer */
+		if(encp && (size_t)(enc.o - enc.start) >
+		   from + b_dist(&chn->buf, start, parsed_til) + b_room(&chn->buf)){
+			enc.o = mark;
+			ret = from + b_dist(&chn->buf, start, parse_start);
+			full = 1;
+			passed = 0;
+			break;
+		}
+		parse_start = parsed_til;
+		parsed_records++;
+	}
+
+ next:
+	/* go on with the records following the passed one */
+	if(passed){
+		from = passed;
+		st->scan.records = 0;
+		goto rescan;
+	}
+
+#ifdef FILTER_TRACE
+	STRM_TRACE(conf, s, "%-25s: channel=%-10s - mode=%-5s (%s) - next=%u - avail=%u - consume=%d - records_parsed=%d - records_failed=%d",
+		   __FUNCTION__,
+		   channel_label(chn), proxy_mode(s), stream_pos(s),
+		   FLT_NXT(filter, chn), avail, ret,
+		   parsed_records, failed_records);
+#endif
+	JSON_CNT(conf)->records_parsed += parsed_records;
+	JSON_CNT(conf)->records_failed += failed_records;
+
+	/* the partial record is kept in the scanner state, there is nothing
+	 * to do until more data arrive */
+	st->scan.records = 0;
+	if(full){
+		/* the room cannot grow anymore when there is no output data
+		 * left to leave the buffer, the record will never fit */
+		if(enc.o == enc.start && !co_data(chn) && !FLT_NXT(filter, chn)){
+			st->failed = 1;
+			JSON_CNT(conf)->records_failed++;
+		}
+	}
+	if(encp)
+		tmp->data = enc.o - enc.start;
+	ret = json_forward(s, filter, chn, ret, avail, tmp);
+	/* the records which did not fit are scanned again once the output
+	 * left */
+	if(full)
+		json_simd_init(&st->scan);
+	json_count_call(conf, avail, call_start);
+	return ret;
+}
+
+/* Returns non-zero if the record found between <from> and <to> in view <v>
+ * passes all the raw predicates of <conf>.
+ */
+static inline int
+json_raw_match(const struct json_config *conf, const struct json_view *v, size_t from, size_t to)
+{
+	struct json_pred *pred;
+
+	list_for_each_entry(pred, &conf->preds, list) {
+		if (json_raw_contains(v, from, to, pred->str, pred->len) == pred->drop_if)
+			return 0;
+	}
+	return 1;
+}
+
+/* Parser mode with raw predicates, as done by Sparser: records are delimited
+ * by newlines, and each of them must pass the predicates before being fully
+ * parsed. Records which do not are removed from the channel, so that most of
+ * the input never reaches rapidjson when the predicates are selective.
+ */
+static int
+json_tcp_data_raw(struct stream *s, struct filter *filter, struct channel *chn)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
+	int                  avail = ci_data(chn) - FLT_NXT(filter, chn);
+	struct json_view     v;
+	size_t rd, wr, eol, len, from;
+	size_t rec = 0, rec_end = 0;
+	char *origin, *buffer_end, *parsed_til;
+	unsigned long long start = json_now_ns();
+	int parsed_records = 0;
+	int failed_records = 0;
+	int dropped_records = 0;
+
+	if(avail == 0 || st->failed){
+		return 0;
+	}
+
+	origin = b_orig(&chn->buf);
+	buffer_end = b_wrap(&chn->buf);
+	json_get_view(filter, chn, avail, &v);
+
+	/* <rd> is the beginning of the next record to look at, <wr> is where
+	 * it goes once the dropped ones before it are removed */
+	rd = wr = 0;
+	len = json_fanout_window(conf, chn, avail);
+	while (rd < len) {
+		from = rd + st->raw_ofs;
+		eol = json_view_chr(&v, from, avail, '\n');
+		if (eol == (size_t)avail) {
+			if (!(chn->flags & CF_SHUTR)) {
+				/* wait for the end of the record */
+				st->raw_ofs = avail - rd;
+				break;
+			}
+			/* the last record has no newline */
+			eol = avail - 1;
+		}
+		st->raw_ofs = 0;
+
+		for (from = rd; from <= eol && isspace((unsigned char)json_view_byte(&v, from)); from++)
+			;
+		/* blank lines are kept as they are */
+		if (from <= eol) {
+			if (!json_raw_match(conf, &v, rd, eol + 1)) {
+				dropped_records++;
+				rd = eol + 1;
+				continue;
+			}
+			if (json_parse_wrap(origin, b_peek(&chn->buf, co_data(chn) + FLT_NXT(filter, chn) + rd),
+			                    b_peek(&chn->buf, co_data(chn) + FLT_NXT(filter, chn) + eol),
+			                    buffer_end, &parsed_til, conf->schema, NULL) == JSON_FAIL) {
+				JSON_PARSE_TRACE("json parse failed at: %lu\n", rd);
+				failed_records++;
+				if (conf->on_error == JSON_ERR_BLOCK) {
+					st->failed = 1;
+					break;
+				}
+				if (conf->on_error != JSON_ERR_PASS) {
+					if (conf->on_error == JSON_ERR_QUARANTINE)
+						json_quarantine(conf, s, &v, rd, eol + 1);
+					rd = eol + 1;
+					continue;
+				}
+			}
+			else {
+				parsed_records++;
+				/* where it goes once the dropped ones are removed */
+				rec = wr;
+				rec_end = wr + eol + 1 - rd;
+			}
+		}
+
+		if (wr != rd)
+			json_move_input(chn, FLT_NXT(filter, chn) + wr, FLT_NXT(filter, chn) + rd, eol + 1 - rd);
+		wr += eol + 1 - rd;
+		rd = eol + 1;
+	}
+
+	if (wr != rd) {
+		/* remove the dropped records at once */
+		json_del_input(chn, FLT_NXT(filter, chn) + wr, rd - wr);
+		avail -= rd - wr;
+	}
+
+#ifdef FILTER_TRACE
+	STRM_TRACE(conf, s, "%-25s: channel=%-10s - mode=%-5s (%s) - next=%u - avail=%u - consume=%lu - records_parsed=%d - records_failed=%d - records_dropped=%d",
+		   __FUNCTION__,
+		   channel_label(chn), proxy_mode(s), stream_pos(s),
+		   FLT_NXT(filter, chn), avail, wr,
+		   parsed_records, failed_records, dropped_records);
+#endif
+	JSON_CNT(conf)->records_parsed += parsed_records;
+	JSON_CNT(conf)->records_failed += failed_records;
+	JSON_CNT(conf)->records_dropped += dropped_records;
+	json_count_call(conf, avail + rd - wr, start);
+
+	if(conf->fanout.be && wr > 0)
+		wr = json_fanout(s, filter, chn, wr, avail);
+	if(wr > 0)
+		json_keep_record(st, wr, rec, rec_end);
+	return wr;
+}
+
+static int
+json_tcp_data_newline(struct stream *s, struct filter *filter, struct channel *chn)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	int                  avail = ci_data(chn) - FLT_NXT(filter, chn);
 	int                  ret  = avail;
-	int left;
+	unsigned long long   call_start = json_now_ns();
+	int left, len;
 
 	if(avail == 0){
 		return 0;
 	}
 
-	left = ci_contig_data(chn);
 #ifdef FILTER_TRACE
 	STRM_TRACE(conf, s, "%-25s: channel=%-10s - mode=%-5s (%s) - next=%u - avail=%u",
 		   __FUNCTION__,
@@ -495,6 +1743,13 @@ json_tcp_data_newline(struct stream *s, struct filter *filter, struct channel *c
 		   FLT_NXT(filter, chn), avail);
 #endif
 
+	/* with fan-out, only look for the end of one batch first */
+	len = json_fanout_window(conf, chn, avail);
+ rescan:
+	left = ci_contig_data(chn);
+	if(left > len)
+		left = len;
+
 	char *start;
 	int parsed_records = 0;
 	/* scan for a newline record delimeter */
@@ -508,10 +1763,10 @@ json_tcp_data_newline(struct stream *s, struct filter *filter, struct channel *c
 		}
 	}
 
-	if(unlikely(left < avail)){
+	if(unlikely(left < len)){
 		/* more data than is contiguous, so wrap and and continue scanning */
 		start = c_orig(chn);
-		for(int i = 0; i<(avail-left); i++){
+		for(int i = 0; i<(len-left); i++){
 			if(start[i] == '\n'){
 				ret = left+i+1;
 				parsed_records++;
@@ -519,8 +1774,16 @@ json_tcp_data_newline(struct stream *s, struct filter *filter, struct channel *c
 			}
 		}
 	}
-	conf->stats_records_parsed += parsed_records;
+	if(ret == 0 && len < avail){
+		/* the record is larger than a batch */
+		len = avail;
+		goto rescan;
+	}
+	JSON_CNT(conf)->records_parsed += parsed_records;
+	json_count_call(conf, len, call_start);
 
+	if(conf->fanout.be && ret > 0)
+		return json_fanout(s, filter, chn, ret, avail);
 	if (ret != avail)
 		task_wakeup(s->task, TASK_WOKEN_MSG);
 	return ret;
@@ -528,11 +1791,16 @@ json_tcp_data_newline(struct stream *s, struct filter *filter, struct channel *c
 static int
 json_tcp_data_newline_simd(struct stream *s, struct filter *filter, struct channel *chn)
 {
-	/* scan for a newline record delimeter using simd */
+	/* find the record delimiters with the vectorized splitter, which
+	 * covers both parts of a wrapping buffer in a single call */
 	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
 	int                  avail = ci_data(chn) - FLT_NXT(filter, chn);
-	int                  ret  = avail;
-	int left;
+	struct json_view     v;
+	unsigned int         records = 0;
+	size_t               end = 0;
+	unsigned long long   start = json_now_ns();
+	int                  ret, len;
 
 	if(avail == 0){
 		return 0;
@@ -545,80 +1813,22 @@ json_tcp_data_newline_simd(struct stream *s, struct filter *filter, struct chann
 		   FLT_NXT(filter, chn), avail);
 #endif
 
-	char *start, *end;
-	int parsed_records = 0;
-	ret = 0;
-
-	/* first from the start of the data in the buffer */
-	start = ci_head(chn) + FLT_NXT(filter, chn);
-	left = ci_contig_data(chn);
-	end = start + left;
-	JSON_PARSE_TRACE("newline search: start= %p (%d), end= %p (%d) \n", start, *start, end, *end);
-
-	while(start < end){
-		JSON_PARSE_TRACE("memchr(start=%p(%d), ..., left=%d)\n", start, *start, left);
-		char* simd_ret = memchr(start, (int)'\n', left);
-		if(simd_ret != NULL){
-			/* found occurrence */
-			simd_ret += 1; //move up to the next byte to look at, helps with math below
-			size_t change = (simd_ret-start);
-			JSON_PARSE_TRACE("found occurrence at: %p (%d)\n", simd_ret, *simd_ret);
-
-			JSON_PARSE_TRACE("ret += %d\n", change);
-			ret += change;
-			parsed_records ++;
-
-			/* reduce left and move start up */
-			left -= (simd_ret - start);
-			start = simd_ret; /* if this goes past end it never gets dereferenced */
-		} else {
-			break;
-		}
-	}
-	/* check wrap remainder */
-	int wrap_remainder = end-start;
-	JSON_PARSE_TRACE("wrap remainder: %d\n", wrap_remainder);
-
-	if(unlikely(ci_contig_data(chn) < avail)){
-		/* more data than is contiguous, so wrap and and continue scanning */
-		start = c_orig(chn);
-		left = avail - ci_contig_data(chn);
-		end = start + left;
-		JSON_PARSE_TRACE("newline search wrapped: start= %p (%d), end= %p (%d), left=%d \n", start, *start, end, *end, left);
-
-		while(start != end){
-			JSON_PARSE_TRACE("memchr(start=%p(%d), ..., left=%d)\n", start, *start, left);
-			char* simd_ret = memchr(start, (int)'\n', left);
-			if(simd_ret != NULL){
-				/* found occurrence */
-				simd_ret += 1; //move up to the next byte to look at, helps with math below
-				size_t change = (simd_ret-start);
-				JSON_PARSE_TRACE("found occurrence at: %p (%d)\n", simd_ret, *simd_ret);
-
-				if(unlikely(wrap_remainder)>0){
-					change += wrap_remainder;
-					wrap_remainder = 0;
-				}
-				JSON_PARSE_TRACE("ret += %lu\n", change);
-				ret += change;
-				parsed_records ++;
-
-				/* reduce left and move start up */
-				left -= (simd_ret - start);
-				start = simd_ret; /* if this goes past end it never gets dereferenced */
-			} else {
-				break;
-			}
-		}
-		/*for(int i = 0; i<(avail-left); i++){*/
-			/*if(start[i] == '\n'){*/
-				/*ret = left+i+1;*/
-				/*parsed_records++;*/
-				/*//break; [> allow one record at a time through <]*/
-			/*}*/
-		/*}*/
+	json_get_view(filter, chn, avail, &v);
+
+	/* the first <raw_ofs> bytes were already searched during a previous
+	 * call. With fan-out, only look for the end of one batch first. */
+	len = json_fanout_window(conf, chn, avail);
+	if(st->raw_ofs < (unsigned int)len)
+		records = json_split_lines(&v, st->raw_ofs, len, &end);
+	if(records == 0 && len < avail){
+		/* the record is larger than a batch */
+		records = json_split_lines(&v, MAX(st->raw_ofs, (unsigned int)len), avail, &end);
+		len = avail;
 	}
-	conf->stats_records_parsed += parsed_records;
+	ret = records ? end : 0;
+	st->raw_ofs = len - ret;
+	JSON_CNT(conf)->records_parsed += records;
+	json_count_call(conf, len, start);
 
 #ifdef FILTER_TRACE
 	STRM_TRACE(conf, s, "%-25s: DONE channel=%-10s - mode=%-5s (%s) - next=%u - avail=%u - ret=%d",
@@ -627,10 +1837,57 @@ json_tcp_data_newline_simd(struct stream *s, struct filter *filter, struct chann
 		   FLT_NXT(filter, chn), avail, ret);
 #endif
 
+	if(conf->fanout.be && ret > 0)
+		return json_fanout(s, filter, chn, ret, avail);
 	if (ret != avail)
 		task_wakeup(s->task, TASK_WOKEN_MSG);
 	return ret;
 }
+static int
+json_tcp_data_simd(struct stream *s, struct filter *filter, struct channel *chn)
+{
+	/* validate records from a structural index built over the two
+	 * contiguous parts of the buffer */
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
+	int                  avail = ci_data(chn) - FLT_NXT(filter, chn);
+	unsigned long long   start = json_now_ns();
+	int                  ret;
+	int failed_records = 0;
+
+	if(avail == 0){
+		return 0;
+	}
+	/* the invalid record found during the previous call starts the input */
+	if(st->failed && !json_handle_invalid(s, filter, chn, 0, &avail)){
+		return 0;
+	}
+
+	/* the scanner resumes where the previous call stopped */
+	while(json_scan(filter, chn, st, avail) == JSON_FAIL){
+		JSON_PARSE_TRACE("json simd scan failed at: %lu\n", st->scan.error);
+		failed_records++;
+		if(!json_handle_invalid(s, filter, chn, st->scan.done, &avail))
+			break;
+	}
+	ret = st->scan.done;
+
+#ifdef FILTER_TRACE
+	STRM_TRACE(conf, s, "%-25s: channel=%-10s - mode=%-5s (%s) - next=%u - avail=%u - consume=%d - records_parsed=%u - records_failed=%d",
+		   __FUNCTION__,
+		   channel_label(chn), proxy_mode(s), stream_pos(s),
+		   FLT_NXT(filter, chn), avail, ret,
+		   st->scan.records, failed_records);
+#endif
+	JSON_CNT(conf)->records_parsed += st->scan.records;
+	JSON_CNT(conf)->records_failed += failed_records;
+
+	st->scan.records = 0;
+	ret = json_forward(s, filter, chn, ret, avail, NULL);
+	json_count_call(conf, avail, start);
+	return ret;
+}
+
 static int
 json_tcp_data_noop(struct stream *s, struct filter *filter, struct channel *chn)
 {
@@ -646,9 +1903,27 @@ static int
 json_tcp_forward_data(struct stream *s, struct filter *filter, struct channel *chn,
 		 unsigned int len)
 {
-	/*struct json_config *conf = FLT_CONF(filter);*/
+	struct json_config *conf = FLT_CONF(filter);
+	struct json_state  *st = filter->ctx;
 	int                  ret  = len;
 
+	/* Complete records sent to the server are held until there are enough
+	 * of them, or until the first one was held long enough, then they are
+	 * released at once. They cannot be held anymore once no more data may
+	 * come, or when no more data fit in the buffer.
+	 */
+	if (conf->coalesce.size && !(chn->flags & CF_ISRESP) && len) {
+		if (len < conf->coalesce.size && !(chn->flags & CF_SHUTR) &&
+		    !channel_full(chn, global.tune.maxrewrite) &&
+		    !tick_is_expired(st->coalesce_exp, now_ms)) {
+			if (!tick_isset(st->coalesce_exp))
+				st->coalesce_exp = tick_add(now_ms, conf->coalesce.delay);
+			json_coalesce_arm(s, st);
+			return 0;
+		}
+		st->coalesce_exp = TICK_ETERNITY;
+	}
+
 	/*STRM_TRACE(conf, s, "%-25s: channel=%-10s - mode=%-5s (%s) - len=%u - fwd=%u - forward=%d",*/
 		   /*__FUNCTION__,*/
 		   /*channel_label(chn), proxy_mode(s), stream_pos(s), len,*/
@@ -668,34 +1943,103 @@ json_tcp_forward_data(struct stream *s, struct filter *filter, struct channel *c
 /********************************************************************
  * Functions that manage the filter initialization
  ********************************************************************/
-struct flt_ops json_ops = {
-	/* Manage trace filter, called for each filter declaration */
-	.init              = json_init,
-	.deinit            = json_deinit,
-	.check             = json_check,
-	.init_per_thread   = json_init_per_thread,
-	.deinit_per_thread = json_deinit_per_thread,
-
-	/* Handle start/stop of streams */
-	.attach             = json_attach,
-	.detach             = json_detach,
-	.stream_start       = json_stream_start,
-	.stream_set_backend = json_stream_set_backend,
-	.stream_stop        = json_stream_stop,
-	.check_timeouts     = json_check_timeouts,
-
-	/* Handle channels activity */
-	/* start and end needed to (un)register data filter */
-	.channel_start_analyze = json_chn_start_analyze,
-	/*.channel_pre_analyze   = json_chn_analyze,*/
-	/*.channel_post_analyze  = json_chn_analyze,*/
-	.channel_end_analyze   = json_chn_end_analyze,
-
-	/* Filter TCP data */
-	.tcp_data         = json_tcp_data_parser,
-	.tcp_forward_data = json_tcp_forward_data,
+/* The callbacks common to all modes, <data_cb> being the one looking at TCP
+ * data. There is one table per mode, so that the mode is set for each filter
+ * instance and is known without any further test once the data callback is
+ * called.
+ */
+#define JSON_FLT_OPS(data_cb) {						\
+	/* Manage trace filter, called for each filter declaration */	\
+	.init              = json_init,					\
+	.deinit            = json_deinit,				\
+	.check             = json_check,				\
+	.init_per_thread   = json_init_per_thread,			\
+	.deinit_per_thread = json_deinit_per_thread,			\
+									\
+	/* Handle start/stop of streams */				\
+	.attach             = json_attach,				\
+	.detach             = json_detach,				\
+	.stream_start       = json_stream_start,			\
+	.stream_set_backend = json_stream_set_backend,			\
+	.stream_stop        = json_stream_stop,				\
+	.check_timeouts     = json_check_timeouts,			\
+									\
+	/* Handle channels activity */					\
+	/* start and end needed to (un)register data filter */		\
+	.channel_start_analyze = json_chn_start_analyze,		\
+	.channel_end_analyze   = json_chn_end_analyze,			\
+									\
+	/* Filter HTTP bodies */					\
+	.http_headers        = json_http_headers,			\
+	.http_data           = json_http_data,				\
+	.http_chunk_trailers = json_http_chunk_trailers,		\
+	.http_forward_data   = json_http_forward_data,			\
+									\
+	/* Filter TCP data */						\
+	.tcp_data         = data_cb,					\
+	.tcp_forward_data = json_tcp_forward_data,			\
+}
+
+static struct flt_ops json_ops[] = {
+	[JSON_PARSER]       = JSON_FLT_OPS(json_tcp_data_parser),
+	[JSON_NOOP]         = JSON_FLT_OPS(json_tcp_data_noop),
+	[JSON_NEWLINE]      = JSON_FLT_OPS(json_tcp_data_newline),
+	[JSON_NEWLINE_SIMD] = JSON_FLT_OPS(json_tcp_data_newline_simd),
+	[JSON_SIMD]         = JSON_FLT_OPS(json_tcp_data_simd),
 };
 
+/* parser mode with raw predicates */
+static struct flt_ops json_ops_raw = JSON_FLT_OPS(json_tcp_data_raw);
+
+/* Loads and compiles the JSON schema found in <file> for keyword <kw>. Returns
+ * it, or NULL with <err> filled on error.
+ */
+static struct json_schema *
+json_load_schema(const char *kw, const char *file, char **err)
+{
+	struct json_schema *schema = NULL;
+	struct stat         stat;
+	const char         *msg;
+	char               *text = NULL;
+	size_t              ofs, i;
+	int                 fd, line, col;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &stat) < 0) {
+		memprintf(err, "'%s' : error opening schema file <%s> : %s",
+			  kw, file, strerror(errno));
+		goto end;
+	}
+	text = malloc(stat.st_size + 1);
+	if (!text) {
+		memprintf(err, "%s: out of memory", kw);
+		goto end;
+	}
+	if (read(fd, text, stat.st_size) != stat.st_size) {
+		memprintf(err, "'%s' : error reading schema file <%s>", kw, file);
+		goto end;
+	}
+	text[stat.st_size] = 0;
+
+	schema = json_schema_compile(text, stat.st_size, &msg, &ofs);
+	if (!schema) {
+		for (i = 0, line = 1, col = 1; i < ofs; i++, col++) {
+			if (text[i] == '\n') {
+				line++;
+				col = 0;
+			}
+		}
+		memprintf(err, "'%s' : schema file <%s> line %d column %d : %s",
+			  kw, file, line, col, msg);
+	}
+
+ end:
+	if (fd >= 0)
+		close(fd);
+	free(text);
+	return schema;
+}
+
 /* Return -1 on error, else 0 */
 static int
 parse_json_flt(char **args, int *cur_arg, struct proxy *px,
@@ -710,8 +2054,9 @@ parse_json_flt(char **args, int *cur_arg, struct proxy *px,
 		return -1;
 	}
 	conf->proxy = px;
-	conf->stats_records_parsed = 0;
-	conf->stats_records_failed = 0;
+	LIST_INIT(&conf->preds);
+	conf->fanout.conns = JSON_FANOUT_DEF_CONNS;
+	conf->coalesce.delay = JSON_COALESCE_DEF_DELAY;
 
 	if (!strcmp(args[pos], "json")) {
 		pos++;
@@ -730,12 +2075,161 @@ parse_json_flt(char **args, int *cur_arg, struct proxy *px,
 				}
 				pos++;
 			}
+			else if (!strcmp(args[pos], "fanout")) {
+				if (!*args[pos + 1]) {
+					memprintf(err, "'%s' : '%s' option without value",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				free(conf->fanout.be_name);
+				conf->fanout.be_name = strdup(args[pos + 1]);
+				if (!conf->fanout.be_name) {
+					memprintf(err, "%s: out of memory", args[*cur_arg]);
+					goto error;
+				}
+				pos++;
+			}
+			else if (!strcmp(args[pos], "fanout-conns")) {
+				if (!*args[pos + 1]) {
+					memprintf(err, "'%s' : '%s' option without value",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				conf->fanout.conns = atoi(args[pos + 1]);
+				if (conf->fanout.conns < 1 || conf->fanout.conns > JSON_FANOUT_MAX_CONNS) {
+					memprintf(err, "'%s' : '%s' expects a value between 1 and %d",
+						  args[*cur_arg], args[pos], JSON_FANOUT_MAX_CONNS);
+					goto error;
+				}
+				pos++;
+			}
+			else if (!strcmp(args[pos], "fanout-batch")) {
+				const char *res;
+
+				if (!*args[pos + 1]) {
+					memprintf(err, "'%s' : '%s' option without value",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				res = parse_size_err(args[pos + 1], &conf->fanout.batch);
+				if (res || !conf->fanout.batch) {
+					memprintf(err, "'%s' : '%s' expects a positive size",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				pos++;
+			}
+			else if (!strcmp(args[pos], "on-error")) {
+				if (!strcmp(args[pos + 1], "block"))
+					conf->on_error = JSON_ERR_BLOCK;
+				else if (!strcmp(args[pos + 1], "pass"))
+					conf->on_error = JSON_ERR_PASS;
+				else if (!strcmp(args[pos + 1], "drop"))
+					conf->on_error = JSON_ERR_DROP;
+				else if (!strcmp(args[pos + 1], "quarantine"))
+					conf->on_error = JSON_ERR_QUARANTINE;
+				else {
+					memprintf(err, "'%s' : '%s' expects 'block', 'pass', 'drop' or 'quarantine'",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				pos++;
+			}
+			else if (!strcmp(args[pos], "coalesce")) {
+				const char *res;
+
+				if (!*args[pos + 1]) {
+					memprintf(err, "'%s' : '%s' option without value",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				res = parse_size_err(args[pos + 1], &conf->coalesce.size);
+				if (res || !conf->coalesce.size) {
+					memprintf(err, "'%s' : '%s' expects a positive size",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				pos++;
+			}
+			else if (!strcmp(args[pos], "coalesce-delay")) {
+				const char *res;
+
+				if (!*args[pos + 1]) {
+					memprintf(err, "'%s' : '%s' option without value",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				res = parse_time_err(args[pos + 1], &conf->coalesce.delay, TIME_UNIT_MS);
+				if (res || !conf->coalesce.delay) {
+					memprintf(err, "'%s' : '%s' expects a positive delay in milliseconds",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				pos++;
+			}
+			else if (!strcmp(args[pos], "drop-if") || !strcmp(args[pos], "drop-unless")) {
+				struct json_pred *pred;
+
+				if (strcmp(args[pos + 1], "contains") != 0 || !*args[pos + 2]) {
+					memprintf(err, "'%s' : '%s' expects 'contains' followed by a string",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				if (strlen(args[pos + 2]) > JSON_RAW_MAX_LEN) {
+					memprintf(err, "'%s' : '%s' string cannot exceed %d characters",
+						  args[*cur_arg], args[pos], JSON_RAW_MAX_LEN);
+					goto error;
+				}
+				pred = calloc(1, sizeof(*pred));
+				if (!pred || (pred->str = strdup(args[pos + 2])) == NULL) {
+					free(pred);
+					memprintf(err, "%s: out of memory", args[*cur_arg]);
+					goto error;
+				}
+				pred->drop_if = (args[pos][5] == 'i');
+				pred->len = strlen(pred->str);
+				LIST_ADDQ(&conf->preds, &pred->list);
+				pos += 2;
+			}
+			else if (!strcmp(args[pos], "schema")) {
+				if (!*args[pos + 1]) {
+					memprintf(err, "'%s' : '%s' option without value",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				json_schema_free(conf->schema);
+				conf->schema = json_load_schema(args[*cur_arg], args[pos + 1], err);
+				if (!conf->schema)
+					goto error;
+				pos++;
+			}
+			else if (!strcmp(args[pos], "minify")) {
+				conf->minify = 1;
+			}
+			else if (!strcmp(args[pos], "canonical")) {
+				conf->minify = 1;
+				conf->canonical = 1;
+			}
+			else if (!strcmp(args[pos], "transcode")) {
+				if (!strcmp(args[pos + 1], "cbor"))
+					conf->transcode = JSON_ENC_CBOR;
+				else if (!strcmp(args[pos + 1], "msgpack"))
+					conf->transcode = JSON_ENC_MSGPACK;
+				else {
+					memprintf(err, "'%s' : '%s' expects 'cbor' or 'msgpack'",
+						  args[*cur_arg], args[pos]);
+					goto error;
+				}
+				pos++;
+			}
 			else if (!strcmp(args[pos], "noop")){
 				conf->version = JSON_NOOP;
 			} else if (!strcmp(args[pos], "newline")) {
 				conf->version = JSON_NEWLINE;
 			} else if (!strcmp(args[pos], "newlinesimd")) {
 				conf->version = JSON_NEWLINE_SIMD;
+			} else if (!strcmp(args[pos], "simd")) {
+				conf->version = JSON_SIMD;
 			} else {
 				break;
 			}
@@ -743,18 +2237,14 @@ parse_json_flt(char **args, int *cur_arg, struct proxy *px,
 		}
 		*cur_arg = pos;
 
-		json_ops.tcp_data = json_tcp_data_parser;
-		if(conf->version == JSON_NOOP){
-			json_ops.tcp_data = json_tcp_data_noop;
-		}
-		if(conf->version == JSON_NEWLINE){
-			json_ops.tcp_data = json_tcp_data_newline;
-		}
-		if(conf->version == JSON_NEWLINE_SIMD){
-			json_ops.tcp_data = json_tcp_data_newline_simd;
+		fconf->id   = json_flt_id;
+		fconf->ops  = &json_ops[conf->version];
+		if(conf->version == JSON_PARSER && !LIST_ISEMPTY(&conf->preds)){
+			fconf->ops = &json_ops_raw;
 		}
 
-		fconf->ops  = &json_ops;
+		if (conf->fanout.be_name)
+			init_new_proxy(&conf->fanout.fe);
 	}
 
 	fconf->conf = conf;
@@ -763,10 +2253,389 @@ parse_json_flt(char **args, int *cur_arg, struct proxy *px,
  error:
 	if (conf->name)
 		free(conf->name);
+	free(conf->fanout.be_name);
+	json_free_preds(conf);
+	json_schema_free(conf->schema);
 	free(conf);
 	return -1;
 }
 
+/***********************************************************************
+ * Counters reporting
+ ***********************************************************************/
+/* Fills the json fields of the stats of proxy <px> with the sum of the
+ * counters of all its json filters. They are left empty if it has none.
+ */
+void
+flt_json_fill_stats(struct proxy *px, struct field *stats)
+{
+	struct flt_conf     *fconf;
+	struct json_config  *conf;
+	struct json_counters sum;
+	unsigned long long   parsed = 0, failed = 0, dropped = 0;
+	int                  found = 0;
+
+	list_for_each_entry(fconf, &px->filter_configs, list) {
+		if (fconf->id != json_flt_id)
+			continue;
+		conf = fconf->conf;
+		if (!conf->counters)
+			continue;
+		json_sum_counters(conf, &sum);
+		parsed  += sum.records_parsed;
+		failed  += sum.records_failed;
+		dropped += sum.records_dropped;
+		found = 1;
+	}
+
+	if (!found)
+		return;
+	stats[ST_F_JSON_REC]  = mkf_u64(FN_COUNTER, parsed);
+	stats[ST_F_JSON_FAIL] = mkf_u64(FN_COUNTER, failed);
+	stats[ST_F_JSON_DROP] = mkf_u64(FN_COUNTER, dropped);
+}
+
+/* Appends to <out> histogram <hist> whose first bucket is for values below
+ * 1 << <shift>. Each bucket is reported with its upper bound.
+ */
+static void
+json_dump_hist(struct buffer *out, const char *name, const unsigned long long *hist, unsigned int shift)
+{
+	int b;
+
+	chunk_appendf(out, "  %s:", name);
+	for (b = 0; b < JSON_HIST_BUCKETS - 1; b++)
+		chunk_appendf(out, " %llu:%llu", 1ULL << (shift + b), hist[b]);
+	chunk_appendf(out, " inf:%llu\n", hist[b]);
+}
+
+/* Appends to <out> the records kept in quarantine by <conf>, oldest first */
+static void
+json_dump_quarantine(struct buffer *out, struct json_config *conf)
+{
+	struct json_quarantine  *q = conf->quarantine;
+	struct json_quarantined *rec;
+	struct tm tm;
+	unsigned int i;
+
+	HA_SPIN_LOCK(JSON_QUARANTINE_LOCK, &q->lock);
+	chunk_appendf(out, "%s: quarantined=%u\n", conf->name, q->total);
+	i = q->total > JSON_QUARANTINE_MAX ? q->total - JSON_QUARANTINE_MAX : 0;
+	for (; i < q->total; i++) {
+		rec = &q->recs[i % JSON_QUARANTINE_MAX];
+		get_localtime(rec->date.tv_sec, &tm);
+		chunk_appendf(out, "  [%02d/%s/%04d:%02d:%02d:%02d.%03d] stream=%u len=%u ",
+			      tm.tm_mday, monthname[tm.tm_mon], tm.tm_year+1900,
+			      tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(rec->date.tv_usec/1000),
+			      rec->sid, rec->len);
+		dump_text(out, rec->data, MIN(rec->len, (unsigned int)JSON_QUARANTINE_LEN));
+		chunk_appendf(out, "%s\n", rec->len > JSON_QUARANTINE_LEN ? "..." : "");
+	}
+	HA_SPIN_UNLOCK(JSON_QUARANTINE_LOCK, &q->lock);
+}
+
+/* Dumps the counters of every json filter, or the records they quarantined
+ * if i1 is set, one proxy at a time. The proxy to dump next is kept in p0,
+ * starting with the first one.
+ */
+static int
+cli_io_handler_show_json(struct appctx *appctx)
+{
+	struct stream_interface *si = appctx->owner;
+	struct proxy            *px = appctx->ctx.cli.p0;
+	struct flt_conf         *fconf;
+	struct json_config      *conf;
+	struct json_counters     sum;
+
+	if (unlikely(si_ic(si)->flags & (CF_WRITE_ERROR|CF_SHUTW)))
+		return 1;
+
+	if (!appctx->ctx.cli.i0) {
+		px = proxies_list;
+		appctx->ctx.cli.i0 = 1;
+	}
+
+	for (; px; px = px->next) {
+		chunk_reset(&trash);
+		list_for_each_entry(fconf, &px->filter_configs, list) {
+			if (fconf->id != json_flt_id)
+				continue;
+			conf = fconf->conf;
+			if (appctx->ctx.cli.i1) {
+				if (conf->quarantine)
+					json_dump_quarantine(&trash, conf);
+				continue;
+			}
+			json_sum_counters(conf, &sum);
+			chunk_appendf(&trash,
+			              "%s: mode=%s parsed=%llu failed=%llu dropped=%llu bytes=%llu calls=%llu time_ns=%llu\n",
+			              conf->name, json_version_str[conf->version],
+			              sum.records_parsed, sum.records_failed, sum.records_dropped,
+			              sum.bytes, sum.calls, sum.time_ns);
+			json_dump_hist(&trash, "bytes", sum.bytes_hist, JSON_HIST_BYTES_SHIFT);
+			json_dump_hist(&trash, "latency_ns", sum.lat_hist, JSON_HIST_NS_SHIFT);
+		}
+		if (ci_putchk(si_ic(si), &trash) == -1) {
+			appctx->ctx.cli.p0 = px;
+			si_applet_cant_put(si);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+cli_parse_show_json(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	appctx->ctx.cli.p0 = NULL;
+	appctx->ctx.cli.i0 = 0;
+	appctx->ctx.cli.i1 = 0;
+	if (*args[2]) {
+		if (strcmp(args[2], "quarantine") != 0) {
+			appctx->ctx.cli.severity = LOG_ERR;
+			appctx->ctx.cli.msg = "Usage: show json-filter [quarantine].\n";
+			appctx->st0 = CLI_ST_PRINT;
+			return 1;
+		}
+		appctx->ctx.cli.i1 = 1;
+	}
+	return 0;
+}
+
+/***********************************************************************
+ * Sample fetches
+ ***********************************************************************/
+/* Checks the path argument of json.path* fetches */
+static int
+val_json_path(struct arg *arg, char **err_msg)
+{
+	if (!json_path_check(arg[0].data.str.area)) {
+		memprintf(err_msg, "invalid JSON path '%s', expects '$' followed by '.name', '[\"name\"]' or '[index]' steps",
+			  arg[0].data.str.area);
+		return 0;
+	}
+	return 1;
+}
+
+/* Decodes in place the escape sequences of the <len> bytes of the JSON string
+ * contents at <str>, which were already validated. Returns the new length.
+ */
+static int
+json_unescape(char *str, int len)
+{
+	char *in = str, *out = str, *end = str + len;
+	unsigned int cp, lo;
+
+	while (in < end) {
+		if (*in != '\\') {
+			*out++ = *in++;
+			continue;
+		}
+		in++;
+		switch (*in++) {
+		case 'b': *out++ = '\b'; break;
+		case 'f': *out++ = '\f'; break;
+		case 'n': *out++ = '\n'; break;
+		case 'r': *out++ = '\r'; break;
+		case 't': *out++ = '\t'; break;
+		case 'u':
+			cp = (hex2i(in[0]) << 12) | (hex2i(in[1]) << 8) | (hex2i(in[2]) << 4) | hex2i(in[3]);
+			in += 4;
+			if (cp >= 0xd800 && cp < 0xdc00 && end - in >= 6 && in[0] == '\\' && in[1] == 'u') {
+				/* surrogate pair */
+				lo = (hex2i(in[2]) << 12) | (hex2i(in[3]) << 8) | (hex2i(in[4]) << 4) | hex2i(in[5]);
+				if (lo >= 0xdc00 && lo < 0xe000) {
+					cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+					in += 6;
+				}
+			}
+			if (cp < 0x80)
+				*out++ = cp;
+			else if (cp < 0x800) {
+				*out++ = 0xc0 | (cp >> 6);
+				*out++ = 0x80 | (cp & 0x3f);
+			}
+			else if (cp < 0x10000) {
+				*out++ = 0xe0 | (cp >> 12);
+				*out++ = 0x80 | ((cp >> 6) & 0x3f);
+				*out++ = 0x80 | (cp & 0x3f);
+			}
+			else {
+				*out++ = 0xf0 | (cp >> 18);
+				*out++ = 0x80 | ((cp >> 12) & 0x3f);
+				*out++ = 0x80 | ((cp >> 6) & 0x3f);
+				*out++ = 0x80 | (cp & 0x3f);
+			}
+			break;
+		default: /* '"', '\\' and '/' */
+			*out++ = in[-1];
+		}
+	}
+	return out - str;
+}
+
+/* Looks up the element designated by the path in args[0] in the first record
+ * of the request's input which the json filter <filter> did not look at yet.
+ * It is the case of the tcp-request content and switching rules, which are
+ * evaluated before the filter gets the data. The record is validated here as
+ * the filter would do it, including against its schema. On success, <rec> is
+ * set to the position of the record in the buffer, <start> and <end> to the
+ * bounds of the element in the record, and 1 is returned. Otherwise 0 is returned, with SMP_F_MAY_CHANGE
+ * set if the record is not complete yet and more data may come.
+ */
+static int
+smp_fetch_json_pending(const struct arg *args, struct sample *smp, struct filter *filter,
+                       size_t *rec, size_t *start, size_t *end)
+{
+	struct json_config *conf = FLT_CONF(filter);
+	struct channel *chn = &smp->strm->req;
+	int avail = ci_data(chn) - FLT_NXT(filter, chn);
+	struct json_simd_state scan;
+	struct json_view v;
+	char *parsed_til;
+
+	if (avail <= 0)
+		goto wait;
+
+	/* as in the filter, the scanner first tells if the record is complete,
+	 * then rapidjson validates it, and stops at its end */
+	json_get_view(filter, chn, avail, &v);
+	json_simd_init(&scan);
+	if (json_simd_scan(&scan, &v) == JSON_FAIL && !scan.records)
+		return 0;
+	if (!scan.records)
+		goto wait;
+
+	*rec = co_data(chn) + FLT_NXT(filter, chn);
+	if (json_parse_wrap(b_orig(&chn->buf), b_peek(&chn->buf, *rec),
+	                    b_peek(&chn->buf, *rec + scan.done - 1), b_wrap(&chn->buf),
+	                    &parsed_til, conf->schema, NULL) == JSON_FAIL)
+		return 0;
+	return json_path_lookup(&v, args[0].data.str.area, start, end) == JSON_LOOKUP_FOUND;
+
+ wait:
+	if (channel_may_recv(chn) && !channel_input_closed(chn))
+		smp->flags |= SMP_F_MAY_CHANGE;
+	return 0;
+}
+
+/* Looks up the element designated by the path in args[0] in the last record
+ * validated by the json filter of the stream, which is read where it lies in
+ * the request buffer. Only the record is indexed, and only up to the element.
+ * While the filter has not validated any record, the first record of the
+ * input is validated on demand instead. On success, the element's text is
+ * copied into a trash chunk, returned in <out>, and 1 is returned. Otherwise
+ * 0 is returned, which is also the case when the stream has no json filter,
+ * or when the record already left the buffer. SMP_F_MAY_CHANGE is set if the
+ * record is still being received.
+ */
+static int
+smp_fetch_json_lookup(const struct arg *args, struct sample *smp, struct buffer **out)
+{
+	struct channel *chn;
+	struct filter *filter;
+	struct json_state *st = NULL;
+	struct json_view v;
+	struct buffer *trash;
+	size_t nxt, rec, start, end;
+
+	if (!smp->strm)
+		return 0;
+
+	list_for_each_entry(filter, &strm_flt(smp->strm)->filters, list) {
+		if (FLT_ID(filter) == json_flt_id && filter->ctx) {
+			st = filter->ctx;
+			break;
+		}
+	}
+	if (!st)
+		return 0;
+
+	/* the filter only validates the request */
+	chn = &smp->strm->req;
+	if (!st->rec_len) {
+		if (!smp_fetch_json_pending(args, smp, filter, &rec, &start, &end))
+			return 0;
+		goto found;
+	}
+
+	/* the record ends <rec_tail> bytes before the first byte the filter
+	 * did not look at */
+	nxt = co_data(chn) + FLT_NXT(filter, chn);
+	if ((size_t)st->rec_len + st->rec_tail > nxt)
+		return 0;
+	rec = nxt - st->rec_tail - st->rec_len;
+
+	v.blk1 = v.blk2 = NULL;
+	v.len1 = v.len2 = 0;
+	b_getblk_nc(&chn->buf, &v.blk1, &v.len1, &v.blk2, &v.len2, rec, st->rec_len);
+	if (json_path_lookup(&v, args[0].data.str.area, &start, &end) != JSON_LOOKUP_FOUND)
+		return 0;
+
+ found:
+	trash = get_trash_chunk();
+	if (end - start > trash->size)
+		return 0;
+	trash->data = b_getblk(&chn->buf, trash->area, end - start, rec + start);
+	*out = trash;
+	return 1;
+}
+
+/* json.path(<path>) : returns the element designated by <path> in the current
+ * JSON record as a string. Strings are unquoted and unescaped, other elements
+ * are returned as they appear in the record.
+ */
+static int
+smp_fetch_json_path(const struct arg *args, struct sample *smp, const char *kw, void *private)
+{
+	struct buffer *val;
+
+	if (!smp_fetch_json_lookup(args, smp, &val))
+		return 0;
+
+	if (val->data >= 2 && val->area[0] == '"') {
+		val->data = json_unescape(val->area + 1, val->data - 2);
+		memmove(val->area, val->area + 1, val->data);
+	}
+	smp->data.type = SMP_T_STR;
+	smp->data.u.str = *val;
+	smp->flags = SMP_F_VOL_TEST;
+	return 1;
+}
+
+/* json.path_int(<path>) : returns the element designated by <path> in the
+ * current JSON record as an integer. Only integer numbers match.
+ */
+static int
+smp_fetch_json_path_int(const struct arg *args, struct sample *smp, const char *kw, void *private)
+{
+	struct buffer *val;
+	long long i;
+
+	if (!smp_fetch_json_lookup(args, smp, &val))
+		return 0;
+
+	if (strl2llrc(val->area, val->data, &i) != 0)
+		return 0;
+	smp->data.type = SMP_T_SINT;
+	smp->data.u.sint = i;
+	smp->flags = SMP_F_VOL_TEST;
+	return 1;
+}
+
+/* Note: must not be declared <const> as its list will be overwritten */
+static struct sample_fetch_kw_list sample_fetch_keywords = {ILH, {
+		{ "json.path",     smp_fetch_json_path,     ARG1(1,STR), val_json_path, SMP_T_STR,  SMP_USE_L6REQ },
+		{ "json.path_int", smp_fetch_json_path_int, ARG1(1,STR), val_json_path, SMP_T_SINT, SMP_USE_L6REQ },
+		{ /* END */ },
+	}
+};
+
+static struct cli_kw_list cli_kws = {{ },{
+	{ { "show", "json-filter", NULL }, "show json-filter [quarantine] : report the counters or the quarantined records of the json filters", cli_parse_show_json, cli_io_handler_show_json, NULL, NULL },
+	{{},}
+}};
+
 /* Declare the filter parser for "trace" keyword */
 static struct flt_kw_list flt_kws = { "JSON", { }, {
 		{ "json", parse_json_flt, NULL },
@@ -779,4 +2648,8 @@ static void
 __flt_json_init(void)
 {
 	flt_register_keywords(&flt_kws);
+	sample_register_fetches(&sample_fetch_keywords);
+	cli_register_kw(&cli_kws);
+	pool_head_json_state = create_pool("json_state", sizeof(struct json_state), MEM_F_SHARED);
+	pool_head_json_sink = create_pool("json_sink", sizeof(struct json_sink), MEM_F_SHARED);
 }
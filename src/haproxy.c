@@ -440,6 +440,9 @@ static void usage(char *name)
 #if defined(ENABLE_EPOLL)
 		"        -de disables epoll() usage even when available\n"
 #endif
+#if defined(ENABLE_URING)
+		"        -du disables io_uring usage even when available\n"
+#endif
 #if defined(ENABLE_KQUEUE)
 		"        -dk disables kqueue() usage even when available\n"
 #endif
@@ -895,6 +898,9 @@ static int mworker_wait_mode()
 	if (!(global.tune.options & GTUNE_USE_KQUEUE))
 		disable_poller("kqueue");
 
+	if (!(global.tune.options & GTUNE_USE_URING))
+		disable_poller("uring");
+
 	if (!(global.tune.options & GTUNE_USE_EPOLL))
 		disable_poller("epoll");
 
@@ -1469,6 +1475,9 @@ static void init(int argc, char **argv)
 #if defined(ENABLE_EPOLL)
 	global.tune.options |= GTUNE_USE_EPOLL;
 #endif
+#if defined(ENABLE_URING)
+	global.tune.options |= GTUNE_USE_URING;
+#endif
 #if defined(ENABLE_KQUEUE)
 	global.tune.options |= GTUNE_USE_KQUEUE;
 #endif
@@ -1512,6 +1521,10 @@ static void init(int argc, char **argv)
 			else if (*flag == 'd' && flag[1] == 'p')
 				global.tune.options &= ~GTUNE_USE_POLL;
 #endif
+#if defined(ENABLE_URING)
+			else if (*flag == 'd' && flag[1] == 'u')
+				global.tune.options &= ~GTUNE_USE_URING;
+#endif
 #if defined(ENABLE_KQUEUE)
 			else if (*flag == 'd' && flag[1] == 'k')
 				global.tune.options &= ~GTUNE_USE_KQUEUE;
@@ -1780,7 +1793,15 @@ static void init(int argc, char **argv)
 	global_listener_queue_task->context = NULL; /* not even a context! */
 	global_listener_queue_task->process = manage_global_listener_queue;
 
-	/* now we know the buffer size, we can initialize the channels and buffers */
+	if (global.tune.maxrewrite < 0)
+		global.tune.maxrewrite = MAXREWRITE;
+
+	if (global.tune.maxrewrite >= global.tune.bufsize / 2)
+		global.tune.maxrewrite = global.tune.bufsize / 2;
+
+	/* now we know the buffer size and the rewrite reserve, we can initialize
+	 * the channels and the buffer size classes.
+	 */
 	init_buffer();
 
 	list_for_each_entry(pcf, &post_check_list, list) {
@@ -1990,12 +2011,6 @@ static void init(int argc, char **argv)
 	if (global.tune.recv_enough == 0)
 		global.tune.recv_enough = MIN_RECV_AT_ONCE_ENOUGH;
 
-	if (global.tune.maxrewrite < 0)
-		global.tune.maxrewrite = MAXREWRITE;
-
-	if (global.tune.maxrewrite >= global.tune.bufsize / 2)
-		global.tune.maxrewrite = global.tune.bufsize / 2;
-
 	if (arg_mode & (MODE_DEBUG | MODE_FOREGROUND)) {
 		/* command line debug mode inhibits configuration mode */
 		global.mode &= ~(MODE_DAEMON | MODE_QUIET);
@@ -2046,6 +2061,9 @@ static void init(int argc, char **argv)
 	if (!(global.tune.options & GTUNE_USE_KQUEUE))
 		disable_poller("kqueue");
 
+	if (!(global.tune.options & GTUNE_USE_URING))
+		disable_poller("uring");
+
 	if (!(global.tune.options & GTUNE_USE_EPOLL))
 		disable_poller("epoll");
 
@@ -2531,6 +2549,10 @@ static void run_poll_loop()
 		/* Check if we can expire some tasks */
 		next = wake_expired_tasks();
 
+		/* give the entries of our pool caches back if asked to */
+		if (pool_cache_flush_req & tid_bit)
+			pool_flush_cache();
+
 		/* stop when there's nothing left to do */
 		if (jobs == 0)
 			break;
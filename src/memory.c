@@ -10,13 +10,22 @@
  *
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
 #include <types/applet.h>
 #include <types/cli.h>
 #include <types/global.h>
 #include <types/stats.h>
 
+#include <common/cfgparse.h>
 #include <common/config.h>
 #include <common/debug.h>
+#include <common/errors.h>
 #include <common/memory.h>
 #include <common/mini-clist.h>
 #include <common/standard.h>
@@ -24,6 +33,7 @@
 #include <proto/applet.h>
 #include <proto/cli.h>
 #include <proto/channel.h>
+#include <proto/fd.h>
 #include <proto/log.h>
 #include <proto/stream_interface.h>
 #include <proto/stats.h>
@@ -31,6 +41,32 @@
 static struct list pools = LIST_HEAD_INIT(pools);
 int mem_poison_byte = -1;
 
+static void pool_trim(struct pool_head *pool_ctx);
+
+/* the local caches of each thread, and the number of pools using them */
+struct pool_cache_head pool_cache[MAX_THREADS][MAX_BASE_POOLS];
+static int nb_cached_pools __maybe_unused;
+
+volatile unsigned long pool_cache_flush_req = 0;
+
+/* arenas requested by "tune.pool-arena", created once the process runs */
+static struct {
+	char name[12];		/* name of the pool */
+	unsigned int size;	/* size of the arena in bytes */
+	struct pool_head *pool;	/* the pool, once resolved after the config */
+} pool_arena_req[MAX_BASE_POOLS];
+static int pool_arena_nbreq;
+
+/* the NUMA node the current thread runs on, or -1 if not known yet */
+static THREAD_LOCAL int pool_arena_cur_node = -1;
+
+/* the size of a huge page, which arenas are aligned on */
+#define POOL_ARENA_PAGE (2UL << 20)
+
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
 /* Try to find an existing shared pool with the same characteristics and
  * returns it, otherwise creates this one. NULL is returned if no memory
  * is available for a new creation. Two flags are supported :
@@ -90,6 +126,18 @@ struct pool_head *create_pool(char *name, unsigned int size, unsigned int flags)
 			strlcpy2(pool->name, name, sizeof(pool->name));
 		pool->size = size;
 		pool->flags = flags;
+		pool->cache_idx = -1;
+#ifndef DEBUG_UAF
+		/* entries must really be released to detect use after free */
+		if (nb_cached_pools < MAX_BASE_POOLS) {
+			pool->cache_idx = nb_cached_pools++;
+			pool->cache_max = CONFIG_HAP_POOL_CACHE_SIZE / (size + POOL_EXTRA);
+			if (pool->cache_max < POOL_CACHE_MIN)
+				pool->cache_max = POOL_CACHE_MIN;
+			else if (pool->cache_max > POOL_CACHE_MAX)
+				pool->cache_max = POOL_CACHE_MAX;
+		}
+#endif
 		LIST_ADDQ(start, &pool->list);
 	}
 	pool->users++;
@@ -99,6 +147,342 @@ struct pool_head *create_pool(char *name, unsigned int size, unsigned int flags)
 	return pool;
 }
 
+/* Releases the entries of all the current thread's caches to the shared
+ * lists, except the one of pool <skip> which may be NULL.
+ */
+static void pool_flush_local_caches(struct pool_head *skip)
+{
+	struct pool_head *entry;
+
+	list_for_each_entry(entry, &pools, list) {
+		if (entry->cache_idx >= 0 && entry != skip)
+			pool_evict_from_cache(entry, &pool_cache[tid][entry->cache_idx], 0);
+	}
+}
+
+/* Asks all other threads to release the entries of their caches to the shared
+ * lists, waking up those which are sleeping so that they do it immediately.
+ */
+static void pool_request_cache_flush()
+{
+	unsigned long mask = all_threads_mask & ~tid_bit;
+	int thr;
+
+	if (!mask)
+		return;
+	HA_ATOMIC_OR(&pool_cache_flush_req, mask);
+	mask &= sleeping_thread_mask;
+	for (thr = 0; mask; thr++, mask >>= 1) {
+		if (mask & 1)
+			wake_thread(thr);
+	}
+}
+
+/* Releases the entries of all the current thread's caches to the shared
+ * lists, and acknowledges a flush request from pool_gc(). It is called from
+ * the polling loop when such a request is pending, and when the thread stops.
+ * On request, the shared lists are trimmed again since pool_gc() could not
+ * free the entries which were in this thread's caches.
+ */
+void pool_flush_cache()
+{
+	int req = !!(pool_cache_flush_req & tid_bit);
+
+	HA_ATOMIC_AND(&pool_cache_flush_req, ~tid_bit);
+	pool_flush_local_caches(NULL);
+	if (req)
+		pool_trim(NULL);
+}
+
+/* Returns the number of NUMA nodes of the system, as reported by sysfs, or 1
+ * if it cannot be determined.
+ */
+static int pool_arena_nbnodes()
+{
+	char line[256];
+	FILE *f;
+	char *p;
+	int last = 0;
+
+	/* a list of ranges such as "0-1,3", the last number is the highest node */
+	f = fopen("/sys/devices/system/node/online", "r");
+	if (!f)
+		return 1;
+	if (fgets(line, sizeof(line), f)) {
+		for (p = line; *p; p++) {
+			if (isdigit((unsigned char)*p) && (p == line || !isdigit((unsigned char)p[-1])))
+				last = atoi(p);
+		}
+	}
+	fclose(f);
+	return MIN(last + 1, MAX_NUMA_NODES);
+}
+
+/* Returns the node of arena <arena> the current thread should allocate from.
+ * The thread's node is looked up on its first allocation, which happens once
+ * the threads are bound to their CPUs by "cpu-map".
+ */
+static inline int pool_arena_local_node(const struct pool_arena *arena)
+{
+	if (pool_arena_cur_node < 0) {
+		unsigned int cpu, node = 0;
+
+#if defined(SYS_getcpu)
+		if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+			node = 0;
+#endif
+		pool_arena_cur_node = node;
+	}
+	return pool_arena_cur_node % arena->nbnodes;
+}
+
+/* Makes the kernel take the pages of the <len> bytes at <area> from NUMA node
+ * <node> as long as it has some. Failures are ignored, the pages are then
+ * taken wherever the kernel decides to.
+ */
+static void pool_arena_bind(void *area, size_t len, int node)
+{
+#if defined(SYS_mbind)
+	unsigned long mask = 1UL << node;
+
+	syscall(SYS_mbind, area, len, MPOL_PREFERRED, &mask, LONGBITS, 0);
+#endif
+}
+
+/* Creates an arena of about <size> bytes for pool <pool>. The area is mapped
+ * from the reserved huge pages when there are enough, otherwise it is aligned
+ * on a huge page and transparent huge pages are requested for it. It is split
+ * into one part per NUMA node, each bound to its node, and all its pages are
+ * touched so that the memory is reserved now. Returns the arena, or NULL with
+ * <err> filled in case of error.
+ */
+static struct pool_arena *pool_arena_create(struct pool_head *pool, size_t size, char **err)
+{
+	struct pool_arena *arena;
+	struct pool_arena_node *an;
+	size_t part, head;
+	char *area, *p;
+	int n;
+
+	arena = calloc(1, sizeof(*arena));
+	if (!arena) {
+		memprintf(err, "out of memory");
+		return NULL;
+	}
+
+	arena->nbnodes = pool_arena_nbnodes();
+	arena->chunk = (pool->size + POOL_EXTRA + 63) & -64;
+
+	/* each node gets a whole number of huge pages */
+	part = (size / arena->nbnodes + POOL_ARENA_PAGE - 1) & -POOL_ARENA_PAGE;
+	if (part / arena->chunk == 0) {
+		memprintf(err, "%lu bytes cannot hold a %u-byte object on each of the %d NUMA nodes",
+		          (unsigned long)size, arena->chunk, arena->nbnodes);
+		free(arena);
+		return NULL;
+	}
+	arena->size = part * arena->nbnodes;
+
+	area = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+	area = mmap(NULL, arena->size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	if (area != MAP_FAILED)
+		arena->hugetlb = 1;
+#endif
+	if (area == MAP_FAILED) {
+		/* one more page is mapped so that the area can be aligned */
+		area = mmap(NULL, arena->size + POOL_ARENA_PAGE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+		if (area == MAP_FAILED) {
+			memprintf(err, "cannot map %lu bytes (%s)", (unsigned long)arena->size, strerror(errno));
+			free(arena);
+			return NULL;
+		}
+		head = (((uintptr_t)area + POOL_ARENA_PAGE - 1) & -POOL_ARENA_PAGE) - (uintptr_t)area;
+		if (head)
+			munmap(area, head);
+		munmap(area + head + arena->size, POOL_ARENA_PAGE - head);
+		area += head;
+#if defined(MADV_HUGEPAGE)
+		madvise(area, arena->size, MADV_HUGEPAGE);
+#endif
+	}
+	arena->base = area;
+
+	for (n = 0; n < arena->nbnodes; n++) {
+		an = &arena->node[n];
+		an->area = an->next = area + n * part;
+		an->chunks = part / arena->chunk;
+		an->end = an->area + an->chunks * arena->chunk;
+		HA_SPIN_INIT(&an->lock);
+
+		if (arena->nbnodes > 1)
+			pool_arena_bind(an->area, part, n);
+		for (p = an->area; p < an->area + part; p += 4096)
+			*p = 0;
+	}
+	return arena;
+}
+
+/* Releases arena <arena>, which must not be used anymore */
+static void pool_arena_destroy(struct pool_arena *arena)
+{
+	int n;
+
+	if (!arena)
+		return;
+	for (n = 0; n < arena->nbnodes; n++)
+		HA_SPIN_DESTROY(&arena->node[n].lock);
+	munmap(arena->base, arena->size);
+	free(arena);
+}
+
+/* Returns a chunk of arena <arena>, preferably from the current thread's NUMA
+ * node, or NULL if the arena is exhausted.
+ */
+static void *pool_arena_alloc(struct pool_arena *arena)
+{
+	struct pool_arena_node *an;
+	void *ptr = NULL;
+	int local, n;
+
+	local = pool_arena_local_node(arena);
+	for (n = 0; n < arena->nbnodes; n++) {
+		an = &arena->node[(local + n) % arena->nbnodes];
+		HA_SPIN_LOCK(POOL_LOCK, &an->lock);
+		if (an->free_list) {
+			ptr = an->free_list;
+			an->free_list = *(void **)ptr;
+		}
+		else if (an->next < an->end) {
+			ptr = an->next;
+			an->next += arena->chunk;
+		}
+		if (ptr)
+			an->used++;
+		HA_SPIN_UNLOCK(POOL_LOCK, &an->lock);
+		if (ptr)
+			return ptr;
+	}
+	HA_ATOMIC_ADD(&arena->fallbacks, 1);
+	return NULL;
+}
+
+/* Gives <ptr> back to arena <arena> and returns non-zero, or returns zero if
+ * it does not belong to the arena.
+ */
+static int pool_arena_free(struct pool_arena *arena, void *ptr)
+{
+	struct pool_arena_node *an;
+	int n;
+
+	for (n = 0; n < arena->nbnodes; n++) {
+		an = &arena->node[n];
+		if ((char *)ptr < an->area || (char *)ptr >= an->end)
+			continue;
+		HA_SPIN_LOCK(POOL_LOCK, &an->lock);
+		*(void **)ptr = an->free_list;
+		an->free_list = ptr;
+		an->used--;
+		HA_SPIN_UNLOCK(POOL_LOCK, &an->lock);
+		return 1;
+	}
+	return 0;
+}
+
+/* Returns a new area for an entry of pool <pool>, taken from its arena if it
+ * has one and it is not exhausted, otherwise from the system.
+ */
+static inline void *pool_get_area(struct pool_head *pool)
+{
+	void *ptr = NULL;
+
+	if (pool->arena)
+		ptr = pool_arena_alloc(pool->arena);
+	if (!ptr) {
+#ifdef CONFIG_HAP_LOCKLESS_POOLS
+		ptr = malloc(pool->size + POOL_EXTRA);
+#else
+		ptr = pool_alloc_area(pool->size + POOL_EXTRA);
+#endif
+	}
+	return ptr;
+}
+
+/* Releases area <ptr> of pool <pool> obtained with pool_get_area() */
+static inline void pool_put_area(struct pool_head *pool, void *ptr)
+{
+	if (pool->arena && pool_arena_free(pool->arena, ptr))
+		return;
+#ifdef CONFIG_HAP_LOCKLESS_POOLS
+	free(ptr);
+#else
+	pool_free_area(ptr, pool->size + POOL_EXTRA);
+#endif
+}
+
+/* Resolves the pools named by "tune.pool-arena" once all the pools are
+ * created. Returns ERR_* flags.
+ */
+static int pool_check_arenas()
+{
+	struct pool_head *entry;
+	int i;
+
+	for (i = 0; i < pool_arena_nbreq; i++) {
+		list_for_each_entry(entry, &pools, list) {
+			if (strcmp(entry->name, pool_arena_req[i].name) == 0)
+				goto found;
+		}
+		ha_alert("tune.pool-arena : unknown pool '%s'.\n", pool_arena_req[i].name);
+		return ERR_ALERT | ERR_FATAL;
+	found:
+#ifdef DEBUG_UAF
+		ha_warning("tune.pool-arena : ignored for pool '%s' since entries must really be released with DEBUG_UAF.\n",
+		           entry->name);
+		continue;
+#endif
+		pool_arena_req[i].pool = entry;
+	}
+	return ERR_NONE;
+}
+
+/* Creates the arenas requested by "tune.pool-arena" from the first thread of
+ * each worker process. This is only done once the process runs, since an
+ * arena touched before the fork would be shared with the master and copied on
+ * write by the workers, and never in the master which doesn't need it. The
+ * entries allocated so far are released so that the next ones come from the
+ * arena, which the other threads start to use once it is published. Returns 0
+ * in case of error.
+ */
+static int pool_setup_arenas()
+{
+	struct pool_head *entry;
+	struct pool_arena *arena;
+	char *err = NULL;
+	int i;
+
+	if (tid || master)
+		return 1;
+
+	for (i = 0; i < pool_arena_nbreq; i++) {
+		entry = pool_arena_req[i].pool;
+		if (!entry || entry->arena)
+			continue;
+		arena = pool_arena_create(entry, pool_arena_req[i].size, &err);
+		if (!arena) {
+			ha_alert("tune.pool-arena : pool '%s' : %s.\n", entry->name, err);
+			free(err);
+			return 0;
+		}
+		if (entry->cache_idx >= 0)
+			pool_evict_from_cache(entry, &pool_cache[tid][entry->cache_idx], 0);
+		pool_flush(entry);
+		__ha_barrier_store();
+		entry->arena = arena;
+	}
+	return 1;
+}
+
 #ifdef CONFIG_HAP_LOCKLESS_POOLS
 /* Allocates new entries for pool <pool> until there are at least <avail> + 1
  * available, then returns the last one for immediate use, so that at least
@@ -112,7 +496,6 @@ void *__pool_refill_alloc(struct pool_head *pool, unsigned int avail)
 {
 	void *ptr = NULL, *free_list;
 	int failed = 0;
-	int size = pool->size;
 	int limit = pool->limit;
 	int allocated = pool->allocated, allocated_orig = allocated;
 
@@ -125,7 +508,7 @@ void *__pool_refill_alloc(struct pool_head *pool, unsigned int avail)
 			return NULL;
 		}
 
-		ptr = malloc(size + POOL_EXTRA);
+		ptr = pool_get_area(pool);
 		if (!ptr) {
 			HA_ATOMIC_ADD(&pool->failed, 1);
 			if (failed)
@@ -177,17 +560,57 @@ void pool_flush(struct pool_head *pool)
 		temp = next;
 		next = *POOL_LINK(pool, temp);
 		removed++;
-		free(temp);
+		pool_put_area(pool, temp);
 	}
 	pool->free_list = next;
 	HA_ATOMIC_SUB(&pool->allocated, removed);
 	/* here, we should have pool->allocate == pool->used */
 }
 
+/* Releases the entries of the current thread's cache <ph> of pool <pool>
+ * which follow the <keep> most recent ones to the shared list. They are
+ * chained already, so they are pushed at once.
+ */
+void pool_evict_from_cache(struct pool_head *pool, struct pool_cache_head *ph, unsigned int keep)
+{
+	void **first, **last, *free_list;
+	unsigned int n;
+
+	if (ph->count <= keep)
+		return;
+
+	if (keep) {
+		for (last = ph->list, n = 1; n < keep; n++)
+			last = *POOL_LINK(pool, last);
+		first = *POOL_LINK(pool, last);
+		*POOL_LINK(pool, last) = NULL;
+	}
+	else {
+		first = ph->list;
+		ph->list = NULL;
+	}
+
+	n = ph->count - keep;
+	ph->count = keep;
+
+	for (last = first; *POOL_LINK(pool, last); last = *POOL_LINK(pool, last))
+		;
+
+	free_list = pool->free_list;
+	do {
+		*POOL_LINK(pool, last) = free_list;
+		__ha_barrier_store();
+	} while (!HA_ATOMIC_CAS(&pool->free_list, (void *)&free_list, (void *)first));
+
+	HA_ATOMIC_SUB(&pool->used, n);
+}
+
 /*
  * This function frees whatever can be freed in all pools, but respecting
  * the minimum thresholds imposed by owners. It takes care of avoiding
- * recursion because it may be called from a signal handler.
+ * recursion because it may be called from a signal handler. The current
+ * thread's caches are flushed first, and the other threads are asked to
+ * flush theirs.
  *
  * <pool_ctx> is unused
  */
@@ -195,11 +618,24 @@ void pool_gc(struct pool_head *pool_ctx)
 {
 	static int recurse;
 	int cur_recurse = 0;
-	struct pool_head *entry;
 
 	if (recurse || !HA_ATOMIC_CAS(&recurse, &cur_recurse, 1))
 		return;
 
+	pool_request_cache_flush();
+	pool_flush_local_caches(NULL);
+	pool_trim(pool_ctx);
+
+	HA_ATOMIC_STORE(&recurse, 0);
+}
+
+/* Frees the entries of the shared lists in excess of the minimum thresholds
+ * imposed by owners. <pool_ctx> is unused.
+ */
+static void pool_trim(struct pool_head *pool_ctx)
+{
+	struct pool_head *entry;
+
 	list_for_each_entry(entry, &pools, list) {
 		while ((int)((volatile int)entry->allocated - (volatile int)entry->used) > (int)entry->minavail) {
 			struct pool_free_list cmp, new;
@@ -214,12 +650,10 @@ void pool_gc(struct pool_head *pool_ctx)
 			new.seq = cmp.seq + 1;
 			if (__ha_cas_dw(&entry->free_list, &cmp, &new) == 0)
 				continue;
-			free(cmp.free_list);
+			pool_put_area(entry, cmp.free_list);
 			HA_ATOMIC_SUB(&entry->allocated, 1);
 		}
 	}
-
-	HA_ATOMIC_STORE(&recurse, 0);
 }
 #else /* CONFIG_HAP_LOCKLESS_POOLS */
 
@@ -243,7 +677,7 @@ void *__pool_refill_alloc(struct pool_head *pool, unsigned int avail)
 		if (pool->limit && pool->allocated >= pool->limit)
 			return NULL;
 
-		ptr = pool_alloc_area(pool->size + POOL_EXTRA);
+		ptr = pool_get_area(pool);
 		if (!ptr) {
 			pool->failed++;
 			if (failed)
@@ -289,31 +723,83 @@ void pool_flush(struct pool_head *pool)
 		temp = next;
 		next = *POOL_LINK(pool, temp);
 		pool->allocated--;
-		pool_free_area(temp, pool->size + POOL_EXTRA);
+		pool_put_area(pool, temp);
 	}
 	pool->free_list = next;
 	HA_SPIN_UNLOCK(POOL_LOCK, &pool->lock);
 	/* here, we should have pool->allocate == pool->used */
 }
 
+/* Releases the entries of the current thread's cache <ph> of pool <pool>
+ * which follow the <keep> most recent ones to the shared list. They are
+ * chained already, so they are inserted at once under the lock.
+ */
+void pool_evict_from_cache(struct pool_head *pool, struct pool_cache_head *ph, unsigned int keep)
+{
+	void **first, **last;
+	unsigned int n;
+
+	if (ph->count <= keep)
+		return;
+
+	if (keep) {
+		for (last = ph->list, n = 1; n < keep; n++)
+			last = *POOL_LINK(pool, last);
+		first = *POOL_LINK(pool, last);
+		*POOL_LINK(pool, last) = NULL;
+	}
+	else {
+		first = ph->list;
+		ph->list = NULL;
+	}
+
+	n = ph->count - keep;
+	ph->count = keep;
+
+	for (last = first; *POOL_LINK(pool, last); last = *POOL_LINK(pool, last))
+		;
+
+	HA_SPIN_LOCK(POOL_LOCK, &pool->lock);
+	*POOL_LINK(pool, last) = (void *)pool->free_list;
+	pool->free_list = first;
+	pool->used -= n;
+	HA_SPIN_UNLOCK(POOL_LOCK, &pool->lock);
+}
+
 /*
  * This function frees whatever can be freed in all pools, but respecting
  * the minimum thresholds imposed by owners. It takes care of avoiding
- * recursion because it may be called from a signal handler.
+ * recursion because it may be called from a signal handler. The current
+ * thread's caches are flushed first, and the other threads are asked to
+ * flush theirs.
  *
  * <pool_ctx> is used when pool_gc is called to release resources to allocate
  * an element in __pool_refill_alloc. It is important because <pool_ctx> is
- * already locked, so we need to skip the lock here.
+ * already locked, so we need to skip the lock here. Its cache is empty since
+ * the refill only happens once it was found empty.
  */
 void pool_gc(struct pool_head *pool_ctx)
 {
 	static int recurse;
 	int cur_recurse = 0;
-	struct pool_head *entry;
 
 	if (recurse || !HA_ATOMIC_CAS(&recurse, &cur_recurse, 1))
 		return;
 
+	pool_request_cache_flush();
+	pool_flush_local_caches(pool_ctx);
+	pool_trim(pool_ctx);
+
+	HA_ATOMIC_STORE(&recurse, 0);
+}
+
+/* Frees the entries of the shared lists in excess of the minimum thresholds
+ * imposed by owners. <pool_ctx> is already locked by the caller if not NULL.
+ */
+static void pool_trim(struct pool_head *pool_ctx)
+{
+	struct pool_head *entry;
+
 	list_for_each_entry(entry, &pools, list) {
 		void *temp, *next;
 		//qfprintf(stderr, "Flushing pool %s\n", entry->name);
@@ -325,14 +811,12 @@ void pool_gc(struct pool_head *pool_ctx)
 			temp = next;
 			next = *POOL_LINK(entry, temp);
 			entry->allocated--;
-			pool_free_area(temp, entry->size + POOL_EXTRA);
+			pool_put_area(entry, temp);
 		}
 		entry->free_list = next;
 		if (entry != pool_ctx)
 			HA_SPIN_UNLOCK(POOL_LOCK, &entry->lock);
 	}
-
-	HA_ATOMIC_STORE(&recurse, 0);
 }
 #endif
 
@@ -340,12 +824,22 @@ void pool_gc(struct pool_head *pool_ctx)
  * This function destroys a pool by freeing it completely, unless it's still
  * in use. This should be called only under extreme circumstances. It always
  * returns NULL if the resulting pool is empty, easing the clearing of the old
- * pointer, otherwise it returns the pool.
+ * pointer, otherwise it returns the pool. The entries sitting in the caches of
+ * the current thread and of the threads which already stopped are released
+ * first since they are still accounted as used.
  * .
  */
 void *pool_destroy(struct pool_head *pool)
 {
+	int thr;
+
 	if (pool) {
+		if (pool->cache_idx >= 0) {
+			for (thr = 0; thr < global.nbthread; thr++) {
+				if (thr == tid || !(all_threads_mask & (1UL << thr)))
+					pool_evict_from_cache(pool, &pool_cache[thr][pool->cache_idx], 0);
+			}
+		}
 		pool_flush(pool);
 		if (pool->used)
 			return pool;
@@ -355,17 +849,63 @@ void *pool_destroy(struct pool_head *pool)
 #ifndef CONFIG_HAP_LOCKLESS_POOLS
 			HA_SPIN_DESTROY(&pool->lock);
 #endif
+			pool_arena_destroy(pool->arena);
 			free(pool);
 		}
 	}
 	return NULL;
 }
 
+/* Returns the number of entries of pool <pool> sitting in the threads' local
+ * caches. If <hits> and <misses> are not NULL, the cache hits and misses are
+ * reported there. The values are only indicative as they are not locked.
+ */
+static unsigned int pool_cached(struct pool_head *pool, unsigned long *hits, unsigned long *misses)
+{
+	unsigned int cached = 0;
+	unsigned long h = 0, m = 0;
+	int thr;
+
+	if (pool->cache_idx >= 0) {
+		for (thr = 0; thr < global.nbthread; thr++) {
+			cached += pool_cache[thr][pool->cache_idx].count;
+			h += pool_cache[thr][pool->cache_idx].hits;
+			m += pool_cache[thr][pool->cache_idx].misses;
+		}
+	}
+	if (cached > pool->used)
+		cached = pool->used;
+	if (hits)
+		*hits = h;
+	if (misses)
+		*misses = m;
+	return cached;
+}
+
+/* Appends the description of arena <arena> to the trash buffer. The values
+ * are only indicative as they are not locked.
+ */
+static void dump_arena_to_trash(const struct pool_arena *arena)
+{
+	unsigned int used = 0, chunks = 0;
+	int n;
+
+	for (n = 0; n < arena->nbnodes; n++) {
+		used += arena->node[n].used;
+		chunks += arena->node[n].chunks;
+	}
+	chunk_appendf(&trash, "      arena: %lu kB of %s huge pages on %d node%s, %u/%u chunks used, %u fallbacks\n",
+	              (unsigned long)(arena->size >> 10), arena->hugetlb ? "reserved" : "transparent",
+	              arena->nbnodes, arena->nbnodes > 1 ? "s" : "", used, chunks, arena->fallbacks);
+}
+
 /* This function dumps memory usage information into the trash buffer. */
 void dump_pools_to_trash()
 {
 	struct pool_head *entry;
 	unsigned long allocated, used;
+	unsigned long hits, misses;
+	unsigned int cached;
 	int nbpools;
 
 	allocated = used = nbpools = 0;
@@ -374,13 +914,17 @@ void dump_pools_to_trash()
 #ifndef CONFIG_HAP_LOCKLESS_POOLS
 		HA_SPIN_LOCK(POOL_LOCK, &entry->lock);
 #endif
-		chunk_appendf(&trash, "  - Pool %s (%d bytes) : %d allocated (%u bytes), %d used, %d failures, %d users%s\n",
+		cached = pool_cached(entry, &hits, &misses);
+		chunk_appendf(&trash, "  - Pool %s (%d bytes) : %d allocated (%u bytes), %d used, %u cached (%u%% hits), %d failures, %d users%s\n",
 			 entry->name, entry->size, entry->allocated,
-		         entry->size * entry->allocated, entry->used, entry->failed,
-			 entry->users, (entry->flags & MEM_F_SHARED) ? " [SHARED]" : "");
+		         entry->size * entry->allocated, entry->used - cached, cached,
+			 (unsigned int)(hits + misses ? hits * 100 / (hits + misses) : 0),
+			 entry->failed, entry->users, (entry->flags & MEM_F_SHARED) ? " [SHARED]" : "");
+		if (entry->arena)
+			dump_arena_to_trash(entry->arena);
 
 		allocated += entry->allocated * entry->size;
-		used += entry->used * entry->size;
+		used += (entry->used - cached) * entry->size;
 		nbpools++;
 #ifndef CONFIG_HAP_LOCKLESS_POOLS
 		HA_SPIN_UNLOCK(POOL_LOCK, &entry->lock);
@@ -426,7 +970,7 @@ unsigned long pool_total_used()
 	unsigned long used = 0;
 
 	list_for_each_entry(entry, &pools, list)
-		used += entry->used * entry->size;
+		used += (entry->used - pool_cached(entry, NULL, NULL)) * entry->size;
 	return used;
 }
 
@@ -446,6 +990,54 @@ static int cli_io_handler_dump_pools(struct appctx *appctx)
 	return 1;
 }
 
+/* config parser for global "tune.pool-arena" */
+static int mem_parse_pool_arena(char **args, int section_type, struct proxy *curpx,
+                                struct proxy *defpx, const char *file, int line,
+                                char **err)
+{
+	const char *res;
+	unsigned int size;
+	int i;
+
+	if (too_many_args(2, args, err, NULL))
+		return -1;
+
+	if (!*args[1] || !*args[2]) {
+		memprintf(err, "'%s' expects a pool name and a size.", args[0]);
+		return -1;
+	}
+
+	res = parse_size_err(args[2], &size);
+	if (res) {
+		memprintf(err, "unexpected '%s' after size passed to '%s'.", res, args[0]);
+		return -1;
+	}
+	if (!size) {
+		memprintf(err, "'%s' expects a non-null size.", args[0]);
+		return -1;
+	}
+
+	for (i = 0; i < pool_arena_nbreq; i++) {
+		if (strcmp(pool_arena_req[i].name, args[1]) == 0)
+			break;
+	}
+	if (i == MAX_BASE_POOLS) {
+		memprintf(err, "'%s' : too many pools, at most %d are supported.", args[0], MAX_BASE_POOLS);
+		return -1;
+	}
+	if (i == pool_arena_nbreq)
+		pool_arena_nbreq++;
+	strlcpy2(pool_arena_req[i].name, args[1], sizeof(pool_arena_req[i].name));
+	pool_arena_req[i].size = size;
+	return 0;
+}
+
+/* config keyword parsers */
+static struct cfg_kw_list mem_cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.pool-arena", mem_parse_pool_arena },
+	{ 0, NULL, NULL }
+}};
+
 /* register cli keywords */
 static struct cli_kw_list cli_kws = {{ },{
 	{ { "show", "pools",  NULL }, "show pools     : report information about the memory pools usage", NULL, cli_io_handler_dump_pools },
@@ -456,6 +1048,10 @@ __attribute__((constructor))
 static void __memory_init(void)
 {
 	cli_register_kw(&cli_kws);
+	cfg_register_keywords(&mem_cfg_kws);
+	hap_register_post_check(pool_check_arenas);
+	hap_register_per_thread_init(pool_setup_arenas);
+	hap_register_per_thread_deinit(pool_flush_cache);
 }
 
 /*
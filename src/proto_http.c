@@ -4325,7 +4325,7 @@ int http_request_forward_body(struct stream *s, struct channel *req, int an_bit)
  return_bad_req_stats_ok:
 	txn->req.err_state = txn->req.msg_state;
 	txn->req.msg_state = HTTP_MSG_ERROR;
-	if (txn->status) {
+	if (txn->status > 0) {
 		/* Note: we don't send any error if some data were already sent */
 		http_reply_and_close(s, txn->status, NULL);
 	} else {
@@ -4348,7 +4348,7 @@ int http_request_forward_body(struct stream *s, struct channel *req, int an_bit)
  aborted_xfer:
 	txn->req.err_state = txn->req.msg_state;
 	txn->req.msg_state = HTTP_MSG_ERROR;
-	if (txn->status) {
+	if (txn->status > 0) {
 		/* Note: we don't send any error if some data were already sent */
 		http_reply_and_close(s, txn->status, NULL);
 	} else {
@@ -51,6 +51,7 @@
 #include <proto/compression.h>
 #include <proto/stats.h>
 #include <proto/fd.h>
+#include <proto/flt_json.h>
 #include <proto/freq_ctr.h>
 #include <proto/frontend.h>
 #include <proto/log.h>
@@ -217,6 +218,9 @@ const char *stat_field_names[ST_F_TOTAL_FIELDS] = {
 	[ST_F_DCON]           = "dcon",
 	[ST_F_DSES]           = "dses",
 	[ST_F_WREW]           = "wrew",
+	[ST_F_JSON_REC]       = "json_rec",
+	[ST_F_JSON_FAIL]      = "json_fail",
+	[ST_F_JSON_DROP]      = "json_drop",
 };
 
 /* one line of info */
@@ -606,6 +610,21 @@ err:
 	return 0;
 }
 
+/* Appends to <out> the rows of the json filter counters found in <stats>, to
+ * be shown in the hover of the total sessions.
+ */
+static void stats_dump_json_html(struct buffer *out, const struct field *stats)
+{
+	chunk_appendf(out,
+	              "<tr><th>JSON records:</th><td>%s</td></tr>"
+	              "<tr><th>- failed:</th><td>%s</td></tr>"
+	              "<tr><th>- dropped:</th><td>%s</td></tr>"
+	              "",
+	              U2H(stats[ST_F_JSON_REC].u.u64),
+	              U2H(stats[ST_F_JSON_FAIL].u.u64),
+	              U2H(stats[ST_F_JSON_DROP].u.u64));
+}
+
 /* Dump all fields from <stats> into <out> using the HTML format. A column is
  * reserved for the checkbox is ST_SHOWADMIN is set in <flags>. Some extra info
  * are provided if ST_SHLGNDS is present in <flags>.
@@ -711,6 +730,10 @@ static int stats_dump_fields_html(struct buffer *out,
 			              U2H(stats[ST_F_WREW].u.u64));
 		}
 
+		/* json records (via hover): parsed, failed, dropped */
+		if (stats[ST_F_JSON_REC].type)
+			stats_dump_json_html(out, stats);
+
 		chunk_appendf(out,
 		              "</table></div></u></td>"
 		              /* sessions: lbtot, lastsess */
@@ -1177,6 +1200,10 @@ static int stats_dump_fields_html(struct buffer *out,
 			              U2H(stats[ST_F_HRSP_OTHER].u.u64));
 		}
 
+		/* json records (via hover): parsed, failed, dropped */
+		if (stats[ST_F_JSON_REC].type)
+			stats_dump_json_html(out, stats);
+
 		chunk_appendf(out, "<tr><th>- Queue time:</th><td>%s</td><td>ms</td></tr>",   U2H(stats[ST_F_QTIME].u.u32));
 		chunk_appendf(out, "<tr><th>- Connect time:</th><td>%s</td><td>ms</td></tr>", U2H(stats[ST_F_CTIME].u.u32));
 		if (strcmp(field_str(stats, ST_F_MODE), "http") == 0)
@@ -1313,6 +1340,9 @@ int stats_fill_fe_stats(struct proxy *px, struct field *stats, int len)
 	stats[ST_F_RATE_MAX] = mkf_u32(FN_MAX, px->fe_counters.sps_max);
 	stats[ST_F_WREW]     = mkf_u64(FN_COUNTER, px->fe_counters.failed_rewrites);
 
+	/* json records: parsed, failed, dropped */
+	flt_json_fill_stats(px, stats);
+
 	/* http response: 1xx, 2xx, 3xx, 4xx, 5xx, other */
 	if (px->mode == PR_MODE_HTTP) {
 		stats[ST_F_HRSP_1XX]    = mkf_u64(FN_COUNTER, px->fe_counters.p.http.rsp[1]);
@@ -1763,6 +1793,10 @@ int stats_fill_be_stats(struct proxy *px, int flags, struct field *stats, int le
 	stats[ST_F_WREDIS]   = mkf_u64(FN_COUNTER, px->be_counters.redispatches);
 	stats[ST_F_WREW]     = mkf_u64(FN_COUNTER, px->be_counters.failed_rewrites);
 	stats[ST_F_STATUS]   = mkf_str(FO_STATUS, (px->lbprm.tot_weight > 0 || !px->srv) ? "UP" : "DOWN");
+
+	/* json records, already reported on the frontend line of a listen */
+	if (!(px->cap & PR_CAP_FE))
+		flt_json_fill_stats(px, stats);
 	stats[ST_F_WEIGHT]   = mkf_u32(FN_AVG, (px->lbprm.tot_weight * px->lbprm.wmult + px->lbprm.wdiv - 1) / px->lbprm.wdiv);
 	stats[ST_F_ACT]      = mkf_u32(0, px->srv_act);
 	stats[ST_F_BCK]      = mkf_u32(0, px->srv_bck);
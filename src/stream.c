@@ -413,7 +413,8 @@ static void stream_free(struct stream *s)
 
 	/* We may want to free the maximum amount of pools if the proxy is stopping */
 	if (fe && unlikely(fe->state == PR_STSTOPPED)) {
-		pool_flush(pool_head_buffer);
+		for (i = 0; i < nb_buffer_classes; i++)
+			pool_flush(pool_head_buffer_class[i]);
 		pool_flush(pool_head_http_txn);
 		pool_flush(pool_head_hdr_idx);
 		pool_flush(pool_head_requri);
@@ -445,8 +446,16 @@ static int stream_alloc_work_buffer(struct stream *s)
 		HA_SPIN_UNLOCK(BUF_WQ_LOCK, &buffer_wq_lock);
 	}
 
-	if (b_alloc_margin(&s->res.buf, 0))
+	if (b_alloc_small_margin(&s->res.buf, 0)) {
+		/* a full buffer which could not be promoted upon receipt is
+		 * retried here, and we wait for a buffer again on failure.
+		 */
+		if (!channel_may_recv(&s->req) && !(s->req.flags & CF_SHUTR))
+			channel_grow_buffer(&s->req, c_size(&s->req) + 1, &s->buffer_wait);
+		if (!channel_may_recv(&s->res) && !(s->res.flags & CF_SHUTR))
+			channel_grow_buffer(&s->res, c_size(&s->res) + 1, &s->buffer_wait);
 		return 1;
+	}
 
 	HA_SPIN_LOCK(BUF_WQ_LOCK, &buffer_wq_lock);
 	LIST_ADDQ(&buffer_wq, &s->buffer_wait.list);
@@ -2958,7 +2967,7 @@ static int stats_dump_full_strm_to_buffer(struct stream_interface *si, struct st
 			              conn->flags,
 			              conn->handle.fd,
 			              conn->handle.fd >= 0 ? fdtab[conn->handle.fd].state : 0,
-			              conn->handle.fd >= 0 ? fdtab[conn->handle.fd].cache.next >= -2 : 0,
+			              conn->handle.fd >= 0 ? fd_in_cache(conn->handle.fd) : 0,
 			              conn->handle.fd >= 0 ? !!(fdtab[conn->handle.fd].update_mask & tid_bit) : 0,
 				      conn->handle.fd >= 0 ? fdtab[conn->handle.fd].thread_mask: 0);
 		}
@@ -2992,7 +3001,7 @@ static int stats_dump_full_strm_to_buffer(struct stream_interface *si, struct st
 			              conn->flags,
 			              conn->handle.fd,
 			              conn->handle.fd >= 0 ? fdtab[conn->handle.fd].state : 0,
-			              conn->handle.fd >= 0 ? fdtab[conn->handle.fd].cache.next >= -2 : 0,
+			              conn->handle.fd >= 0 ? fd_in_cache(conn->handle.fd) : 0,
 			              conn->handle.fd >= 0 ? !!(fdtab[conn->handle.fd].update_mask & tid_bit) : 0,
 				      conn->handle.fd >= 0 ? fdtab[conn->handle.fd].thread_mask: 0);
 		}
@@ -1235,6 +1235,10 @@ int si_cs_recv(struct conn_stream *cs)
 	       !(cs->flags & (CS_FL_ERROR|CS_FL_EOS)) && !(ic->flags & CF_SHUTR)) {
 		max = channel_recv_max(ic);
 
+		/* a full buffer is first promoted to a larger size class */
+		if (!max && channel_grow_buffer(ic, c_size(ic) + 1, &(si_strm(si)->buffer_wait)))
+			max = channel_recv_max(ic);
+
 		if (!max) {
 			si->flags |= SI_FL_WAIT_ROOM;
 			break;
@@ -1263,7 +1267,8 @@ int si_cs_recv(struct conn_stream *cs)
 		ic->flags |= CF_READ_PARTIAL;
 		ic->total += ret;
 
-		if (!channel_may_recv(ic)) {
+		if (!channel_may_recv(ic) &&
+		    !channel_grow_buffer(ic, c_size(ic) + 1, &(si_strm(si)->buffer_wait))) {
 			si->flags |= SI_FL_WAIT_ROOM;
 			break;
 		}
@@ -10,8 +10,10 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 
+#include <common/cfgparse.h>
 #include <common/config.h>
 #include <common/memory.h>
 #include <common/mini-clist.h>
@@ -57,18 +59,213 @@ static unsigned int rqueue_ticks;  /* insertion count */
 
 struct task_per_thread task_per_thread[MAX_THREADS];
 
+unsigned int profiling = 0;  /* bitfield of HA_PROF_* */
+struct task_prof task_prof[MAX_THREADS][TASK_PROF_HANDLERS];
+
+/* Returns the current thread's profiling entry for task handler <func>,
+ * creating it if needed, or NULL if the table is full.
+ */
+static struct task_prof *task_prof_entry(const void *func)
+{
+	struct task_prof *tbl = task_prof[tid];
+	unsigned int i, idx;
+
+	idx = ((unsigned long)func >> 4) % TASK_PROF_HANDLERS;
+	for (i = 0; i < TASK_PROF_HANDLERS; i++) {
+		if (tbl[idx].func == func)
+			return &tbl[idx];
+		if (!tbl[idx].func) {
+			tbl[idx].func = func;
+			return &tbl[idx];
+		}
+		if (++idx == TASK_PROF_HANDLERS)
+			idx = 0;
+	}
+	return NULL;
+}
+
+/* Inserts task <t>, already accounted for in tasks_run_queue, in run queue
+ * <root> whose size is <rq_size>.
+ */
+static inline void __task_rq_insert(struct task *t, struct eb_root *root, int *rq_size)
+{
+	t->rq.key = HA_ATOMIC_ADD(&rqueue_ticks, 1);
+
+	if (likely(t->nice)) {
+		int offset;
+
+		HA_ATOMIC_ADD(&niced_tasks, 1);
+		if (likely(t->nice > 0))
+			offset = (unsigned)((*rq_size * (unsigned int)t->nice) / 32U);
+		else
+			offset = -(unsigned)((*rq_size * (unsigned int)-t->nice) / 32U);
+		t->rq.key += offset;
+	}
+
+	eb32sc_insert(root, &t->rq, t->thread_mask);
+}
+
+#ifdef USE_THREAD
+/* Pushes task <t>, already accounted for in tasks_run_queue, to the inbox of
+ * thread <thr>, which will move it to its run queue. The inbox is a lock-free
+ * list which only its owner empties, all at once, so that the threads waking
+ * up a task never wait for each other nor for the owner.
+ */
+static void __task_wakeup_remote(struct task *t, int thr)
+{
+	struct task_per_thread *tpt = &task_per_thread[thr];
+	unsigned long old_active_mask;
+	struct task *head;
+
+	HA_ATOMIC_OR(&t->state, TASK_INBOX);
+	head = tpt->inbox;
+	do {
+		t->inbox_next = head;
+		__ha_barrier_store();
+	} while (!HA_ATOMIC_CAS(&tpt->inbox, &head, t));
+
+	old_active_mask = active_tasks_mask;
+	HA_ATOMIC_OR(&active_tasks_mask, 1UL << thr);
+	if ((sleeping_thread_mask & (1UL << thr)) && !(old_active_mask & (1UL << thr)))
+		wake_thread(thr);
+}
+#endif
+
+/* Moves the tasks other threads woke up for the current one from its inbox to
+ * its run queue, in the order they were woken up. The ones another thread
+ * unlinked meanwhile are dropped instead, and released if it freed them.
+ */
+void task_drain_inbox()
+{
+	struct task *t, *next, *list = NULL;
+	unsigned short state;
+
+	t = HA_ATOMIC_XCHG(&task_per_thread[tid].inbox, NULL);
+	while (t) {
+		/* the inbox is last in first out */
+		next = t->inbox_next;
+		t->inbox_next = list;
+		list = t;
+		t = next;
+	}
+
+	while (list) {
+		t = list;
+		list = t->inbox_next;
+		/* no other thread may mark it once it left the inbox */
+		state = HA_ATOMIC_AND(&t->state, ~TASK_INBOX);
+		if (unlikely(state & TASK_UNLINK)) {
+			/* a new wakeup waits for the flag to go, see
+			 * __task_wakeup() */
+			HA_ATOMIC_SUB(&tasks_run_queue, 1);
+			if (state & TASK_FREE) {
+				/* no other thread may reference it anymore */
+				__task_free(t);
+				continue;
+			}
+			t->rq.node.leaf_p = NULL;
+			__ha_barrier_store();
+			HA_ATOMIC_AND(&t->state, ~TASK_UNLINK);
+			continue;
+		}
+		__task_rq_insert(t, &task_per_thread[tid].rqueue, &task_per_thread[tid].rqueue_size);
+		task_per_thread[tid].rqueue_size++;
+		activity[tid].inbox++;
+	}
+}
+
+#ifdef USE_THREAD
+/* Cancels the unlink of task <t> requested while it was in another thread's
+ * inbox, because it is woken up again. Returns 0 if that thread is dropping
+ * it already, in which case the wakeup must be tried again.
+ */
+static int task_cancel_unlink(struct task *t)
+{
+	unsigned short state = t->state;
+
+	while (state & TASK_UNLINK) {
+		if (!(state & TASK_INBOX))
+			return 0;
+		if (HA_ATOMIC_CAS(&t->state, &state, state & ~TASK_UNLINK))
+			break;
+	}
+	return 1;
+}
+#endif
+
+#ifdef USE_THREAD
+/* Moves up to STEAL_BATCH tasks from the current thread's run queue to each of
+ * the idle threads which asked for some, without giving more than half of the
+ * queue. Only the tasks an idle thread may run are given to it, the oldest
+ * first. They go through the idle thread's inbox so that the run queues are
+ * still only modified by their owner.
+ */
+static void task_hand_over()
+{
+	struct task_per_thread *tpt = &task_per_thread[tid];
+	unsigned long req = HA_ATOMIC_XCHG(&tpt->steal_req, 0);
+	struct eb32sc_node *node;
+	struct task *t;
+	int thr, n, given;
+
+	while (req) {
+		thr = my_ffsl(req) - 1;
+		req &= req - 1;
+
+		n = MIN(tpt->rqueue_size / 2, STEAL_BATCH);
+		for (given = 0; given < n; given++) {
+			node = eb32sc_lookup_ge(&tpt->rqueue, rqueue_ticks - TIMER_LOOK_BACK, 1UL << thr);
+			if (!node)
+				node = eb32sc_first(&tpt->rqueue, 1UL << thr);
+			if (!node)
+				break;
+
+			t = eb32sc_entry(node, struct task, rq);
+			__task_unlink_rq(t);
+			__task_wakeup(t, &task_per_thread[thr].rqueue);
+		}
+		if (given)
+			HA_ATOMIC_ADD(&activity[thr].stolen, given);
+	}
+}
+
+/* Asks the thread with the longest run queue to hand some of its tasks over to
+ * the current one, which has nothing left to do. The request is served by the
+ * busy thread on its next call to process_runnable_tasks(), and the tasks wake
+ * the current thread up if it is sleeping by then.
+ */
+static void task_steal_request()
+{
+	int thr, best = -1, max = STEAL_BATCH;
+
+	for (thr = 0; thr < global.nbthread; thr++) {
+		if (thr != tid && task_per_thread[thr].rqueue_size > max) {
+			max = task_per_thread[thr].rqueue_size;
+			best = thr;
+		}
+	}
+
+	if (best < 0 || (task_per_thread[best].steal_req & tid_bit))
+		return;
+	HA_ATOMIC_OR(&task_per_thread[best].steal_req, tid_bit);
+	activity[tid].steal_req++;
+}
+#endif
+
 /* Puts the task <t> in run queue at a position depending on t->nice. <t> is
  * returned. The nice value assigns boosts in 32th of the run queue size. A
  * nice value of -1024 sets the task to -tasks_run_queue*32, while a nice value
  * of 1024 sets the task to tasks_run_queue*32. The state flags are cleared, so
  * the caller will have to set its flags after this call.
  * The task must not already be in the run queue. If unsure, use the safer
- * task_wakeup() function.
+ * task_wakeup() function. When <root> is another thread's run queue, the task
+ * is passed to this thread through its inbox instead.
  */
 void __task_wakeup(struct task *t, struct eb_root *root)
 {
 	void *expected = NULL;
 	int *rq_size;
+	int __maybe_unused nb = tid;
 	unsigned long __maybe_unused old_active_mask;
 
 #ifdef USE_THREAD
@@ -78,15 +275,25 @@ void __task_wakeup(struct task *t, struct eb_root *root)
 	} else
 #endif
 	{
-		int nb = ((void *)root - (void *)&task_per_thread[0].rqueue) / sizeof(task_per_thread[0]);
+		nb = ((void *)root - (void *)&task_per_thread[0].rqueue) / sizeof(task_per_thread[0]);
 		rq_size = &task_per_thread[nb].rqueue_size;
 	}
 	/* Make sure if the task isn't in the runqueue, nobody inserts it
 	 * in the meanwhile.
 	 */
 redo:
+#ifdef USE_THREAD
+	/* the thread owning the inbox it was in is dropping it */
+	while (unlikely((t->state & (TASK_INBOX|TASK_UNLINK)) == TASK_UNLINK))
+		pl_cpu_relax();
+#endif
 	if (unlikely(!HA_ATOMIC_CAS(&t->rq.node.leaf_p, &expected, (void *)0x1))) {
 #ifdef USE_THREAD
+		/* still in an inbox but unlinked, it must be queued again */
+		if (unlikely(t->state & TASK_UNLINK) && !task_cancel_unlink(t)) {
+			expected = NULL;
+			goto redo;
+		}
 		if (root == &rqueue)
 			HA_SPIN_UNLOCK(TASK_RQ_LOCK, &rq_lock);
 #endif
@@ -118,8 +325,16 @@ redo:
 #endif
 		return;
 	}
+	/* tasks moved between run queues keep their first wakeup date */
+	if (unlikely(profiling & HA_PROF_TASKS) && !t->wake_date)
+		t->wake_date = now_mono_time();
 	HA_ATOMIC_ADD(&tasks_run_queue, 1);
 #ifdef USE_THREAD
+	if (root != &rqueue && nb != tid) {
+		/* only the owner of the tree may insert into it */
+		__task_wakeup_remote(t, nb);
+		return;
+	}
 	if (root == &rqueue) {
 		HA_ATOMIC_OR(&global_tasks_mask, t->thread_mask);
 		__ha_barrier_store();
@@ -127,20 +342,7 @@ redo:
 #endif
 	old_active_mask = active_tasks_mask;
 	HA_ATOMIC_OR(&active_tasks_mask, t->thread_mask);
-	t->rq.key = HA_ATOMIC_ADD(&rqueue_ticks, 1);
-
-	if (likely(t->nice)) {
-		int offset;
-
-		HA_ATOMIC_ADD(&niced_tasks, 1);
-		if (likely(t->nice > 0))
-			offset = (unsigned)((*rq_size * (unsigned int)t->nice) / 32U);
-		else
-			offset = -(unsigned)((*rq_size * (unsigned int)-t->nice) / 32U);
-		t->rq.key += offset;
-	}
-
-	eb32sc_insert(root, &t->rq, t->thread_mask);
+	__task_rq_insert(t, root, rq_size);
 #ifdef USE_THREAD
 	if (root == &rqueue) {
 		global_rqueue_size++;
@@ -195,6 +397,162 @@ void __task_queue(struct task *task, struct eb_root *wq)
 	eb32_insert(wq, &task->wq);
 }
 
+/*
+ * __task_queue_wheel()
+ *
+ * Same as __task_queue() for timer wheel <wheel>. The task is placed in the
+ * slot of the lowest level where its expiration date only differs from the
+ * wheel's current date in the level's bits, or in the current slot if it is
+ * already expired. Since the task is only linked into a list, wq.node.leaf_p
+ * is set to 0x1 to tell task_in_wq() and __task_unlink_wq() that it is in a
+ * wheel.
+ */
+void __task_queue_wheel(struct task *task, struct timer_wheel *wheel)
+{
+	unsigned int pos, diff, idx;
+	struct list *head;
+	int l;
+
+	if (likely(task_in_wq(task)))
+		__task_unlink_wq(task);
+
+	task->wq.key = task->expire;
+
+	/* an empty wheel may follow the current date */
+	if (!(wheel->map[0] | wheel->map[1] | wheel->map[2] | wheel->map[3] | wheel->map[4] | wheel->map[5]))
+		wheel->cur = now_ms;
+
+	pos = task->expire;
+	if (tick_is_lt(pos, wheel->cur))
+		pos = wheel->cur;
+
+	diff = pos ^ wheel->cur;
+	for (l = 0; diff >= TIMER_WHEEL_SLOTS; l++)
+		diff >>= TIMER_WHEEL_BITS;
+
+	idx = (pos >> (l * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+	head = &wheel->slot[l][idx];
+	if (!(wheel->map[l] & (1ULL << idx))) {
+		LIST_INIT(head);
+		wheel->map[l] |= 1ULL << idx;
+	}
+	LIST_ADDQ(head, &task->wl);
+	task->wq.node.leaf_p = (void *)0x1;
+}
+
+/* Returns the start date of the first slot after the current one which may
+ * hold tasks in wheel <w>, looking at the lowest levels first, or the wheel's
+ * current date if there is none. It is never later than the expiration date
+ * of any of the tasks of the wheel outside of the current slot. Note that the
+ * slot may start at date zero.
+ */
+static unsigned int wheel_next(const struct timer_wheel *w)
+{
+	unsigned long long map;
+	unsigned int shift, idx, date;
+	int l;
+
+	for (l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+		if (!w->map[l])
+			continue;
+
+		/* rotate the map so that the current slot is bit 0 */
+		shift = l * TIMER_WHEEL_BITS;
+		idx = (w->cur >> shift) & (TIMER_WHEEL_SLOTS - 1);
+		map = (w->map[l] >> idx) | ((w->map[l] << (TIMER_WHEEL_SLOTS - 1 - idx)) << 1);
+		map &= ~1ULL;
+		if (!map)
+			continue;
+
+		/* slots after the last one of the top level wrap with the ticks */
+		date = (w->cur & ~((1U << shift) - 1)) + ((unsigned int)__builtin_ctzll(map) << shift);
+		return date;
+	}
+	return w->cur;
+}
+
+/* Moves the tasks of the slots starting at the current date of wheel <w> to
+ * the lower levels, starting from the highest level so that a task may go down
+ * several levels at once. The tasks whose timer was disabled are removed.
+ */
+static void wheel_cascade(struct timer_wheel *w)
+{
+	struct task *task;
+	struct list *head;
+	unsigned int shift, idx;
+	int l;
+
+	for (l = TIMER_WHEEL_LEVELS - 1; l > 0; l--) {
+		shift = l * TIMER_WHEEL_BITS;
+		if (w->cur & ((1U << shift) - 1))
+			continue;
+
+		idx = (w->cur >> shift) & (TIMER_WHEEL_SLOTS - 1);
+		if (!(w->map[l] & (1ULL << idx)))
+			continue;
+
+		head = &w->slot[l][idx];
+		while (!LIST_ISEMPTY(head)) {
+			task = LIST_ELEM(head->n, struct task *, wl);
+			__task_unlink_wq(task);
+			if (tick_isset(task->expire))
+				__task_queue_wheel(task, w);
+		}
+		w->map[l] &= ~(1ULL << idx);
+	}
+}
+
+/* Wakes up all the expired tasks of wheel <w>, and returns the date of the
+ * next event (or eternity). The wheel's current date moves up to <now_ms>,
+ * jumping over the empty slots.
+ */
+static int wheel_expire(struct timer_wheel *w)
+{
+	struct task *task;
+	struct list *head;
+	unsigned int idx, next;
+
+	while (1) {
+		idx = w->cur & (TIMER_WHEEL_SLOTS - 1);
+		if (w->map[0] & (1ULL << idx)) {
+			head = &w->slot[0][idx];
+			while (!LIST_ISEMPTY(head)) {
+				task = LIST_ELEM(head->n, struct task *, wl);
+				__task_unlink_wq(task);
+
+				/* as with the trees, the task may have been left
+				 * there while its expiration date was pushed later,
+				 * in which case it only has to be moved.
+				 */
+				if (!tick_is_expired(task->expire, now_ms)) {
+					if (tick_isset(task->expire))
+						__task_queue_wheel(task, w);
+					continue;
+				}
+				task_wakeup(task, TASK_WOKEN_TIMER);
+			}
+			w->map[0] &= ~(1ULL << idx);
+		}
+
+		if (!tick_is_lt(w->cur, now_ms))
+			break;
+
+		next = wheel_next(w);
+		if (next == w->cur || tick_is_lt(now_ms, next)) {
+			/* nothing to do in the slots up to now */
+			w->cur = now_ms;
+			break;
+		}
+		w->cur = next;
+		wheel_cascade(w);
+	}
+
+	next = wheel_next(w);
+	if (next == w->cur)
+		return TICK_ETERNITY;
+	return next ? next : 1; /* no task expires at zero */
+}
+
 /*
  * Extract all expired timers from the timer queue, and wakes up all
  * associated tasks. Returns the date of next event (or eternity).
@@ -205,6 +563,10 @@ int wake_expired_tasks()
 	struct eb32_node *eb;
 	int ret = TICK_ETERNITY;
 
+	/* the tree may still hold tasks queued before the wheel was allocated */
+	if (task_per_thread[tid].wheel)
+		ret = wheel_expire(task_per_thread[tid].wheel);
+
 	while (1) {
   lookup_next_local:
 		eb = eb32_lookup_ge(&task_per_thread[tid].timers, now_ms - TIMER_LOOK_BACK);
@@ -220,7 +582,7 @@ int wake_expired_tasks()
 
 		if (tick_is_lt(now_ms, eb->key)) {
 			/* timer not expired yet, revisit it later */
-			ret = eb->key;
+			ret = tick_first(ret, eb->key);
 			break;
 		}
 
@@ -243,7 +605,7 @@ int wake_expired_tasks()
 		 */
 		if (!tick_is_expired(task->expire, now_ms)) {
 			if (tick_isset(task->expire))
-				__task_queue(task, &task_per_thread[tid].timers);
+				__task_queue_local(task);
 			goto lookup_next_local;
 		}
 		task_wakeup(task, TASK_WOKEN_TIMER);
@@ -319,15 +681,30 @@ void process_runnable_tasks()
 	nb_tasks_cur = nb_tasks;
 	max_processed = global.tune.runqueue_depth;
 
-	if (likely(global.nbthread > 1)) {
-		HA_SPIN_LOCK(TASK_RQ_LOCK, &rq_lock);
-		if (!(active_tasks_mask & tid_bit)) {
-			HA_SPIN_UNLOCK(TASK_RQ_LOCK, &rq_lock);
-			activity[tid].empty_rq++;
-			return;
-		}
+	if (!(active_tasks_mask & tid_bit)) {
+		activity[tid].empty_rq++;
+#ifdef USE_THREAD
+		if (global.nbthread > 1)
+			task_steal_request();
+#endif
+		return;
+	}
 
 #ifdef USE_THREAD
+	/* tasks bound to this thread but woken up by other ones */
+	if (task_per_thread[tid].inbox)
+		task_drain_inbox();
+
+	/* idle threads want some of our tasks */
+	if (task_per_thread[tid].steal_req)
+		task_hand_over();
+
+	/* the global run queue only holds the tasks several threads may run,
+	 * it is only locked when some of them are for this thread.
+	 */
+	if (global_tasks_mask & tid_bit) {
+		HA_SPIN_LOCK(TASK_RQ_LOCK, &rq_lock);
+
 		/* Get some elements from the global run queue and put it in the
 		 * local run queue. To try to keep a bit of fairness, just get as
 		 * much elements from the global list as to have a bigger local queue
@@ -356,15 +733,10 @@ void process_runnable_tasks()
 			__task_unlink_rq(t);
 			__task_wakeup(t, &task_per_thread[tid].rqueue);
 		}
-#endif
 
 		HA_SPIN_UNLOCK(TASK_RQ_LOCK, &rq_lock);
-	} else {
-		if (!(active_tasks_mask & tid_bit)) {
-			activity[tid].empty_rq++;
-			return;
-		}
 	}
+#endif
 	/* Get some tasks from the run queue, make sure we don't
 	 * get too much in the task list, but put a bit more than
 	 * the max that will be run, to give a bit more fairness
@@ -396,10 +768,11 @@ void process_runnable_tasks()
 		/* And add it to the local task list */
 		task_insert_into_tasklet_list(t);
 	}
-	if (!(global_tasks_mask & tid_bit) && task_per_thread[tid].rqueue_size == 0) {
+	if (!(global_tasks_mask & tid_bit) && task_per_thread[tid].rqueue_size == 0 &&
+	    !task_per_thread[tid].inbox) {
 		HA_ATOMIC_AND(&active_tasks_mask, ~tid_bit);
 		__ha_barrier_load();
-		if (global_tasks_mask & tid_bit)
+		if ((global_tasks_mask & tid_bit) || task_per_thread[tid].inbox)
 			HA_ATOMIC_OR(&active_tasks_mask, tid_bit);
 	}
 	while (max_processed > 0 && !LIST_ISEMPTY(&task_per_thread[tid].task_list)) {
@@ -407,6 +780,8 @@ void process_runnable_tasks()
 		unsigned short state;
 		void *ctx;
 		struct task *(*process)(struct task *t, void *ctx, unsigned short state);
+		struct task_prof *prof = NULL;
+		unsigned long long start = 0;
 
 		t = (struct task *)LIST_ELEM(task_per_thread[tid].task_list.n, struct tasklet *, list);
 		state = HA_ATOMIC_XCHG(&t->state, TASK_RUNNING);
@@ -416,6 +791,21 @@ void process_runnable_tasks()
 		ctx = t->context;
 		process = t->process;
 		t->calls++;
+
+		if (unlikely(profiling & HA_PROF_TASKS) && (prof = task_prof_entry(process))) {
+			prof->calls++;
+			if (t->wake_date) {
+				unsigned long long lat = now_mono_time() - t->wake_date;
+				unsigned int us = MIN(lat / 1000, 0x7fffffffULL);
+
+				prof->lat_calls++;
+				prof->lat_ns += lat;
+				prof->lat_hist[us ? MIN(flsnz(us), TASK_PROF_BUCKETS - 1) : 0]++;
+			}
+			start = rdtsc();
+		}
+		t->wake_date = 0;
+
 		curr_task = (struct task *)t;
 		if (likely(process == process_stream))
 			t = process_stream(t, ctx, state);
@@ -428,18 +818,16 @@ void process_runnable_tasks()
 			}
 		}
 		curr_task = NULL;
+		if (prof)
+			prof->cycles += rdtsc() - start;
+
 		/* If there is a pending state  we have to wake up the task
 		 * immediatly, else we defer it into wait queue
 		 */
 		if (t != NULL) {
 			state = HA_ATOMIC_AND(&t->state, ~TASK_RUNNING);
 			if (state)
-#ifdef USE_THREAD
-				__task_wakeup(t, ((t->thread_mask & all_threads_mask) == tid_bit) ?
-				    &task_per_thread[tid].rqueue : &rqueue);
-#else
-				__task_wakeup(t, &task_per_thread[tid].rqueue);
-#endif
+				__task_wakeup(t, task_rq_root(t));
 			else
 				task_queue(t);
 		}
@@ -480,6 +868,84 @@ int init_task()
 	return 1;
 }
 
+/* allocates the current thread's timer wheel when "tune.timers wheel" is set */
+static int alloc_timer_wheel_per_thread()
+{
+	struct timer_wheel *wheel;
+
+	if (!(global.tune.options & GTUNE_TIMER_WHEEL))
+		return 1;
+
+	wheel = calloc(1, sizeof(*wheel));
+	if (!wheel)
+		return 0;
+	wheel->cur = now_ms;
+	task_per_thread[tid].wheel = wheel;
+	return 1;
+}
+
+static void deinit_timer_wheels()
+{
+	int i;
+
+	for (i = 0; i < MAX_THREADS; i++) {
+		free(task_per_thread[i].wheel);
+		task_per_thread[i].wheel = NULL;
+	}
+}
+
+/* config parser for global "profiling.tasks" */
+static int task_parse_global_profiling(char **args, int section_type, struct proxy *curpx,
+                                       struct proxy *defpx, const char *file, int line,
+                                       char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		profiling |= HA_PROF_TASKS;
+	else if (strcmp(args[1], "off") == 0)
+		profiling &= ~HA_PROF_TASKS;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.timers" */
+static int task_parse_global_timers(char **args, int section_type, struct proxy *curpx,
+                                    struct proxy *defpx, const char *file, int line,
+                                    char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "tree") == 0)
+		global.tune.options &= ~GTUNE_TIMER_WHEEL;
+	else if (strcmp(args[1], "wheel") == 0)
+		global.tune.options |= GTUNE_TIMER_WHEEL;
+	else {
+		memprintf(err, "'%s' expects either 'tree' or 'wheel' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "profiling.tasks", task_parse_global_profiling },
+	{ CFG_GLOBAL, "tune.timers", task_parse_global_timers },
+	{ 0, NULL, NULL }
+}};
+
+__attribute__((constructor))
+static void __task_init(void)
+{
+	cfg_register_keywords(&cfg_kws);
+	hap_register_per_thread_init(alloc_timer_wheel_per_thread);
+	hap_register_post_deinit(deinit_timer_wheels);
+}
+
 /*
  * Local variables:
  *  c-indent-level: 8
@@ -0,0 +1,328 @@
+/*
+ * Compares two ways for threads to add and remove FDs from the FD cache shared
+ * by several threads :
+ *  - "list" : the lock-free doubly linked list which fd_add_to_fd_list() and
+ *             fd_rm_from_fd_list() used to maintain ;
+ *  - "set"  : the bitmap with its summary that fdset_add() and fdset_del()
+ *             maintain.
+ * Each thread repeatedly adds and removes its own FDs, as fd_may_recv() and
+ * fd_cant_recv() do, while one of them also walks the cache the way
+ * fd_process_cached_events() does.
+ *
+ * Build with :
+ *   gcc -O2 -o test_fdcache tests/test_fdcache.c -lpthread
+ *
+ * usage: test_fdcache [threads [operations per thread]]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define LONGBITS ((unsigned int)sizeof(long) * 8)
+#define FDS_PER_THREAD 256
+
+struct entry {
+	int next;
+	int prev;
+} __attribute__((aligned(8)));
+
+/* an entry as seen by the 8-byte CAS */
+union entry_cas {
+	struct entry e;
+	unsigned long long u;
+};
+
+struct list {
+	int first;
+	int last;
+} __attribute__((aligned(8)));
+
+struct set {
+	unsigned long *bits;
+	unsigned long *summary;
+	unsigned int nbsum;
+};
+
+static union entry_cas *entries;
+static volatile struct list list = { -1, -1 };
+static struct set set;
+
+static int nbthreads = 4;
+static int nbops = 1000000;
+static int use_set;
+static volatile int running;
+static unsigned long retries[64];
+
+#define CAS(ptr, old, new) __atomic_compare_exchange_n(ptr, old, new, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define STORE_BARRIER()    __atomic_thread_fence(__ATOMIC_RELEASE)
+
+/* the list, as formerly done by fd_add_to_fd_list() */
+static void list_add(int fd, int thr)
+{
+	int next, old, last;
+
+redo_next:
+	next = entries[fd].e.next;
+	if (next >= -2)
+		return;
+	if (!CAS(&entries[fd].e.next, &next, -2)) {
+		retries[thr]++;
+		goto redo_next;
+	}
+	STORE_BARRIER();
+redo_last:
+	last = list.last;
+	old = -1;
+	entries[fd].e.prev = -2;
+	STORE_BARRIER();
+	if (last == -1) {
+		if (!CAS(&list.last, &old, fd)) {
+			retries[thr]++;
+			goto redo_last;
+		}
+		list.first = fd;
+	} else {
+		if (!CAS(&entries[last].e.next, &old, fd)) {
+			retries[thr]++;
+			goto redo_last;
+		}
+		list.last = fd;
+	}
+	STORE_BARRIER();
+	entries[fd].e.prev = last;
+	entries[fd].e.next = -1;
+	STORE_BARRIER();
+}
+
+/* the list, as formerly done by fd_rm_from_fd_list() with an 8-byte CAS */
+static void list_del(int fd, int thr)
+{
+	union entry_cas cur, locked = { .e = { -2, -2 } };
+	int old, prev, next, last;
+
+lock_self:
+	cur.u = __atomic_load_n(&entries[fd].u, __ATOMIC_SEQ_CST);
+	do {
+		if (cur.e.next <= -3)
+			return;
+		if (cur.e.prev == -2 || cur.e.next == -2) {
+			retries[thr]++;
+			goto lock_self;
+		}
+	} while (!CAS(&entries[fd].u, &cur.u, locked.u));
+	next = cur.e.next;
+	prev = cur.e.prev;
+	STORE_BARRIER();
+
+	if (prev != -1) {
+redo_prev:
+		old = fd;
+		if (!CAS(&entries[prev].e.next, &old, -2)) {
+			retries[thr]++;
+			if (old == -2) {
+				entries[fd].e.prev = prev;
+				STORE_BARRIER();
+				entries[fd].e.next = next;
+				STORE_BARRIER();
+				goto lock_self;
+			}
+			goto redo_prev;
+		}
+	}
+	if (next != -1) {
+redo_next:
+		old = fd;
+		if (!CAS(&entries[next].e.prev, &old, -2)) {
+			retries[thr]++;
+			if (old == -2) {
+				if (prev != -1) {
+					entries[prev].e.next = fd;
+					STORE_BARRIER();
+				}
+				entries[fd].e.prev = prev;
+				STORE_BARRIER();
+				entries[fd].e.next = next;
+				STORE_BARRIER();
+				goto lock_self;
+			}
+			goto redo_next;
+		}
+	}
+	if (list.first == fd)
+		list.first = next;
+	STORE_BARRIER();
+	last = list.last;
+	while (last == fd && !CAS(&list.last, &last, prev))
+		;
+	STORE_BARRIER();
+	if (prev != -1)
+		entries[prev].e.next = next;
+	STORE_BARRIER();
+	if (next != -1)
+		entries[next].e.prev = prev;
+	STORE_BARRIER();
+	entries[fd].e.next = -(next + 4);
+	STORE_BARRIER();
+}
+
+/* walks the list, returns the number of entries seen */
+static int list_walk()
+{
+	int fd, old_fd, n = 0;
+
+	for (old_fd = fd = list.first; fd != -1; fd = entries[fd].e.next) {
+		if (fd == -2) {
+			fd = old_fd;
+			continue;
+		} else if (fd <= -3)
+			fd = -fd - 4;
+		if (fd == -1)
+			break;
+		old_fd = fd;
+		if (entries[fd].e.next < -3)
+			continue;
+		n++;
+	}
+	return n;
+}
+
+/* the set, as done by fdset_add() */
+static void set_add(int fd, int thr)
+{
+	unsigned int w = fd / LONGBITS;
+	unsigned long sbit = 1UL << (w % LONGBITS);
+
+	if (__atomic_fetch_or(&set.bits[w], 1UL << (fd % LONGBITS), __ATOMIC_SEQ_CST) & (1UL << (fd % LONGBITS)))
+		return;
+	if (!(((volatile unsigned long *)set.summary)[w / LONGBITS] & sbit))
+		__atomic_or_fetch(&set.summary[w / LONGBITS], sbit, __ATOMIC_SEQ_CST);
+}
+
+/* the set, as done by fdset_del() */
+static void set_del(int fd, int thr)
+{
+	unsigned long bit = 1UL << (fd % LONGBITS);
+
+	if (((volatile unsigned long *)set.bits)[fd / LONGBITS] & bit)
+		__atomic_and_fetch(&set.bits[fd / LONGBITS], ~bit, __ATOMIC_SEQ_CST);
+}
+
+/* walks the set as fdset_process_cached_events() does, returns the number of
+ * entries seen.
+ */
+static int set_walk()
+{
+	unsigned long sum, bits, sbit;
+	unsigned int s, w;
+	int n = 0;
+
+	for (s = 0; s < set.nbsum; s++) {
+		for (sum = ((volatile unsigned long *)set.summary)[s]; sum; sum &= sum - 1) {
+			sbit = sum & -sum;
+			w = s * LONGBITS + __builtin_ctzl(sum);
+			bits = ((volatile unsigned long *)set.bits)[w];
+			if (!bits) {
+				__atomic_and_fetch(&set.summary[s], ~sbit, __ATOMIC_SEQ_CST);
+				bits = ((volatile unsigned long *)set.bits)[w];
+				if (!bits)
+					continue;
+				__atomic_or_fetch(&set.summary[s], sbit, __ATOMIC_SEQ_CST);
+			}
+			n += __builtin_popcountl(bits);
+		}
+	}
+	return n;
+}
+
+static void *worker(void *arg)
+{
+	long thr = (long)arg;
+	int first = thr * FDS_PER_THREAD;
+	unsigned int rnd = thr + 1;
+	long walked = 0;
+	int i, fd;
+
+	while (!running)
+		sched_yield();
+
+	for (i = 0; i < nbops; i++) {
+		/* xorshift, so that the FDs are not touched in order */
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+		fd = first + rnd % FDS_PER_THREAD;
+
+		if (use_set) {
+			if (rnd & 0x10000)
+				set_add(fd, thr);
+			else
+				set_del(fd, thr);
+			if (!thr && !(i & 63))
+				walked += set_walk();
+		}
+		else {
+			if (rnd & 0x10000)
+				list_add(fd, thr);
+			else
+				list_del(fd, thr);
+			if (!thr && !(i & 63))
+				walked += list_walk();
+		}
+	}
+	return (void *)walked;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *thr;
+	struct timeval start, stop;
+	double elapsed;
+	unsigned long total_retries;
+	void *walked;
+	long i;
+	int maxfd;
+
+	if (argc > 1)
+		nbthreads = atoi(argv[1]);
+	if (argc > 2)
+		nbops = atoi(argv[2]);
+	if (nbthreads <= 0 || nbthreads > 64 || nbops <= 0) {
+		fprintf(stderr, "usage: %s [threads (1-64) [operations per thread]]\n", argv[0]);
+		exit(1);
+	}
+
+	maxfd = nbthreads * FDS_PER_THREAD;
+	entries = calloc(maxfd, sizeof(*entries));
+	set.nbsum = ((maxfd + LONGBITS - 1) / LONGBITS + LONGBITS - 1) / LONGBITS;
+	set.bits = calloc(set.nbsum * LONGBITS, sizeof(*set.bits));
+	set.summary = calloc(set.nbsum, sizeof(*set.summary));
+	thr = calloc(nbthreads, sizeof(*thr));
+	if (!entries || !set.bits || !set.summary || !thr)
+		exit(1);
+
+	for (use_set = 0; use_set < 2; use_set++) {
+		for (i = 0; i < maxfd; i++)
+			entries[i].e.next = -3;
+		running = 0;
+		for (i = 0; i < nbthreads; i++) {
+			retries[i] = 0;
+			pthread_create(&thr[i], NULL, worker, (void *)i);
+		}
+		gettimeofday(&start, NULL);
+		running = 1;
+		for (i = 0; i < nbthreads; i++)
+			pthread_join(thr[i], i ? NULL : &walked);
+		gettimeofday(&stop, NULL);
+
+		for (total_retries = i = 0; i < nbthreads; i++)
+			total_retries += retries[i];
+		elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) * 1.0e-6;
+		printf("%-4s %d threads : %.0f ops/s, %lu CAS retries, %ld entries walked\n",
+		       use_set ? "set" : "list", nbthreads,
+		       (double)nbthreads * nbops / elapsed, total_retries, (long)walked);
+	}
+	return 0;
+}
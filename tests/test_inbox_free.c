@@ -0,0 +1,215 @@
+/*
+ * Checks that a task woken up into another thread's inbox may be freed before
+ * that thread takes it, as task_unlink_rq(), task_free() and
+ * task_drain_inbox() do with TASK_INBOX, TASK_UNLINK and TASK_FREE :
+ *  - the wakers push their tasks to the inbox of the owner, then immediately
+ *    unlink and free them ;
+ *  - the owner repeatedly takes its whole inbox and either queues the tasks
+ *    or drops the unlinked ones, releasing those which were freed.
+ * A released task is only marked dead so that any later access to it by the
+ * owner is reported as a use after free. The "naive" mode releases the tasks
+ * immediately like task_free() used to, and is expected to report errors.
+ *
+ * Build with :
+ *   gcc -O2 -o test_inbox_free tests/test_inbox_free.c -lpthread
+ *
+ * usage: test_inbox_free [wakers [tasks per waker [naive]]]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TASK_INBOX 0x0004
+#define TASK_UNLINK 0x0008
+#define TASK_FREE 0x0010
+
+#define TASK_ALIVE 0x7a5c
+#define TASK_DEAD  0xdead
+
+struct task {
+	struct task *inbox_next;
+	unsigned short state;
+	unsigned int magic;
+	int ran;           /* set once the owner does not reference it anymore */
+};
+
+static struct task *inbox;
+static int nbwakers = 3;
+static int nbtasks = 100000;
+static int naive;
+static int wakers_left;
+
+static unsigned int released, deferred, dropped, queued, errors;
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__asm__ volatile("rep;nop\n" ::: "memory");
+#else
+	__asm__ volatile("" ::: "memory");
+#endif
+}
+
+/* marks task <t> dead, reporting a double free */
+static void task_release(struct task *t)
+{
+	if (__atomic_exchange_n(&t->magic, TASK_DEAD, __ATOMIC_SEQ_CST) != TASK_ALIVE)
+		__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&released, 1, __ATOMIC_RELAXED);
+}
+
+static void task_wakeup_remote(struct task *t)
+{
+	struct task *head;
+
+	__atomic_or_fetch(&t->state, TASK_INBOX, __ATOMIC_SEQ_CST);
+	head = __atomic_load_n(&inbox, __ATOMIC_RELAXED);
+	do {
+		t->inbox_next = head;
+	} while (!__atomic_compare_exchange_n(&inbox, &head, t, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* same as the inbox part of task_unlink_rq() */
+static void task_unlink(struct task *t)
+{
+	unsigned short state = __atomic_load_n(&t->state, __ATOMIC_RELAXED);
+
+	while (state & TASK_INBOX) {
+		if (__atomic_compare_exchange_n(&t->state, &state, state | TASK_UNLINK, 0,
+		                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
+/* same as task_free(), the task being released once the owner is done with
+ * it when it left the inbox.
+ */
+static void task_free(struct task *t)
+{
+	unsigned short state = __atomic_load_n(&t->state, __ATOMIC_RELAXED);
+
+	if (naive) {
+		task_release(t);
+		return;
+	}
+
+	while (state & (TASK_INBOX|TASK_UNLINK)) {
+		if (!(state & TASK_INBOX)) {
+			cpu_relax();
+			state = __atomic_load_n(&t->state, __ATOMIC_ACQUIRE);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&t->state, &state, state | TASK_UNLINK | TASK_FREE, 0,
+		                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			__atomic_add_fetch(&deferred, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+	/* in the run queue, wait for the owner to be done with it */
+	while (!__atomic_load_n(&t->ran, __ATOMIC_ACQUIRE))
+		sched_yield();
+	task_release(t);
+}
+
+/* same as task_drain_inbox(), except that the queued tasks are run at once */
+static void task_drain_inbox()
+{
+	struct task *t, *next, *list = NULL;
+	unsigned short state;
+
+	t = __atomic_exchange_n(&inbox, NULL, __ATOMIC_ACQUIRE);
+	while (t) {
+		next = t->inbox_next;
+		t->inbox_next = list;
+		list = t;
+		t = next;
+	}
+
+	while (list) {
+		t = list;
+		if (__atomic_load_n(&t->magic, __ATOMIC_RELAXED) != TASK_ALIVE) {
+			/* freed while still in the inbox */
+			__atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+			list = t->inbox_next;
+			continue;
+		}
+		list = t->inbox_next;
+		state = __atomic_fetch_and(&t->state, ~TASK_INBOX, __ATOMIC_SEQ_CST);
+		if (state & TASK_UNLINK) {
+			dropped++;
+			if (state & TASK_FREE) {
+				task_release(t);
+				continue;
+			}
+			__atomic_store_n(&t->ran, 1, __ATOMIC_RELEASE);
+			__atomic_and_fetch(&t->state, ~TASK_UNLINK, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		queued++;
+		__atomic_store_n(&t->ran, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void *owner(void *arg)
+{
+	while (__atomic_load_n(&wakers_left, __ATOMIC_ACQUIRE) || __atomic_load_n(&inbox, __ATOMIC_RELAXED)) {
+		if (!__atomic_load_n(&inbox, __ATOMIC_RELAXED))
+			sched_yield();
+		task_drain_inbox();
+	}
+	return NULL;
+}
+
+static void *waker(void *arg)
+{
+	struct task *tasks = arg;
+	int i;
+
+	for (i = 0; i < nbtasks; i++) {
+		tasks[i].magic = TASK_ALIVE;
+		task_wakeup_remote(&tasks[i]);
+		if (i & 1)
+			sched_yield();
+		task_unlink(&tasks[i]);
+		task_free(&tasks[i]);
+	}
+	__atomic_sub_fetch(&wakers_left, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *thr;
+	struct task *tasks;
+	int i;
+
+	if (argc > 1)
+		nbwakers = atoi(argv[1]);
+	if (argc > 2)
+		nbtasks = atoi(argv[2]);
+	if (argc > 3)
+		naive = strcmp(argv[3], "naive") == 0;
+
+	thr = calloc(nbwakers + 1, sizeof(*thr));
+	tasks = calloc((size_t)nbwakers * nbtasks, sizeof(*tasks));
+	if (!thr || !tasks) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	/* the owner stops once all wakers are done and the inbox is empty */
+	wakers_left = nbwakers;
+	for (i = 0; i < nbwakers; i++)
+		pthread_create(&thr[i + 1], NULL, waker, tasks + (size_t)i * nbtasks);
+	pthread_create(&thr[0], NULL, owner, NULL);
+	for (i = 0; i <= nbwakers; i++)
+		pthread_join(thr[i], NULL);
+
+	printf("wakers=%d tasks=%u released=%u deferred=%u dropped=%u queued=%u errors=%u\n",
+	       nbwakers, nbwakers * nbtasks, released, deferred, dropped, queued, errors);
+
+	return errors || released != (unsigned int)(nbwakers * nbtasks);
+}
@@ -0,0 +1,176 @@
+/*
+ * Compares two ways for threads to wake up tasks bound to another thread :
+ *  - "lock"  : the wakers insert the task in a run queue shared with the
+ *              owner, under a spinlock, as the global run queue does ;
+ *  - "inbox" : the wakers push the task onto a lock-free list of the owner,
+ *              which takes the whole list at once and inserts the tasks in
+ *              its private run queue, as task_drain_inbox() does.
+ *
+ * Build with :
+ *   gcc -O2 -Iinclude -Iebtree -o test_wakeup tests/test_wakeup.c \
+ *       ebtree/eb32sctree.c ebtree/ebtree.c -lpthread
+ *
+ * usage: test_wakeup [wakers [wakeups per waker]]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <eb32sctree.h>
+
+struct task {
+	struct eb32sc_node rq;
+	struct task *inbox_next;
+	volatile int queued;
+};
+
+static struct eb_root rqueue = EB_ROOT_UNIQUE;
+static pthread_spinlock_t rq_lock;
+static struct task *volatile inbox;
+static unsigned int rqueue_ticks;
+
+static int nbwakers = 3;
+static int nbwakeups = 1000000;
+static int use_inbox;
+static volatile int wakers_done;
+
+/* tasks of each waker, only woken up again once run */
+static struct task *tasks;
+#define TASKS_PER_WAKER 64
+
+static void wake_lock(struct task *t)
+{
+	pthread_spin_lock(&rq_lock);
+	t->rq.key = ++rqueue_ticks;
+	eb32sc_insert(&rqueue, &t->rq, 1);
+	pthread_spin_unlock(&rq_lock);
+}
+
+static void wake_inbox(struct task *t)
+{
+	struct task *head = inbox;
+
+	do {
+		t->inbox_next = head;
+	} while (!__atomic_compare_exchange_n(&inbox, &head, t, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void *waker(void *arg)
+{
+	struct task *mine = tasks + (long)arg * TASKS_PER_WAKER;
+	int i = 0, n = 0;
+
+	while (n < nbwakeups) {
+		struct task *t = &mine[i++ % TASKS_PER_WAKER];
+
+		if (__atomic_load_n(&t->queued, __ATOMIC_ACQUIRE)) {
+			/* let the owner run them */
+			sched_yield();
+			continue;
+		}
+		t->queued = 1;
+		if (use_inbox)
+			wake_inbox(t);
+		else
+			wake_lock(t);
+		n++;
+	}
+	__atomic_add_fetch(&wakers_done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+/* runs the tasks in the run queue, returns the number of tasks run */
+static long run_queue(struct eb_root *root, int locked)
+{
+	struct eb32sc_node *node;
+	long run = 0;
+
+	while (1) {
+		if (locked)
+			pthread_spin_lock(&rq_lock);
+		node = eb32sc_first(root, 1);
+		if (node)
+			eb32sc_delete(node);
+		if (locked)
+			pthread_spin_unlock(&rq_lock);
+		if (!node)
+			break;
+		__atomic_store_n(&container_of(node, struct task, rq)->queued, 0, __ATOMIC_RELEASE);
+		run++;
+	}
+	return run;
+}
+
+static long owner()
+{
+	struct eb_root local = EB_ROOT_UNIQUE;
+	struct task *t, *next, *list;
+	long run = 0, prev = 0;
+	int done;
+
+	do {
+		if (run == prev)
+			sched_yield();
+		prev = run;
+		done = __atomic_load_n(&wakers_done, __ATOMIC_ACQUIRE) == nbwakers;
+		if (!use_inbox) {
+			run += run_queue(&rqueue, 1);
+			continue;
+		}
+		t = __atomic_exchange_n(&inbox, NULL, __ATOMIC_ACQUIRE);
+		for (list = NULL; t; t = next) {
+			next = t->inbox_next;
+			t->inbox_next = list;
+			list = t;
+		}
+		for (; list; list = list->inbox_next) {
+			list->rq.key = ++rqueue_ticks;
+			eb32sc_insert(&local, &list->rq, 1);
+		}
+		run += run_queue(&local, 0);
+	} while (!done);
+	return run;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t *thr;
+	struct timeval start, stop;
+	double elapsed;
+	long i, run;
+
+	if (argc > 1)
+		nbwakers = atoi(argv[1]);
+	if (argc > 2)
+		nbwakeups = atoi(argv[2]);
+	if (nbwakers <= 0 || nbwakeups <= 0) {
+		fprintf(stderr, "usage: %s [wakers [wakeups per waker]]\n", argv[0]);
+		exit(1);
+	}
+
+	pthread_spin_init(&rq_lock, PTHREAD_PROCESS_PRIVATE);
+	tasks = calloc(nbwakers * TASKS_PER_WAKER, sizeof(*tasks));
+	thr = calloc(nbwakers, sizeof(*thr));
+	if (!tasks || !thr)
+		exit(1);
+
+	for (use_inbox = 0; use_inbox < 2; use_inbox++) {
+		wakers_done = 0;
+		gettimeofday(&start, NULL);
+		for (i = 0; i < nbwakers; i++)
+			pthread_create(&thr[i], NULL, waker, (void *)i);
+		run = owner();
+		for (i = 0; i < nbwakers; i++)
+			pthread_join(thr[i], NULL);
+		gettimeofday(&stop, NULL);
+
+		elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) * 1.0e-6;
+		printf("%-6s %d wakers : %ld tasks run in %.3f s, %.0f wakeups/s%s\n",
+		       use_inbox ? "inbox" : "lock", nbwakers, run, elapsed, run / elapsed,
+		       run == (long)nbwakers * nbwakeups ? "" : " (MISMATCH)");
+	}
+	return 0;
+}